@@ -12,6 +12,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "disk.h"
 
 #define DISK_SEEKDELAY 10
@@ -32,6 +33,7 @@ struct disk {
 	unsigned long numSectors;	//Numero de setores
 	unsigned long size;		//Espaco util total para dados no disco
 	unsigned long currCylinder;	//Cilindro atual 
+	pthread_mutex_t lock;		//Posse da cabeca (e de fp) por uma operacao
 };
 
 
@@ -73,6 +75,7 @@ Disk* diskConnect(int id, char* rawDiskPath) {
 		d->numCylinders = d->numSectors / DISK_SECTORSPERTRACK;
 		d->size = d->numSectors * DISK_SECTORDATASIZE;
 		d->currCylinder = 0;
+		pthread_mutex_init (&d->lock, NULL);
 	}
 	return d;
 }
@@ -80,6 +83,7 @@ Disk* diskConnect(int id, char* rawDiskPath) {
 //Funcao que disconecta um disco fisico do sistema operacional
 int diskDisconnect(Disk* d) {
 	int result = fclose (d->fp);
+	pthread_mutex_destroy (&d->lock);
 	free(d);
 	return result;
 }
@@ -109,7 +113,11 @@ unsigned long diskGetSize (Disk* d) {
 //Funcao que retorna o cilindro sobre o qual as cabecas estao atualmente
 //posicionadas em um disco
 unsigned long diskGetCurrentCylinder (Disk* d) {
-	return d->currCylinder;
+	unsigned long cyl;
+	pthread_mutex_lock (&d->lock);
+	cyl = d->currCylinder;
+	pthread_mutex_unlock (&d->lock);
+	return cyl;
 }
 
 //Funcao que escreve em *cyl o numero do cilindro correspondente a um endereco
@@ -122,24 +130,88 @@ int diskAddrToCylinder (Disk* d, unsigned long addr, unsigned long *cyl) {
 
 //Funcao para realizar a leitura de um setor identificado pelo endereco LBA
 //(addr). Os dados sao transferidos para *data. Retorna 0 se a leitura ocorreu
-//sem erros e -1 caso contrario
+//sem erros e -1 caso contrario. Como as demais operacoes de leitura e
+//escrita, pode ser chamada de varias threads: o posicionamento e a
+//transferencia ocorrem juntos, com a cabeca reservada para a operacao
 int diskReadSector (Disk* d, unsigned long addr, unsigned char *data) {
+	int ret = 0;
 	if (addr >= d->numSectors) return -1;
+	pthread_mutex_lock (&d->lock);
 	__diskSeek (d,addr);
 	if (fread (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
+		ret = -1;
+	pthread_mutex_unlock (&d->lock);
+	return ret;
+}
+
+//Funcao para realizar a leitura de count setores consecutivos, a partir do
+//endereco LBA (addr), em uma unica operacao: a cabeca e' posicionada uma vez
+//e os setores sao lidos em sequencia. Os dados sao transferidos para *data,
+//que deve comportar count setores. Retorna 0 se a leitura ocorreu sem erros
+//e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned long count,
+                     unsigned char* data) {
+	int ret = 0;
+	if (count == 0 || addr >= d->numSectors || count > d->numSectors - addr)
 		return -1;
-	return 0;
+	pthread_mutex_lock (&d->lock);
+	__diskSeek (d,addr);
+	for (unsigned long i = 0; i < count && ret == 0; i++) {
+		//Entre setores da mesma trilha, basta pular o ECC e o preambulo
+		if (i > 0) {
+			if ((addr + i) % DISK_SECTORSPERTRACK == 0)
+				__diskSeek (d, addr + i);
+			else
+				fseek (d->fp, 2*DISK_SECTORDATAOFFSET, SEEK_CUR);
+		}
+		if (fread (data + i*DISK_SECTORDATASIZE, 1, DISK_SECTORDATASIZE,
+		           d->fp) != DISK_SECTORDATASIZE)
+			ret = -1;
+	}
+	pthread_mutex_unlock (&d->lock);
+	return ret;
 }
 
 //Funcao para realzar a escrita de um setor identificado pelo endereco LBA
 //(addr). Os dados sao transferidos a partir de *data. Retorna 0 se a leitura
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long addr, unsigned char* data) {
+	int ret = 0;
 	if (addr >= d->numSectors) return -1;
+	pthread_mutex_lock (&d->lock);
 	__diskSeek (d,addr);
 	if (fwrite (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
+		ret = -1;
+	pthread_mutex_unlock (&d->lock);
+	return ret;
+}
+
+//Funcao para realizar a escrita de count setores consecutivos, a partir do
+//endereco LBA (addr), em uma unica operacao: a cabeca e' posicionada uma vez
+//e os setores sao escritos em sequencia. Os dados sao transferidos a partir
+//de *data, que deve conter count setores. Retorna 0 se a escrita ocorreu sem
+//erros e -1 caso contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned long count,
+                      unsigned char* data) {
+	int ret = 0;
+	if (count == 0 || addr >= d->numSectors || count > d->numSectors - addr)
 		return -1;
-	return 0;
+	pthread_mutex_lock (&d->lock);
+	__diskSeek (d,addr);
+	for (unsigned long i = 0; i < count && ret == 0; i++) {
+		//Entre setores da mesma trilha, basta pular o ECC e o preambulo
+		if (i > 0) {
+			if ((addr + i) % DISK_SECTORSPERTRACK == 0)
+				__diskSeek (d, addr + i);
+			else
+				fseek (d->fp, 2*DISK_SECTORDATAOFFSET, SEEK_CUR);
+		}
+		if (fwrite (data + i*DISK_SECTORDATASIZE, 1, DISK_SECTORDATASIZE,
+		            d->fp) != DISK_SECTORDATASIZE)
+			ret = -1;
+	}
+	pthread_mutex_unlock (&d->lock);
+	return ret;
 }
 
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
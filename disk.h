@@ -74,11 +74,27 @@ int diskAddrToCylinder (Disk* d, unsigned long addr, unsigned long *cyl);
 //sem erros e -1 caso contrario
 int diskReadSector (Disk* d, unsigned long addr, unsigned char* data);
 
+//Funcao para realizar a leitura de count setores consecutivos, a partir do
+//endereco LBA (addr), em uma unica operacao: a cabeca e' posicionada uma vez
+//e os setores sao lidos em sequencia. Os dados sao transferidos para *data,
+//que deve comportar count setores. Retorna 0 se a leitura ocorreu sem erros
+//e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned long count,
+                     unsigned char* data);
+
 //Funcao para realzar a escrita de um setor identificado pelo endereco LBA
 //(addr). Os dados sao transferidos a partir de *data. Retorna 0 se a leitura
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long int addr, unsigned char* data);
 
+//Funcao para realizar a escrita de count setores consecutivos, a partir do
+//endereco LBA (addr), em uma unica operacao: a cabeca e' posicionada uma vez
+//e os setores sao escritos em sequencia. Os dados sao transferidos a partir
+//de *data, que deve conter count setores. Retorna 0 se a escrita ocorreu sem
+//erros e -1 caso contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned long count,
+                      unsigned char* data);
+
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
 //regular indicado por rawDiskPath e com numero total de cilindros indicado
 //por numCylinders. Retorna 0 se o disco fisico for criado com sucesso e -1
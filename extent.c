@@ -0,0 +1,322 @@
+/*
+*  extent.c - Indice de extents livres (sequencias de blocos livres)
+*
+*  Autores: Caio Fernandes dos Reis, Luiza Caldeira Daniel e Vitor de Souza Reis
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*/
+
+#include <stdlib.h>
+#include "extent.h"
+
+#define BY_START 0	//Arvore ordenada pelo bloco inicial
+#define BY_SIZE 1	//Arvore ordenada pelo tamanho (e bloco inicial)
+
+//No de extent livre. Cada no pertence as duas arvores (AVL) do indice ao
+//mesmo tempo, com um conjunto de ligacoes para cada uma
+typedef struct extentNode {
+	unsigned int start;
+	unsigned int len;
+	struct extentNode *left[2];
+	struct extentNode *right[2];
+	int height[2];
+} ExtentNode;
+
+//Tipo para representacao do indice de extents livres
+struct extentTree {
+	ExtentNode *root[2];
+	unsigned int count;
+};
+
+//Funcao interna que compara dois extents na ordem da arvore k
+static int __extentCompare (ExtentNode *a, ExtentNode *b, int k) {
+	if (k == BY_SIZE && a->len != b->len)
+		return (a->len < b->len ? -1 : 1);
+	if (a->start != b->start)
+		return (a->start < b->start ? -1 : 1);
+	return 0;
+}
+
+static int __extentHeight (ExtentNode *n, int k) {
+	return (n ? n->height[k] : 0);
+}
+
+static void __extentUpdate (ExtentNode *n, int k) {
+	int hl = __extentHeight (n->left[k], k);
+	int hr = __extentHeight (n->right[k], k);
+	n->height[k] = 1 + (hl > hr ? hl : hr);
+}
+
+static ExtentNode* __extentRotateRight (ExtentNode *n, int k) {
+	ExtentNode *l = n->left[k];
+	n->left[k] = l->right[k];
+	l->right[k] = n;
+	__extentUpdate (n, k);
+	__extentUpdate (l, k);
+	return l;
+}
+
+static ExtentNode* __extentRotateLeft (ExtentNode *n, int k) {
+	ExtentNode *r = n->right[k];
+	n->right[k] = r->left[k];
+	r->left[k] = n;
+	__extentUpdate (n, k);
+	__extentUpdate (r, k);
+	return r;
+}
+
+//Funcao interna que restaura o balanceamento AVL de uma subarvore
+static ExtentNode* __extentBalance (ExtentNode *n, int k) {
+	int diff;
+	__extentUpdate (n, k);
+	diff = __extentHeight (n->left[k], k) - __extentHeight (n->right[k], k);
+	if (diff > 1) {
+		if (__extentHeight (n->left[k]->left[k], k) <
+		    __extentHeight (n->left[k]->right[k], k))
+			n->left[k] = __extentRotateLeft (n->left[k], k);
+		return __extentRotateRight (n, k);
+	}
+	if (diff < -1) {
+		if (__extentHeight (n->right[k]->right[k], k) <
+		    __extentHeight (n->right[k]->left[k], k))
+			n->right[k] = __extentRotateRight (n->right[k], k);
+		return __extentRotateLeft (n, k);
+	}
+	return n;
+}
+
+static ExtentNode* __extentInsertNode (ExtentNode *root, ExtentNode *x, int k) {
+	if (!root) {
+		x->left[k] = x->right[k] = NULL;
+		x->height[k] = 1;
+		return x;
+	}
+	if (__extentCompare (x, root, k) < 0)
+		root->left[k] = __extentInsertNode (root->left[k], x, k);
+	else
+		root->right[k] = __extentInsertNode (root->right[k], x, k);
+	return __extentBalance (root, k);
+}
+
+//Funcao interna que desliga o menor no de uma subarvore, escrito em *min
+static ExtentNode* __extentRemoveMin (ExtentNode *root, ExtentNode **min,
+                                      int k) {
+	if (!root->left[k]) {
+		*min = root;
+		return root->right[k];
+	}
+	root->left[k] = __extentRemoveMin (root->left[k], min, k);
+	return __extentBalance (root, k);
+}
+
+static ExtentNode* __extentRemoveNode (ExtentNode *root, ExtentNode *x, int k) {
+	int c;
+	if (!root) return NULL;
+	c = __extentCompare (x, root, k);
+	if (c < 0)
+		root->left[k] = __extentRemoveNode (root->left[k], x, k);
+	else if (c > 0)
+		root->right[k] = __extentRemoveNode (root->right[k], x, k);
+	else {
+		ExtentNode *min;
+		if (!root->left[k]) return root->right[k];
+		if (!root->right[k]) return root->left[k];
+		root->right[k] = __extentRemoveMin (root->right[k], &min, k);
+		min->left[k] = root->left[k];
+		min->right[k] = root->right[k];
+		return __extentBalance (min, k);
+	}
+	return __extentBalance (root, k);
+}
+
+//Funcoes internas que inserem/removem um no das duas arvores
+static void __extentLink (ExtentTree *t, ExtentNode *x) {
+	t->root[BY_START] = __extentInsertNode (t->root[BY_START], x, BY_START);
+	t->root[BY_SIZE] = __extentInsertNode (t->root[BY_SIZE], x, BY_SIZE);
+	t->count++;
+}
+
+static void __extentUnlink (ExtentTree *t, ExtentNode *x) {
+	t->root[BY_START] = __extentRemoveNode (t->root[BY_START], x, BY_START);
+	t->root[BY_SIZE] = __extentRemoveNode (t->root[BY_SIZE], x, BY_SIZE);
+	t->count--;
+}
+
+//Funcao interna que retorna o extent de maior inicio <= block, ou NULL
+static ExtentNode* __extentFloor (ExtentTree *t, unsigned int block) {
+	ExtentNode *n = t->root[BY_START], *found = NULL;
+	while (n) {
+		if (n->start <= block) {
+			found = n;
+			n = n->right[BY_START];
+		}
+		else n = n->left[BY_START];
+	}
+	return found;
+}
+
+//Funcao interna que retorna o extent de menor inicio > block, ou NULL
+static ExtentNode* __extentHigher (ExtentTree *t, unsigned int block) {
+	ExtentNode *n = t->root[BY_START], *found = NULL;
+	while (n) {
+		if (n->start > block) {
+			found = n;
+			n = n->left[BY_START];
+		}
+		else n = n->right[BY_START];
+	}
+	return found;
+}
+
+static void __extentFreeNodes (ExtentNode *n) {
+	if (!n) return;
+	__extentFreeNodes (n->left[BY_START]);
+	__extentFreeNodes (n->right[BY_START]);
+	free (n);
+}
+
+//Funcao que cria um indice vazio. Retorna NULL se nao houver memoria
+ExtentTree* extentTreeCreate ( void ) {
+	return calloc (1, sizeof (ExtentTree));
+}
+
+//Funcao que libera toda a memoria de um indice
+void extentTreeDestroy (ExtentTree *t) {
+	if (!t) return;
+	__extentFreeNodes (t->root[BY_START]);
+	free (t);
+}
+
+//Funcao que retorna o numero de extents livres no indice
+unsigned int extentTreeCount (ExtentTree *t) {
+	return (t ? t->count : 0);
+}
+
+//Funcao que registra os blocos [start, start + len) como livres,
+//coalescendo-os com os extents vizinhos. Os blocos nao podem estar livres
+//no indice. Retorna 0 se bem sucedida ou -1 caso contrario
+int extentTreeInsert (ExtentTree *t, unsigned int start, unsigned int len) {
+	ExtentNode *prev, *next, *x = NULL;
+	if (!t || len == 0) return -1;
+
+	//Nenhum extent livre pode comecar antes do fim e terminar depois do
+	//inicio dos blocos liberados
+	prev = __extentFloor (t, start + len - 1);
+	if (prev && prev->start + prev->len > start) return -1;
+
+	prev = (start > 0 ? __extentFloor (t, start - 1) : NULL);
+	next = __extentHigher (t, start + len - 1);
+
+	//Coalescendo com o extent anterior e com o seguinte
+	if (prev && prev->start + prev->len == start) {
+		__extentUnlink (t, prev);
+		start = prev->start;
+		len += prev->len;
+		x = prev;
+	}
+	if (next && start + len == next->start) {
+		__extentUnlink (t, next);
+		len += next->len;
+		if (x) free (next);
+		else x = next;
+	}
+	if (!x) {
+		x = malloc (sizeof (ExtentNode));
+		if (!x) return -1;
+	}
+	x->start = start;
+	x->len = len;
+	__extentLink (t, x);
+	return 0;
+}
+
+//Funcao que registra os blocos [start, start + len) como ocupados. Os blocos
+//precisam estar contidos em um unico extent livre, que e' dividido se
+//necessario. Retorna 0 se bem sucedida ou -1 caso contrario
+int extentTreeRemove (ExtentTree *t, unsigned int start, unsigned int len) {
+	ExtentNode *x, *tail;
+	unsigned int end, xEnd;
+	if (!t || len == 0) return -1;
+
+	x = __extentFloor (t, start);
+	end = start + len;
+	if (!x || x->start + x->len < end) return -1;
+	xEnd = x->start + x->len;
+
+	__extentUnlink (t, x);
+	//Sobra depois do trecho ocupado
+	if (xEnd > end) {
+		if (x->start == start) tail = x;
+		else {
+			tail = malloc (sizeof (ExtentNode));
+			if (!tail) {
+				__extentLink (t, x);
+				return -1;
+			}
+		}
+		tail->start = end;
+		tail->len = xEnd - end;
+		__extentLink (t, tail);
+		if (tail == x) return 0;
+	}
+	//Sobra antes do trecho ocupado
+	if (x->start < start) {
+		x->len = start - x->start;
+		__extentLink (t, x);
+	}
+	else free (x);
+	return 0;
+}
+
+//Funcao que encontra o menor extent livre com pelo menos n blocos (best-fit).
+//Se nao houver, encontra o maior extent livre. O extent encontrado e'
+//escrito em *start e *len, sem ser removido. Retorna 0 se algum extent foi
+//encontrado ou -1 se o indice estiver vazio
+int extentTreeBestFit (ExtentTree *t, unsigned int n,
+                       unsigned int *start, unsigned int *len) {
+	ExtentNode *node, *found = NULL;
+	if (!t || !t->root[BY_SIZE]) return -1;
+
+	node = t->root[BY_SIZE];
+	while (node) {
+		if (node->len >= n) {
+			found = node;
+			node = node->left[BY_SIZE];
+		}
+		else node = node->right[BY_SIZE];
+	}
+	if (!found) {
+		//Nenhum extent e' grande o bastante: o maior deles
+		found = t->root[BY_SIZE];
+		while (found->right[BY_SIZE]) found = found->right[BY_SIZE];
+	}
+	*start = found->start;
+	*len = found->len;
+	return 0;
+}
+
+//Funcao que encontra o extent livre mais proximo do bloco goal: o que
+//contem goal ou, se nao houver, o mais proximo antes (*prevStart, *prevLen)
+//e depois (*nextStart, *nextLen) de goal. Um lado sem extent tem tamanho 0.
+//Retorna 1 se goal estiver livre (extent em *prev*), 0 caso contrario
+int extentTreeNearest (ExtentTree *t, unsigned int goal,
+                       unsigned int *prevStart, unsigned int *prevLen,
+                       unsigned int *nextStart, unsigned int *nextLen) {
+	ExtentNode *prev, *next;
+	*prevStart = *prevLen = *nextStart = *nextLen = 0;
+	if (!t) return 0;
+
+	prev = __extentFloor (t, goal);
+	next = __extentHigher (t, goal);
+	if (prev) {
+		*prevStart = prev->start;
+		*prevLen = prev->len;
+	}
+	if (next) {
+		*nextStart = next->start;
+		*nextLen = next->len;
+	}
+	return (prev && goal < prev->start + prev->len);
+}
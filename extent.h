@@ -0,0 +1,56 @@
+/*
+*  extent.h - Indice de extents livres (sequencias de blocos livres)
+*
+*  Autores: Caio Fernandes dos Reis, Luiza Caldeira Daniel e Vitor de Souza Reis
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*/
+
+#ifndef EXTENT_H
+#define EXTENT_H
+
+//Tipo para representacao do indice de extents livres. Cada extent e' uma
+//sequencia maxima de blocos livres [start, start + len). O indice mantem os
+//extents em duas arvores balanceadas: uma ordenada pelo bloco inicial, para
+//coalescer vizinhos e achar o extent mais proximo de um bloco, e outra
+//ordenada pelo tamanho, para a busca best-fit. Todas as operacoes custam
+//O(log n) no numero de extents
+typedef struct extentTree ExtentTree;
+
+//Funcao que cria um indice vazio. Retorna NULL se nao houver memoria
+ExtentTree* extentTreeCreate ( void );
+
+//Funcao que libera toda a memoria de um indice
+void extentTreeDestroy (ExtentTree *t);
+
+//Funcao que retorna o numero de extents livres no indice
+unsigned int extentTreeCount (ExtentTree *t);
+
+//Funcao que registra os blocos [start, start + len) como livres,
+//coalescendo-os com os extents vizinhos. Os blocos nao podem estar livres
+//no indice. Retorna 0 se bem sucedida ou -1 caso contrario
+int extentTreeInsert (ExtentTree *t, unsigned int start, unsigned int len);
+
+//Funcao que registra os blocos [start, start + len) como ocupados. Os blocos
+//precisam estar contidos em um unico extent livre, que e' dividido se
+//necessario. Retorna 0 se bem sucedida ou -1 caso contrario
+int extentTreeRemove (ExtentTree *t, unsigned int start, unsigned int len);
+
+//Funcao que encontra o menor extent livre com pelo menos n blocos (best-fit).
+//Se nao houver, encontra o maior extent livre. O extent encontrado e'
+//escrito em *start e *len, sem ser removido. Retorna 0 se algum extent foi
+//encontrado ou -1 se o indice estiver vazio
+int extentTreeBestFit (ExtentTree *t, unsigned int n,
+                       unsigned int *start, unsigned int *len);
+
+//Funcao que encontra o extent livre mais proximo do bloco goal: o que
+//contem goal ou, se nao houver, o mais proximo antes (*prevStart, *prevLen)
+//e depois (*nextStart, *nextLen) de goal. Um lado sem extent tem tamanho 0.
+//Retorna 1 se goal estiver livre (extent em *prev*), 0 caso contrario
+int extentTreeNearest (ExtentTree *t, unsigned int goal,
+                       unsigned int *prevStart, unsigned int *prevLen,
+                       unsigned int *nextStart, unsigned int *nextLen);
+
+#endif
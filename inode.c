@@ -10,7 +10,10 @@
 *
 */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "inode.h"
 #include "util.h"
 
@@ -22,28 +25,71 @@
 #define INODE_ITEM_BLOCKADDR 0		//Itens 0 a 7: Enderecos de bloco
 #define INODE_ITEM_FILETYPE (INODE_SIZE - 8)	//Item 8: Tipo de arquivo
 #define INODE_ITEM_FILESIZE (INODE_SIZE - 7)	//Item 9: Tamanho do arquivo
+
+//O tipo de arquivo ocupa os 8 bits baixos do item 8; os 24 bits altos guardam
+//os bits 32 a 55 do tamanho do arquivo, cujos 32 bits baixos ficam no item 9.
+//Discos antigos, com esses bits zerados, continuam validos
+#define INODE_FILETYPE_MASK 0xFFu
+#define INODE_FILESIZE_HIGHSHIFT 8
 #define INODE_ITEM_OWNER (INODE_SIZE - 6)	//Item 10: Proprietario
 #define INODE_ITEM_GROUPOWNER (INODE_SIZE - 5)	//Item 11: Grupo Proprietario
 #define INODE_ITEM_PERMISSION (INODE_SIZE - 4)	//Item 12: Permissao
 #define INODE_ITEM_REFCOUNT (INODE_SIZE - 3)	//Item 13: Contador referencia
 
+//Numero total de i-nodes da area de i-nodes (0: sem limite conhecido)
+static unsigned int numInodesLimit = 0;
+
+//Trava da area de i-nodes. Varios i-nodes dividem um setor, gravado por
+//leitura-modificacao-escrita, e um i-node livre so' deixa de ser livre quando
+//e' gravado; com a trava, essas sequencias ficam inteiras entre threads. E'
+//recursiva porque as operacoes sobre cadeias de extensoes usam inodeSave
+static pthread_mutex_t areaLock;
+static pthread_once_t areaLockOnce = PTHREAD_ONCE_INIT;
+
+static void __inodeAreaLockInit (void) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&areaLock, &attr);
+	pthread_mutexattr_destroy (&attr);
+}
+
+static void __inodeAreaLock (void) {
+	pthread_once (&areaLockOnce, __inodeAreaLockInit);
+	pthread_mutex_lock (&areaLock);
+}
+
+static void __inodeAreaUnlock (void) {
+	pthread_mutex_unlock (&areaLock);
+}
+
 //Tipo para representacao de i-nodes
 struct inode {
 	unsigned int inodeItem[NUMITEMS_PERINODE]; //Blocos e dados do i-node
 	unsigned int number; 	//Numero do i-node
 	unsigned int next;	//Numero do proximo i-node em caso de extensao
 	Disk *d; 		//Disco ao qual pertence o i-node
+	unsigned int lastExt;	//Ultima extensao conhecida (so' em memoria)
 };
 
 //Funcao interna que retorna a ultima extensao de um i-node. Retorna NULL
-//se nao houver extensoes do i-node fornecido.
+//se nao houver extensoes do i-node fornecido. A busca parte da ultima
+//extensao ja' encontrada, para nao percorrer a cadeia toda a cada bloco
+//acrescentado
 Inode* __inodeGetLastExtension (Inode *i) {
 	unsigned int niNumber = 0;
+	Inode *first = i;
 	Disk *d = i->d;
 	if (i->next) {
-		niNumber = i->next;
+		niNumber = (i->lastExt ? i->lastExt : i->next);
 		i = inodeLoad (niNumber, d);
 		if (!i) return NULL;
+		//Extensao liberada desde a ultima busca: percorre desde o inicio
+		if (i->number != niNumber && niNumber != first->next) {
+			free (i);
+			first->lastExt = 0;
+			return __inodeGetLastExtension (first);
+		}
 	} 
 	else return NULL;
 	while (i->next != 0) {
@@ -52,6 +98,7 @@ Inode* __inodeGetLastExtension (Inode *i) {
 		i = inodeLoad (niNumber, d);
 		if (!i) return NULL;
 	}
+	first->lastExt = niNumber;
 	return i;
 }
 
@@ -70,6 +117,19 @@ unsigned int inodeNumBlockAddresses ( void ) {
 	return NUMBLOCKS_PERINODE;
 }
 
+//Funcao que retorna o numero de enderecos de blocos que cabem em cada
+//extensao de um i-node
+unsigned int inodeNumExtBlockAddresses ( void ) {
+	return NUMITEMS_PERINODE;
+}
+
+//Funcao que define o numero total de i-nodes da area de i-nodes, limitando
+//a busca por i-nodes livres. Com 0, a busca so' termina quando a leitura de
+//um setor falhar
+void inodeSetNumInodes (unsigned int numInodes) {
+	numInodesLimit = numInodes;
+}
+
 //Funcao que cria um i-node vazio, identificado pelo seu numero (number),
 //que deve ser unico no sistema de arquivos. Retorna ponteiro para o i-node
 //criado ou NULL se nao houver memoria suficiente ou number invalido. A funcao
@@ -81,6 +141,7 @@ Inode* inodeCreate (unsigned int number, Disk *d) {
 	i->d = d;
 	i->number = number;
 	i->next = 0;
+	i->lastExt = 0;
 	if ( inodeClear (i) == 0 ) return i;
 	else free (i);
 	return NULL;
@@ -89,20 +150,25 @@ Inode* inodeCreate (unsigned int number, Disk *d) {
 //Funcao que limpa todo o conteudo de um i-node. O i-node e' salvo em disco,
 //sobrescrevendo-o se ja existente. Retorna 0 se bem sucedido ou -1, caso contrario
 int inodeClear (Inode *i) {
+	int ret;
 	if (i) {
+		__inodeAreaLock ();
 		if (i->next != 0) {
 			Inode* ni = inodeLoad (i->next, i->d);
-			if ( !ni ) return -1;
-			if ( inodeClear (ni) != 0 ) {
+			if ( !ni || inodeClear (ni) != 0 ) {
 				free (ni);
+				__inodeAreaUnlock ();
 				return -1;
 			}
 			free (ni);
 		}	
 		i->next = 0;
+		i->lastExt = 0;
 		for (int a = 0; a < NUMITEMS_PERINODE; a++)
 			i->inodeItem[a] = 0;
-		return inodeSave(i);
+		ret = inodeSave(i);
+		__inodeAreaUnlock ();
+		return ret;
 	}
 	return -1;
 }
@@ -121,8 +187,12 @@ int inodeSave (Inode *i) {
 			* sizeUInt / DISK_SECTORDATASIZE;
 		unsigned char sector[DISK_SECTORDATASIZE];
 
+		__inodeAreaLock ();
 		int ret = diskReadSector (i->d, inodeSectorAddr, sector);
-		if (ret < 0) return ret;
+		if (ret < 0) {
+			__inodeAreaUnlock ();
+			return ret;
+		}
 
 		//Posicao de inicio do i-node dentro do setor
 		unsigned long int offset = ((i->number - 1) % 
@@ -140,25 +210,26 @@ int inodeSave (Inode *i) {
 
 		//Salvando todo o setor onde se encontra o i-node...
 		ret = diskWriteSector (i->d, inodeSectorAddr, sector);
+		__inodeAreaUnlock ();
 		return ret;
 	}
 	return -1;
 }
 
-//Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
-//i-node lido ou NULL em caso de falha.
-Inode* inodeLoad (unsigned int number, Disk *d) {
+//Funcao interna que retorna o endereco do setor onde esta' o i-node number
+static unsigned long int __inodeSectorAddr (unsigned int number) {
+	return INODE_BEGINSECTOR + (number - 1) * INODE_SIZE * sizeof(unsigned int)
+	       / DISK_SECTORDATASIZE;
+}
+
+//Funcao interna que monta o i-node number a partir do setor onde ele esta',
+//ja' lido do disco d. Retorna ponteiro para o i-node ou NULL se nao houver
+//memoria
+static Inode* __inodeDecode (unsigned char *sector, unsigned int number,
+                             Disk *d) {
 	unsigned long int sizeUInt = sizeof(unsigned int);
-	//Endereco do setor do qual o i-node sera' lido
-	unsigned long int inodeSectorAddr = 
-		INODE_BEGINSECTOR + (number - 1) * INODE_SIZE * sizeUInt
-		    / DISK_SECTORDATASIZE;
-	unsigned char sector[DISK_SECTORDATASIZE];
 	Inode *i = NULL;
 
-	int ret = diskReadSector (d, inodeSectorAddr, sector);
-	if (ret < 0) return NULL;
-
 	//Posicao de inicio do i-node dentro do setor
 	unsigned long int offset = ((number - 1) % 
 		(DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
@@ -167,6 +238,7 @@ Inode* inodeLoad (unsigned int number, Disk *d) {
 	i = malloc (sizeof(Inode));
 	if (i) {
 		i->d = d;
+		i->lastExt = 0;
 		//Recuperando enderecos de blocos e atributos do i-node no setor
 		for (int a=0; a < NUMITEMS_PERINODE; a++)
 			char2ul (&sector[offset+a*sizeUInt],
@@ -179,14 +251,76 @@ Inode* inodeLoad (unsigned int number, Disk *d) {
 	return i;
 }
 
+//Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
+//i-node lido ou NULL em caso de falha.
+Inode* inodeLoad (unsigned int number, Disk *d) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+
+	int ret = diskReadSector (d, __inodeSectorAddr (number), sector);
+	if (ret < 0) return NULL;
+	return __inodeDecode (sector, number, d);
+}
+
+//Funcao interna que compara dois pares (numero, posicao) pelo numero
+static int __inodeCompareNumbers (const void *a, const void *b) {
+	unsigned int x = ((const unsigned int *) a)[0];
+	unsigned int y = ((const unsigned int *) b)[0];
+	return (x > y) - (x < y);
+}
+
+//Funcao que recupera de uma vez os n i-nodes cujos numeros estao em numbers,
+//copiando para inodes[k] o i-node de numbers[k]. Os i-nodes sao buscados em
+//ordem de setor e cada setor da area de i-nodes e' lido uma unica vez, por
+//mais i-nodes que contenha. Uma posicao recebe NULL se seu i-node nao puder
+//ser lido. Retorna o numero de i-nodes recuperados
+unsigned int inodeLoadMany (const unsigned int *numbers, Inode **inodes,
+                            unsigned int n, Disk *d) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned long int current = 0;
+	unsigned int loaded = 0, *order;
+	int valid = 0;
+
+	for (unsigned int k = 0; k < n; k++) inodes[k] = NULL;
+	if (n == 0) return 0;
+	//Pares (numero, posicao em numbers), ordenados pelo numero do i-node
+	order = malloc (2 * n * sizeof(unsigned int));
+	if (!order) return 0;
+	for (unsigned int k = 0; k < n; k++) {
+		order[2*k] = numbers[k];
+		order[2*k+1] = k;
+	}
+	qsort (order, n, 2 * sizeof(unsigned int), __inodeCompareNumbers);
+
+	for (unsigned int k = 0; k < n; k++) {
+		unsigned int number = order[2*k];
+		if (number == 0) continue;
+		if (!valid || __inodeSectorAddr (number) != current) {
+			current = __inodeSectorAddr (number);
+			valid = (diskReadSector (d, current, sector) >= 0);
+		}
+		if (!valid) continue;
+		inodes[order[2*k+1]] = __inodeDecode (sector, number, d);
+		if (inodes[order[2*k+1]]) loaded++;
+	}
+	free (order);
+	return loaded;
+}
+
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType) {
-	if (i) i->inodeItem[INODE_ITEM_FILETYPE] = fileType;
+	if (i) i->inodeItem[INODE_ITEM_FILETYPE] =
+		(i->inodeItem[INODE_ITEM_FILETYPE] & ~INODE_FILETYPE_MASK) |
+		(fileType & INODE_FILETYPE_MASK);
 }
 
-//Funcao que modifica o tamanho do arquivo referente a um i-node, em bytes
-void inodeSetFileSize (Inode *i, unsigned int fileSize) {
-	if (i) i->inodeItem[INODE_ITEM_FILESIZE] = fileSize;
+//Funcao que modifica o tamanho do arquivo referente a um i-node, em bytes.
+//Apenas os 56 bits baixos de fileSize sao guardados (INODE_MAX_FILESIZE)
+void inodeSetFileSize (Inode *i, unsigned long long fileSize) {
+	if (!i) return;
+	i->inodeItem[INODE_ITEM_FILESIZE] = (unsigned int)fileSize;
+	i->inodeItem[INODE_ITEM_FILETYPE] =
+		(i->inodeItem[INODE_ITEM_FILETYPE] & INODE_FILETYPE_MASK) |
+		((unsigned int)(fileSize >> 32) << INODE_FILESIZE_HIGHSHIFT);
 }
 
 //Funcao que modifica o proprietario do arquivo referente a um i-node
@@ -209,10 +343,8 @@ void inodeSetRefCount (Inode *i, unsigned int refCount) {
 	if (i) i->inodeItem[INODE_ITEM_REFCOUNT] = refCount;
 }
 
-//Funcao que adiciona um endereco ao fim do array de blocos de um i-node
-//Retorna -1 caso a inclusao do endereco nao seja bem sucedida
-//E' a unica funcao que salva automaticamente o i-node em disco
-int inodeAddBlock (Inode *i, unsigned int blockAddr) {
+//Funcao interna equivalente a inodeAddBlock, com a area de i-nodes travada
+static int __inodeAddBlock (Inode *i, unsigned int blockAddr) {
 	if (i) {
 		Disk *d = i->d;
 		Inode* lastInodeExt = NULL;
@@ -251,14 +383,90 @@ int inodeAddBlock (Inode *i, unsigned int blockAddr) {
 		}
 		lastInodeExt = inodeLoad (niNumber, d);
 		if (!lastInodeExt) return -1;
+		//I-node livre tem numero 0 em disco; a extensao passa a ocupa'-lo
+		lastInodeExt->number = niNumber;
+		lastInodeExt->next = 0;
+		for (int a = 0; a < NUMITEMS_PERINODE; a++)
+			lastInodeExt->inodeItem[a] = 0;
 		lastInodeExt->inodeItem[0] = blockAddr;
 		ret = inodeSave (lastInodeExt);
 		free (lastInodeExt);
+		if (ret == 0) i->lastExt = niNumber;
 		return ret;
 	}
 	return -1;
 }
 
+//Funcao que adiciona um endereco ao fim do array de blocos de um i-node
+//Retorna -1 caso a inclusao do endereco nao seja bem sucedida
+//E' a unica funcao que salva automaticamente o i-node em disco
+int inodeAddBlock (Inode *i, unsigned int blockAddr) {
+	__inodeAreaLock ();
+	int ret = __inodeAddBlock (i, blockAddr);
+	__inodeAreaUnlock ();
+	return ret;
+}
+
+//Funcao interna equivalente a inodeAddBlocks, com a area de i-nodes travada
+static int __inodeAddBlocks (Inode *i, const unsigned int *blockAddrs,
+                             unsigned int n) {
+	Inode *ext;
+	unsigned int k = 0, niNumber;
+	int numblocks = NUMBLOCKS_PERINODE;
+	if (!i) return -1;
+	if (n == 0) return 0;
+	ext = __inodeGetLastExtension (i);
+	if (ext) numblocks = NUMITEMS_PERINODE;
+	else if (i->next != 0) return -1;
+	else ext = i;
+
+	for (;;) {
+		//Preenchendo os enderecos vagos do i-node atual da cadeia
+		for (int a = 0; a < numblocks && k < n; a++)
+			if (ext->inodeItem[a] == 0)
+				ext->inodeItem[a] = blockAddrs[k++];
+		if (k == n) break;
+
+		//I-node cheio. Obter nova extensao
+		niNumber = inodeFindFreeInode (ext->number + 1, i->d);
+		if (!niNumber) break;
+		ext->next = niNumber;
+		if ( ext != i && inodeSave (ext) < 0 ) break;
+		if (ext != i) free (ext);
+		ext = inodeLoad (niNumber, i->d);
+		if (!ext) return -1;
+		//I-node livre tem numero 0 em disco; a extensao passa a ocupa'-lo
+		ext->number = niNumber;
+		ext->next = 0;
+		for (int a = 0; a < NUMITEMS_PERINODE; a++)
+			ext->inodeItem[a] = 0;
+		numblocks = NUMITEMS_PERINODE;
+		i->lastExt = niNumber;
+	}
+	int ret = 0;
+	if (ext != i) {
+		ret = inodeSave (ext);
+		free (ext);
+	}
+	if (ret < 0 || k == 0) return -1;
+	return k;
+}
+
+//Funcao que adiciona n enderecos (blockAddrs) ao fim do array de blocos de
+//um i-node, preenchendo a ultima extensao e criando as extensoes que faltarem.
+//Cada extensao alterada e' salva uma unica vez, em vez de uma vez por
+//endereco; o proprio i-node, que precisa ser o primeiro de sua cadeia, nao e'
+//salvo e cabe a quem chamou grava'-lo (write-back). Retorna o
+//numero de enderecos adicionados (menor que n se faltarem i-nodes livres
+//para novas extensoes) ou -1 em caso de falha
+int inodeAddBlocks (Inode *i, const unsigned int *blockAddrs, unsigned int n) {
+	//Cada nova extensao e' ocupada antes que outra busca a encontre livre
+	__inodeAreaLock ();
+	int ret = __inodeAddBlocks (i, blockAddrs, n);
+	__inodeAreaUnlock ();
+	return ret;
+}
+
 //Funcao que retorna o numero de um i-node.
 unsigned int inodeGetNumber (Inode *i) {
 	return (i ? i->number : 0);
@@ -272,12 +480,15 @@ unsigned int inodeGetNextNumber (Inode *i) {
 
 //Funcao que retorna o tipo de arquivo referente a um i-node.
 unsigned int inodeGetFileType (Inode *i) {
-	return (i ? i->inodeItem[INODE_ITEM_FILETYPE] : 0);
+	return (i ? i->inodeItem[INODE_ITEM_FILETYPE] & INODE_FILETYPE_MASK : 0);
 }
 
 //Funcao que retorna o tamanho do arquivo referente ao i-node, em bytes
-unsigned int inodeGetFileSize (Inode *i) {
-	return (i ? i->inodeItem[INODE_ITEM_FILESIZE] : 0);
+unsigned long long inodeGetFileSize (Inode *i) {
+	if (!i) return 0;
+	return ((unsigned long long)(i->inodeItem[INODE_ITEM_FILETYPE]
+	                             >> INODE_FILESIZE_HIGHSHIFT) << 32) |
+	       i->inodeItem[INODE_ITEM_FILESIZE];
 }
 
 
@@ -318,31 +529,229 @@ unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum) {
 			                      / NUMITEMS_PERINODE;
 			unsigned int offset = (blockNum - NUMBLOCKS_PERINODE)
 			                      % NUMITEMS_PERINODE;
-			Inode *ni = inodeLoad (i->next, i->d);
+			unsigned int blockAddr;
+			Inode *ni;
+			if (i->next == 0) return 0;
+			ni = inodeLoad (i->next, i->d);
+			if (!ni) return 0;
 			for (int a = 1; a < extNum; a++) {
 				Disk *d = ni->d;
 				unsigned int niNumber = ni->next;
 				free (ni);
+				if (niNumber == 0) return 0;
 				ni = inodeLoad (niNumber, d);
+				if (!ni) return 0;
 			}
-			return ni->inodeItem[offset];
+			blockAddr = ni->inodeItem[offset];
+			free (ni);
+			return blockAddr;
 		}
 	}
 	return 0;
 }
 
+//Funcao que copia para addrs os enderecos de blocos de um i-node, na ordem do
+//arquivo, percorrendo sua cadeia de extensoes uma unica vez. Sao copiados no
+//maximo max enderecos, parando no primeiro bloco sem endereco. O i-node
+//precisa ser o primeiro de sua cadeia. Retorna o numero de enderecos copiados
+unsigned int inodeGetBlockAddrs (Inode *i, unsigned int *addrs,
+                                 unsigned int max) {
+	unsigned int count = 0;
+	Inode *ni = i;
+	int numblocks = NUMBLOCKS_PERINODE;
+	if (!i) return 0;
+	for (;;) {
+		for (int a = 0; a < numblocks; a++) {
+			if (count == max || ni->inodeItem[a] == 0) {
+				if (ni != i) free (ni);
+				return count;
+			}
+			addrs[count++] = ni->inodeItem[a];
+		}
+		unsigned int niNumber = ni->next;
+		if (ni != i) free (ni);
+		if (niNumber == 0) return count;
+		ni = inodeLoad (niNumber, i->d);
+		if (!ni) return count;
+		numblocks = NUMITEMS_PERINODE;
+	}
+}
+
+//Funcao interna que libera o i-node de numero number no disco d, zerando todo
+//o seu conteudo, inclusive o numero. O setor do i-node e' mantido em sector,
+//cujo endereco fica em *sectorAddr (0 se nenhum), e so' e' gravado quando um
+//i-node de outro setor for liberado ou com number igual a 0, o que agrupa a
+//liberacao de i-nodes vizinhos. Retorna 0 se bem sucedida ou -1 caso
+//contrario
+static int __inodeRelease (Disk *d, unsigned int number, unsigned char *sector,
+                           unsigned long int *sectorAddr) {
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	unsigned long int inodeSectorAddr = (number == 0 ? 0 :
+		INODE_BEGINSECTOR + (number - 1) * INODE_SIZE * sizeUInt
+		    / DISK_SECTORDATASIZE);
+
+	if (*sectorAddr != inodeSectorAddr) {
+		if (*sectorAddr != 0 &&
+		    diskWriteSector (d, *sectorAddr, sector) < 0) return -1;
+		*sectorAddr = inodeSectorAddr;
+		if (number == 0) return 0;
+		if (diskReadSector (d, inodeSectorAddr, sector) < 0) {
+			*sectorAddr = 0;
+			return -1;
+		}
+	}
+	if (number == 0) return 0;
+
+	//Posicao de inicio do i-node dentro do setor
+	unsigned long int offset = ((number - 1) % 
+		(DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
+		* INODE_SIZE * sizeUInt;
+	memset (&sector[offset], 0, INODE_SIZE * sizeUInt);
+	return 0;
+}
+
+//Funcao que substitui os n enderecos de blocos de um i-node a partir do bloco
+//blockNum pelos enderecos em blockAddrs, percorrendo a cadeia de extensoes uma
+//unica vez e salvando cada extensao alterada uma vez. Os blocos precisam ja'
+//ter endereco (ainda que INODE_HOLE). O i-node precisa ser o primeiro de sua
+//cadeia e, como em inodeAddBlocks, nao e' salvo. Retorna 0 se bem sucedida ou
+//-1 caso contrario
+int inodeSetBlockAddrs (Inode *i, unsigned int blockNum,
+                        const unsigned int *blockAddrs, unsigned int n) {
+	Inode *ni = i;
+	unsigned int first = 0, k = 0;	//Indice do primeiro endereco de ni
+	unsigned int numblocks = NUMBLOCKS_PERINODE;
+	int ret = 0;
+	if (!i) return -1;
+	while (k < n && ret == 0) {
+		if (blockNum + k < first + numblocks) {
+			while (k < n && blockNum + k < first + numblocks) {
+				unsigned int a = blockNum + k - first;
+				if (ni->inodeItem[a] == 0) {
+					ret = -1;
+					break;
+				}
+				ni->inodeItem[a] = blockAddrs[k++];
+			}
+			if (ret == 0 && ni != i) ret = inodeSave (ni);
+			if (k == n || ret < 0) break;
+		}
+		unsigned int niNumber = ni->next;
+		if (ni != i) free (ni);
+		if (niNumber == 0) return -1;
+		ni = inodeLoad (niNumber, i->d);
+		if (!ni) return -1;
+		first += numblocks;
+		numblocks = NUMITEMS_PERINODE;
+	}
+	if (ni != i) free (ni);
+	return ret;
+}
+
+//Funcao interna equivalente a inodeTruncateBlocks, com a area de i-nodes
+//travada
+static int __inodeTruncateBlocks (Inode *i, unsigned int numBlocks) {
+	unsigned int niNumber, keepExt = 0, ext = 0;
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned long int sectorAddr = 0;
+	int released = 0;
+	if (!i) return -1;
+	if (numBlocks > NUMBLOCKS_PERINODE)
+		keepExt = (numBlocks - NUMBLOCKS_PERINODE + NUMITEMS_PERINODE - 1)
+		          / NUMITEMS_PERINODE;
+
+	for (unsigned int a = numBlocks; a < NUMBLOCKS_PERINODE; a++)
+		i->inodeItem[a] = 0;
+	niNumber = i->next;
+	i->lastExt = 0;
+	//A cadeia e' cortada antes de suas extensoes serem liberadas
+	if (keepExt == 0) i->next = 0;
+	if (inodeSave (i) < 0) return -1;
+
+	while (niNumber != 0) {
+		Inode *ni = inodeLoad (niNumber, i->d);
+		int ret = 0;
+		if (!ni) return -1;
+		niNumber = ni->next;
+		ext++;
+		if (ext == keepExt) {
+			//Ultima extensao mantida: limpa os enderecos excedentes
+			unsigned int first = numBlocks - NUMBLOCKS_PERINODE
+			                     - (ext - 1) * NUMITEMS_PERINODE;
+			for (unsigned int a = first; a < NUMITEMS_PERINODE; a++)
+				ni->inodeItem[a] = 0;
+			ni->next = 0;
+			ret = inodeSave (ni);
+		}
+		else if (ext > keepExt) {
+			ret = __inodeRelease (i->d, ni->number, sector, &sectorAddr);
+			if (ret == 0) released++;
+		}
+		free (ni);
+		if (ret < 0) return -1;
+	}
+	//Grava o ultimo setor de i-nodes liberados
+	if (__inodeRelease (i->d, 0, sector, &sectorAddr) < 0) return -1;
+	return released;
+}
+
+//Funcao que reduz o array de blocos de um i-node aos seus numBlocks primeiros
+//enderecos. As extensoes que deixam de ser necessarias sao liberadas. Os
+//blocos em si nao sao liberados. O i-node precisa ser o primeiro de sua
+//cadeia e e' salvo em disco. Retorna o numero de extensoes liberadas ou -1
+//em caso de falha
+int inodeTruncateBlocks (Inode *i, unsigned int numBlocks) {
+	//Os setores de i-nodes liberados sao regravados por inteiro
+	__inodeAreaLock ();
+	int ret = __inodeTruncateBlocks (i, numBlocks);
+	__inodeAreaUnlock ();
+	return ret;
+}
+
+//Funcao que libera um i-node e toda a sua cadeia de extensoes no disco,
+//tornando-os livres para reuso. Os blocos do arquivo nao sao liberados. O
+//i-node precisa ser o primeiro de sua cadeia e nao deve mais ser salvo; a
+//memoria de i continua a cargo de quem chamou. Retorna o numero de i-nodes
+//liberados ou -1 em caso de falha
+int inodeFree (Inode *i) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned long int sectorAddr = 0;
+	__inodeAreaLock ();
+	int released = __inodeTruncateBlocks (i, 0);
+	if (released >= 0 &&
+	    (__inodeRelease (i->d, i->number, sector, &sectorAddr) < 0 ||
+	     __inodeRelease (i->d, 0, sector, &sectorAddr) < 0)) released = -1;
+	__inodeAreaUnlock ();
+	return (released < 0 ? -1 : released + 1);
+}
+
 //Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
-//startFrom. Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
+//startFrom. Um i-node e' livre se o numero gravado em disco for 0, isto e',
+//se nunca foi criado ou se foi liberado. Retorna o numero do inode livre
+//encontrado ou 0 se nao encontrado.
 unsigned int inodeFindFreeInode (unsigned int startFrom, Disk *d) {
 	Inode *i = NULL;
 	unsigned int number = 0;
 	if (startFrom < 1) return 0;
 	for (unsigned int a = startFrom; number == 0; a++) {
+		if (numInodesLimit && a > numInodesLimit) break;
 		i = inodeLoad (a, d);
 		if (!i) break;
-		if (inodeGetBlockAddr(i, 0) == 0)
-			number = inodeGetNumber(i);
+		if (inodeGetNumber(i) == 0)
+			number = a;
 		free (i);
 	}
 	return number;
 }
+
+//Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
+//startFrom, e o cria vazio, como inodeCreate. A busca e a criacao ocorrem
+//juntas, de modo que duas threads nunca recebem o mesmo i-node. Retorna
+//ponteiro para o i-node criado ou NULL se nao houver i-node livre
+Inode* inodeCreateFree (unsigned int startFrom, Disk *d) {
+	__inodeAreaLock ();
+	unsigned int number = inodeFindFreeInode (startFrom, d);
+	Inode *i = (number ? inodeCreate (number, d) : NULL);
+	__inodeAreaUnlock ();
+	return i;
+}
@@ -18,6 +18,13 @@
 //Tipo para representacao de i-nodes
 typedef struct inode Inode;
 
+//Endereco de bloco reservado que marca um buraco no array de blocos de um
+//i-node: um bloco do arquivo que ainda nao tem bloco no disco
+#define INODE_HOLE 0xFFFFFFFFu
+
+//Maior tamanho de arquivo, em bytes, que um i-node consegue registrar
+#define INODE_MAX_FILESIZE 0x00FFFFFFFFFFFFFFull
+
 //Funcao que retorna o numero de i-nodes por setor
 unsigned int inodeNumInodesPerSector ( void );
 
@@ -27,6 +34,15 @@ unsigned int inodeAreaBeginSector ( void );
 //Funcao que retorna o numero de enderecos de blocos que cabem em um i-node
 unsigned int inodeNumBlockAddresses ( void );
 
+//Funcao que retorna o numero de enderecos de blocos que cabem em cada
+//extensao de um i-node
+unsigned int inodeNumExtBlockAddresses ( void );
+
+//Funcao que define o numero total de i-nodes da area de i-nodes, limitando
+//a busca por i-nodes livres. Com 0, a busca so' termina quando a leitura de
+//um setor falhar
+void inodeSetNumInodes (unsigned int numInodes);
+
 //Funcao que cria um i-node vazio, identificado pelo seu numero (number),
 //que deve ser unico no sistema de arquivos. Retorna ponteiro para o i-node
 //criado ou NULL se nao houver memoria suficiente ou number invalido. A funcao
@@ -48,11 +64,20 @@ int inodeSave (Inode *i);
 //i-node lido ou NULL em caso de falha.
 Inode* inodeLoad (unsigned int number, Disk *d);
 
+//Funcao que recupera de uma vez os n i-nodes cujos numeros estao em numbers,
+//copiando para inodes[k] o i-node de numbers[k]. Os i-nodes sao buscados em
+//ordem de setor e cada setor da area de i-nodes e' lido uma unica vez, por
+//mais i-nodes que contenha. Uma posicao recebe NULL se seu i-node nao puder
+//ser lido. Retorna o numero de i-nodes recuperados
+unsigned int inodeLoadMany (const unsigned int *numbers, Inode **inodes,
+                            unsigned int n, Disk *d);
+
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType);
 
-//Funcao que modifica o tamanho do arquivo referente a um i-node, em bytes
-void inodeSetFileSize (Inode *i, unsigned int fileSize);
+//Funcao que modifica o tamanho do arquivo referente a um i-node, em bytes.
+//Apenas os 56 bits baixos de fileSize sao guardados (INODE_MAX_FILESIZE)
+void inodeSetFileSize (Inode *i, unsigned long long fileSize);
 
 //Funcao que modifica o proprietario do arquivo referente a um i-node
 void inodeSetOwner (Inode *i, unsigned int owner);
@@ -71,6 +96,15 @@ void inodeSetRefCount (Inode *i, unsigned int refCount);
 //E' a unica funcao que salva automaticamente o i-node em disco
 int inodeAddBlock (Inode *i, unsigned int blockAddr);
 
+//Funcao que adiciona n enderecos (blockAddrs) ao fim do array de blocos de
+//um i-node, preenchendo a ultima extensao e criando as extensoes que faltarem.
+//Cada extensao alterada e' salva uma unica vez, em vez de uma vez por
+//endereco; o proprio i-node, que precisa ser o primeiro de sua cadeia, nao e'
+//salvo e cabe a quem chamou grava'-lo (write-back). Retorna o
+//numero de enderecos adicionados (menor que n se faltarem i-nodes livres
+//para novas extensoes) ou -1 em caso de falha
+int inodeAddBlocks (Inode *i, const unsigned int *blockAddrs, unsigned int n);
+
 //Funcao que retorna o numero de um i-node.
 unsigned int inodeGetNumber (Inode *i);
 
@@ -81,7 +115,7 @@ unsigned int inodeGetNextNumber (Inode *i);
 unsigned int inodeGetFileType (Inode *i);
 
 //Funcao que retorna o tamanho do arquivo referente ao i-node, em bytes
-unsigned int inodeGetFileSize (Inode *i);
+unsigned long long inodeGetFileSize (Inode *i);
 
 //Funcao que retorna o proprietario do arquivo referente a um i-node
 unsigned int inodeGetOwner (Inode *i);
@@ -100,8 +134,46 @@ unsigned int inodeGetRefCount (Inode *i);
 //Retorna 0 se o bloco nao possuir endereco em blockNum
 unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum);
 
+//Funcao que copia para addrs os enderecos de blocos de um i-node, na ordem do
+//arquivo, percorrendo sua cadeia de extensoes uma unica vez. Sao copiados no
+//maximo max enderecos, parando no primeiro bloco sem endereco. O i-node
+//precisa ser o primeiro de sua cadeia. Retorna o numero de enderecos copiados
+unsigned int inodeGetBlockAddrs (Inode *i, unsigned int *addrs,
+                                 unsigned int max);
+
+//Funcao que substitui os n enderecos de blocos de um i-node a partir do bloco
+//blockNum pelos enderecos em blockAddrs, percorrendo a cadeia de extensoes uma
+//unica vez e salvando cada extensao alterada uma vez. Os blocos precisam ja'
+//ter endereco (ainda que INODE_HOLE). O i-node precisa ser o primeiro de sua
+//cadeia e, como em inodeAddBlocks, nao e' salvo. Retorna 0 se bem sucedida ou
+//-1 caso contrario
+int inodeSetBlockAddrs (Inode *i, unsigned int blockNum,
+                        const unsigned int *blockAddrs, unsigned int n);
+
+//Funcao que reduz o array de blocos de um i-node aos seus numBlocks primeiros
+//enderecos. As extensoes que deixam de ser necessarias sao liberadas. Os
+//blocos em si nao sao liberados. O i-node precisa ser o primeiro de sua
+//cadeia e e' salvo em disco. Retorna o numero de extensoes liberadas ou -1
+//em caso de falha
+int inodeTruncateBlocks (Inode *i, unsigned int numBlocks);
+
+//Funcao que libera um i-node e toda a sua cadeia de extensoes no disco,
+//tornando-os livres para reuso. Os blocos do arquivo nao sao liberados. O
+//i-node precisa ser o primeiro de sua cadeia e nao deve mais ser salvo; a
+//memoria de i continua a cargo de quem chamou. Retorna o numero de i-nodes
+//liberados ou -1 em caso de falha
+int inodeFree (Inode *i);
+
 //Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
-//startFrom. Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
+//startFrom. Um i-node e' livre se o numero gravado em disco for 0, isto e',
+//se nunca foi criado ou se foi liberado. Retorna o numero do inode livre
+//encontrado ou 0 se nao encontrado.
 unsigned int inodeFindFreeInode (unsigned int startFrom, Disk *d);
 
+//Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
+//startFrom, e o cria vazio, como inodeCreate. A busca e a criacao ocorrem
+//juntas, de modo que duas threads nunca recebem o mesmo i-node. Retorna
+//ponteiro para o i-node criado ou NULL se nao houver i-node livre
+Inode* inodeCreateFree (unsigned int startFrom, Disk *d);
+
 #endif
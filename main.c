@@ -23,6 +23,8 @@
 
 #define NO_ID -1
 
+#define DIRLIST_BATCH 32 //Entradas lidas por chamada na listagem de diretorio
+
 //Tipo para manter dados sobre descritores de arquivos
 typedef struct fd {
 	int status; //Status do descritor de arquivos: 0 fechado, 1 aberto
@@ -469,16 +471,21 @@ void doDirList (void) {
 		printf ("\n!! DirList: FAILED. No root filesystem mounted!\n");
 	else {
 		int fd, res;
-		char entryname[MAX_FILENAME_LENGTH+1];
-		unsigned int inumber;
+		FSDirEntry entries[DIRLIST_BATCH];
 		printf ("\n>> DirList: Directory descriptor (#): ");
 		scanf (" %u", &fd);
 		printf ("\n-- DirList: Listing...\n"); fflush (stdout);
-		res = vfsReaddir (fd, entryname, &inumber);
+		res = vfsReaddirPlus (fd, entries, DIRLIST_BATCH);
 		while ( res > 0 ) {
-			printf ("-- Inode #: %5d     Name: %s\n",
-			        inumber, entryname);
-			res = vfsReaddir (fd, entryname, &inumber);
+			for (int i=0; i<res; i++)
+				printf ("-- Inode #: %5u  %s  Size: %10llu  "
+				        "Links: %3u     Name: %s\n",
+				        entries[i].inumber,
+				        (entries[i].fileType == FILETYPE_DIR ?
+				         "dir " : "file"),
+				        entries[i].fileSize,
+				        entries[i].refCount, entries[i].name);
+			res = vfsReaddirPlus (fd, entries, DIRLIST_BATCH);
 		}
 		if ( res == -1 )
 			printf ("\n!! DirList: FAILED. Invalid file "
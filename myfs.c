@@ -8,22 +8,62 @@
 *
 */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "myfs.h"
 #include "vfs.h"
 #include "inode.h"
+#include "extent.h"
 #include "util.h"
 
 //Declaracoes globais
 #define MYFS_MAGIC 0x4D594653  // "MYFS" em ASCII
 #define SUPERBLOCK_SECTOR 0
-#define BITMAP_SECTOR 1
-#define MAX_OPEN_FILES 128
+#define INODE_AREA_SECTORS 64    // Minimo de setores da area de i-nodes
+#define INODE_AREA_RATIO 128     // Setores do disco por setor de i-nodes
+#define FDTABLE_MIN 64          // Capacidade inicial da tabela de descritores
+#define FDTABLE_SEGMENTS 14     // Segmentos da tabela: ate' ~1M descritores
+#define FD_FILE 0               // Tipos de descritor exigidos por fdLock
+#define FD_DIR 1
+#define FD_ANY 2
+#define MAX_BLOCKSIZE 32768     // recLen das entradas de diretorio tem 2 bytes
+#define ROOT_INUMBER 1          // I-node do diretorio raiz
+#define DCACHE_MAX_ENTRIES 4096 // Entradas de outros diretorios na cache
+#define DIRCACHE_SIZE 8         // Diretorios mantidos abertos depois de usados
+#define MAP_READAHEAD_MIN 4     // Janela de leitura antecipada dos mapeamentos,
+#define MAP_READAHEAD_MAX 64    // em blocos, dobrada a cada acesso sequencial
 
-#define MAX_FILES 128
-#define MAX_FILENAME 32
+// Diretorios sao arquivos do MyFS organizados como uma arvore B+ indexada
+// pelo hash dos nomes, com a raiz no bloco 0. Blocos de indice tem um
+// cabecalho [magic: 4][count: 4][level: 4] seguido de count pares
+// [hash: 4][bloco: 4], ordenados pelo hash; o bloco de cada par cobre os
+// hashes a partir do seu e menores que o do par seguinte, e o primeiro par
+// da raiz comeca no hash 0. Os pares de blocos de nivel 0 apontam para
+// folhas; os de nivel n, para blocos de indice de nivel n-1. As folhas tem
+// um cabecalho [magic: 4][proxima folha: 4], que as encadeia na ordem dos
+// hashes (0 na ultima), seguido de entradas de tamanho variavel, em ordem de
+// hash e nome, que nunca cruzam o limite de um bloco:
+//   [inumber: 4][recLen: 2][nameLen: 1][tipo: 1][nome: nameLen]
+// recLen e' o tamanho da entrada, multiplo de 4, mais o espaco livre que a
+// segue ate' a proxima. Uma entrada com inumber 0 esta' livre. Entradas de
+// mesmo hash ficam sempre na mesma folha. Uma folha que fica vazia sai da
+// arvore, e o ultimo bloco do arquivo ocupa o seu lugar. Com a raiz em cache,
+// uma busca le um bloco por nivel abaixo dela
+#define DIRINDEX_MAGIC 0x48444952  // "HDIR" em ASCII
+#define DIRINDEX_HEADER 12
+#define DIRLEAF_MAGIC 0x484C4546   // "HLEF" em ASCII
+#define DIRLEAF_HEADER 8
+#define DIRTREE_MAX_DEPTH 8        // Blocos de indice de um caminho ate' a folha
+#define DIRENT_HEADER 8
+#define DIRENT_SIZE(nameLen) ((DIRENT_HEADER + (nameLen) + 3) & ~3u)
 
 // Estrutura do superbloco
 typedef struct {
@@ -33,30 +73,215 @@ typedef struct {
     unsigned int freeBlocks;
     unsigned int firstDataBlock;
     unsigned int bitmapSectors;
-    unsigned int reserved[122];
+    unsigned int bitmapStart;     // Primeiro setor do bitmap
+    unsigned int inodeCount;      // Numero total de i-nodes
+    unsigned int freeInodes;      // I-nodes livres (inclui extensoes)
+    unsigned int numFiles;        // Arquivos existentes
+    unsigned int refTableInode;   // Arquivo com as referencias de blocos
+    unsigned int reserved[117];
 } Superblock;
 
-// Estrutura do descritor de arquivo
+// I-node em memoria, compartilhado por todos os descritores abertos sobre o
+// mesmo arquivo. Mantem o mapa de blocos do arquivo, para evitar percorrer a
+// cadeia de extensoes do i-node a cada acesso, e os dados ainda sem bloco
+// alocado quando a alocacao atrasada esta' ativa. O i-node, o mapa e os
+// dados sao protegidos por lock: leituras do arquivo a obtem para leitura e
+// seguem em paralelo; escritas, truncamento e sincronizacao, para escrita.
+// openCount, busy e next sao protegidos por memInodesLock
+typedef struct memInode {
+	unsigned int inumber;
+	unsigned int type;		// Tipo do arquivo, fixo enquanto aberto
+	Inode *inode;
+	int openCount;
+	int busy;			// Sendo lido do disco ou gravado no fechamento
+	pthread_rwlock_t lock;
+	unsigned int *blocks;		// Enderecos dos blocos do arquivo
+	unsigned int numBlocks;
+	unsigned int blocksCap;
+	// Alocacao atrasada: bytes a partir de numBlocks * blockSize que ainda
+	// nao tem bloco no disco e os blocos reservados para eles
+	unsigned char *delayBuf;
+	unsigned long long delayLen;
+	unsigned long long delayCap;
+	unsigned int reserved;
+	unsigned char *dirIndex;	// Raiz do indice, se for diretorio
+	int dirty;			// I-node modificado e nao salvo
+	struct memInode *next;
+} MemInode;
+
+// Estrutura do descritor de arquivo. Os campos sao protegidos por lock,
+// obtida para escrita pelas operacoes que alteram o cursor ou o buffer de
+// escrita e para leitura pelas demais; nextFree, por fdTableLock
 typedef struct {
+    pthread_rwlock_t lock;
     int inUse;
+    int isDir;              // Descritor de diretorio (opendir)
     unsigned int inumber;
-    unsigned int cursor;
-    Inode *inode;
+    unsigned long long cursor; // Em diretorios, o hash da ultima entrada lida
+    unsigned int dirSkip;   // Entradas lidas com hash igual ao cursor
+    MemInode *mi;
+    // Buffer de escrita opcional: acumula escritas pequenas e consecutivas,
+    // sem cruzar o fim de um bloco, a partir da posicao wbufStart
+    int buffered;
+    unsigned char *wbuf;
+    unsigned long long wbufStart;
+    unsigned int wbufLen;
+    int nextFree;           // Proximo descritor da lista de livres (-1: fim)
 } FileDescriptor;
 
+// Trecho de arquivo mapeado em memoria (mmap), uma cache de blocos do
+// arquivo: o espaco de data, alinhado aos blocos, e' reservado no
+// mapeamento, mas cada bloco so' e' lido do arquivo no primeiro acesso
+// declarado em myFSMfault, junto com os blocos seguintes da janela de
+// leitura antecipada. present e dirty tem um bit por bloco: ja' lido do
+// arquivo e alterado desde a ultima gravacao. Os bits e a janela sao
+// protegidos por lock
+typedef struct mapRegion {
+	MemInode *mi;
+	unsigned long long offset;	// Multiplo do tamanho de bloco
+	unsigned long long length;	// Multiplo do tamanho de bloco
+	int prot;
+	unsigned char *data;
+	unsigned char *present;
+	unsigned char *dirty;		// NULL se somente leitura
+	unsigned int raNext;		// Bloco seguinte a' ultima leitura
+	unsigned int raBlocks;		// Janela de leitura antecipada atual
+	pthread_mutex_t lock;
+	struct mapRegion *next;
+} MapRegion;
+
+// Entrada de diretorio decodificada de um bloco do diretorio
 typedef struct {
-	char name[MAX_FILENAME];
 	unsigned int inumber;
+	unsigned int recLen;
+	unsigned int nameLen;
+	unsigned int type;
+	const unsigned char *name;	// Aponta para o bloco; sem \0
 } DirEntry;
 
+// Caminho da raiz ate' uma folha na arvore de um diretorio
+typedef struct {
+	unsigned int depth;			// Blocos de indice no caminho
+	unsigned int num[DIRTREE_MAX_DEPTH];	// Blocos de indice, a partir da raiz
+	unsigned int pos[DIRTREE_MAX_DEPTH];	// Par seguido em cada um deles
+	unsigned int leaf;			// Bloco da folha
+} DirPath;
+
 
 // Variaveis globais
 static Superblock *mountedSB = NULL;
-static FileDescriptor fdTable[MAX_OPEN_FILES];
+
+// Tabela de descritores, em segmentos que nunca mudam de lugar: o segmento
+// s tem FDTABLE_MIN << s descritores e so' e' alocado quando todos os
+// anteriores estao em uso, o que dobra a capacidade. Assim, um descritor e'
+// encontrado pelo indice sem trava, mesmo com a tabela crescendo. Os
+// descritores livres formam uma lista encadeada pelos indices, de modo que
+// abrir e fechar custam O(1), e fdOpenCount conta os que estao em uso. A
+// lista, o crescimento e fdOpenCount sao protegidos por fdTableLock
+static FileDescriptor *fdSegments[FDTABLE_SEGMENTS];
+static unsigned int fdNumSegments = 0;
+static int fdFreeHead = -1;
+static unsigned int fdOpenCount = 0;
+static pthread_mutex_t fdTableLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Trechos de arquivos mapeados em memoria. A lista e' protegida por mapLock
+static MapRegion *mappings = NULL;
+static pthread_rwlock_t mapLock = PTHREAD_RWLOCK_INITIALIZER;
 static Disk *mountedDisk = NULL;
 
-static DirEntry rootDir[MAX_FILES];
-static int rootDirSize = 0;
+// Diretorio raiz, aberto durante toda a montagem
+static MemInode *rootDir = NULL;
+
+// Diretorios usados mais recentemente na resolucao de caminhos, mantidos
+// abertos (do mais para o menos recente) para que uma nova busca neles nao
+// recarregue o mapa de blocos nem a raiz da arvore
+static MemInode *dirCache[DIRCACHE_SIZE];
+static pthread_mutex_t dirCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Tabela hash em memoria (enderecamento aberto, sondagem linear) dos nomes
+// de diretorio, carregada na montagem com as entradas do diretorio raiz.
+// Com ela completa, buscas no raiz nao leem o disco. Nos demais diretorios
+// a tabela e' uma cache de resolucao de caminhos: guarda as buscas ja' feitas,
+// inclusive as de nomes inexistentes (inumber 0), ate' DCACHE_MAX_ENTRIES.
+// A tabela e a raiz do indice dos diretorios, carregada sob demanda, sao
+// protegidas por nameLock; buscas na cache seguem em paralelo
+typedef struct {
+	unsigned int dir;	// I-node do diretorio (0: posicao vazia)
+	unsigned int inumber;	// 0: nome inexistente no diretorio
+	unsigned int hash;
+	unsigned int type;
+	char *name;
+} NameEntry;
+
+static NameEntry *nameTable = NULL;
+static unsigned int nameTableCap = 0;	// Potencia de 2
+static unsigned int nameTableCount = 0;
+static int rootNamesLoaded = 0;		// Tabela completa para o raiz
+static unsigned int dcacheCount = 0;	// Entradas de outros diretorios
+static unsigned int dcacheHand = 0;	// Proxima posicao a examinar no descarte
+static pthread_rwlock_t nameLock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Cache do bitmap de blocos livres, carregado na montagem. O buffer tem o
+// tamanho exato dos setores do bitmap, para que cada setor sujo possa ser
+// gravado diretamente a partir dele
+static unsigned char *bitmapCache = NULL;
+static unsigned char *bitmapDirty = NULL;	// 1 flag por setor do bitmap
+
+// Indice de extents livres, mantido junto com o bitmap em memoria e
+// reconstruido a partir dele na montagem. Se nao puder ser mantido (falta
+// de memoria), fica NULL e as buscas usam apenas o bitmap
+static ExtentTree *freeExtents = NULL;
+
+// Dica de alocacao: indice do bloco a partir do qual a proxima busca por
+// bloco livre comeca (next-fit), evitando reexaminar o inicio do disco
+static unsigned int allocHint = 0;
+
+// Lista dos i-nodes em memoria (arquivos abertos). memInodesLock protege a
+// lista e o numero de aberturas; memInodesCond sinaliza que um i-node deixou
+// de estar ocupado (lido do disco ou gravado no ultimo fechamento)
+static MemInode *memInodes = NULL;
+static pthread_mutex_t memInodesLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t memInodesCond = PTHREAD_COND_INITIALIZER;
+
+// Alocacao atrasada: quando ativa, escritas alem dos blocos ja' alocados
+// apenas reservam espaco e mantem os dados em memoria. Os blocos sao
+// alocados e gravados de uma vez no fechamento ou na sincronizacao. O
+// modo e' lido e alterado atomicamente, por delayedAllocEnabled e
+// myFSSetDelayedAlloc; a reserva, sob allocLock
+static int delayedAlloc = 0;
+static unsigned int reservedBlocks = 0;	// Total de blocos reservados
+
+// Numero de referencias dos blocos compartilhados por arquivos clonados, em
+// tabela hash (enderecamento aberto, sondagem linear) indexada pelo
+// endereco do bloco. Blocos fora da tabela tem uma unica referencia. A
+// tabela e' guardada em um arquivo oculto, sem entrada em diretorio, cujo
+// i-node e' indicado no superbloco, e gravada na sincronizacao
+typedef struct {
+	unsigned int addr;	// Endereco do bloco (0: posicao vazia)
+	unsigned int refs;	// Numero de referencias, sempre maior que 1
+} BlockRef;
+
+static BlockRef *refTable = NULL;
+static unsigned int refTableCap = 0;	// Potencia de 2
+static unsigned int refTableCount = 0;
+static int refTableDirty = 0;
+static MemInode *refFile = NULL;	// Arquivo da tabela, se ja' existir
+
+// Numero de setores por cilindro do disco montado, usado para agrupar os
+// blocos de dados em grupos de cilindro na escolha de blocos proximos
+static unsigned long sectorsPerCylinder = 0;
+
+// Trava do alocador: protege o bitmap em memoria, o indice de extents livres,
+// a dica de alocacao, a reserva da alocacao atrasada, a tabela de referencias
+// e os contadores do superbloco. E' mantida so' enquanto essas estruturas
+// sao consultadas ou alteradas, nunca durante a E/S dos dados; as funcoes
+// do alocador supoem que quem as chama a obteve
+static pthread_mutex_t allocLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Serializa a gravacao dos metadados globais (tabela de referencias, bitmap e
+// superbloco), para que uma copia antiga nunca seja gravada depois de outra
+// mais recente
+static pthread_mutex_t syncLock = PTHREAD_MUTEX_INITIALIZER;
 
 // Funcoes auxiliares
 static unsigned int bytesToSectors(unsigned int bytes) {
@@ -68,12 +293,13 @@ static unsigned int blockToSector(unsigned int blockNum, Superblock *sb) {
     return sb->firstDataBlock + (blockNum * sectorsPerBlock);
 }
 
-static int readBitmap(Disk *d, unsigned char *bitmap, unsigned int bitmapSize) {
+static int readBitmap(Disk *d, unsigned int startSector, unsigned char *bitmap,
+                      unsigned int bitmapSize) {
     unsigned int sectorsNeeded = bytesToSectors(bitmapSize);
     unsigned char sector[DISK_SECTORDATASIZE];
     
     for (unsigned int i = 0; i < sectorsNeeded; i++) {
-        if (diskReadSector(d, BITMAP_SECTOR + i, sector) < 0)
+        if (diskReadSector(d, startSector + i, sector) < 0)
             return -1;
         
         unsigned int copySize = (bitmapSize > DISK_SECTORDATASIZE) 
@@ -85,7 +311,8 @@ static int readBitmap(Disk *d, unsigned char *bitmap, unsigned int bitmapSize) {
     return 0;
 }
 
-static int writeBitmap(Disk *d, unsigned char *bitmap, unsigned int bitmapSize) {
+static int writeBitmap(Disk *d, unsigned int startSector, unsigned char *bitmap,
+                       unsigned int bitmapSize) {
     unsigned int sectorsNeeded = bytesToSectors(bitmapSize);
     unsigned char sector[DISK_SECTORDATASIZE];
     
@@ -97,7 +324,7 @@ static int writeBitmap(Disk *d, unsigned char *bitmap, unsigned int bitmapSize)
                                 : bitmapSize;
         memcpy(sector, bitmap + (i * DISK_SECTORDATASIZE), copySize);
         
-        if (diskWriteSector(d, BITMAP_SECTOR + i, sector) < 0)
+        if (diskWriteSector(d, startSector + i, sector) < 0)
             return -1;
         
         bitmapSize -= copySize;
@@ -105,429 +332,4528 @@ static int writeBitmap(Disk *d, unsigned char *bitmap, unsigned int bitmapSize)
     return 0;
 }
 
-//Funcao para verificacao se o sistema de arquivos está ocioso, ou seja,
-//se nao ha quisquer descritores de arquivos em uso atualmente. Retorna
-//um positivo se ocioso ou, caso contrario, 0.
-int myFSIsIdle (Disk *d) {
-	for (int i = 0; i < MAX_OPEN_FILES; i++) {
-		if (fdTable[i].inUse) {
-			return 0;
-		}
-	}
-	return 1;
-}
+// Carrega o bitmap inteiro do disco para a memoria. Retorna 0 em caso de
+// sucesso ou -1 caso contrario
+static int bitmapLoad(Disk *d, Superblock *sb) {
+	unsigned int cacheSize = sb->bitmapSectors * DISK_SECTORDATASIZE;
 
-//Funcao para formatacao de um disco com o novo sistema de arquivos
-//com tamanho de blocos igual a blockSize. Retorna o numero total de
-//blocos disponiveis no disco, se formatado com sucesso. Caso contrario,
-//retorna -1.
-int myFSFormat (Disk *d, unsigned int blockSize) {
-	if (!d || blockSize < DISK_SECTORDATASIZE || blockSize % DISK_SECTORDATASIZE != 0) {
-		return -1;
-	}
-	
-	unsigned int totalSectors = diskGetNumSectors(d);
-	unsigned int sectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
-	
-	// Calcular area de i-nodes
-	unsigned int inodeAreaStart = inodeAreaBeginSector();
-	unsigned int inodesPerSector = inodeNumInodesPerSector();
-	unsigned int inodeAreaSectors = 64;
-	
-	// Estimar numero de blocos
-	unsigned int firstDataSector = BITMAP_SECTOR + 1 + inodeAreaSectors;
-	unsigned int availableDataSectors = totalSectors - firstDataSector;
-	unsigned int totalBlocks = availableDataSectors / sectorsPerBlock;
-	
-	// Calcular tamanho do bitmap
-	unsigned int bitmapSizeBytes = (totalBlocks + 7) / 8;
-	unsigned int bitmapSectors = bytesToSectors(bitmapSizeBytes);
-	
-	// Reajustar firstDataSector
-	firstDataSector = BITMAP_SECTOR + bitmapSectors + inodeAreaSectors;
-	availableDataSectors = totalSectors - firstDataSector;
-	totalBlocks = availableDataSectors / sectorsPerBlock;
-	bitmapSizeBytes = (totalBlocks + 7) / 8;
-	
-	// Criar superbloco
-	Superblock sb;
-	memset(&sb, 0, sizeof(Superblock));
-	sb.magic = MYFS_MAGIC;
-	sb.blockSize = blockSize;
-	sb.totalBlocks = totalBlocks;
-	sb.freeBlocks = totalBlocks;
-	sb.firstDataBlock = firstDataSector;
-	sb.bitmapSectors = bitmapSectors;
-	
-	// Escrever superbloco
-	unsigned char sector[DISK_SECTORDATASIZE];
-	memset(sector, 0, DISK_SECTORDATASIZE);
-	memcpy(sector, &sb, sizeof(Superblock));
-	
-	if (diskWriteSector(d, SUPERBLOCK_SECTOR, sector) < 0) {
+	bitmapCache = malloc(cacheSize);
+	bitmapDirty = calloc(sb->bitmapSectors, 1);
+	if (!bitmapCache || !bitmapDirty || readBitmap(d, sb->bitmapStart, bitmapCache, cacheSize) < 0) {
+		free(bitmapCache);
+		free(bitmapDirty);
+		bitmapCache = NULL;
+		bitmapDirty = NULL;
 		return -1;
 	}
-	
-	// Inicializar bitmap (todos livres)
-	unsigned char *bitmap = calloc(bitmapSizeBytes, 1);
-	if (!bitmap) {
-		return -1;
+	return 0;
+}
+
+// Marca um bloco (numerado a partir de 0) como ocupado ou livre no bitmap
+// em memoria, registrando o setor correspondente como sujo
+static void bitmapSetBit(unsigned int blockIdx, int used) {
+	unsigned int byteIdx = blockIdx / 8;
+	unsigned char mask = 1 << (blockIdx % 8);
+
+	if (used) bitmapCache[byteIdx] |= mask;
+	else bitmapCache[byteIdx] &= ~mask;
+	bitmapDirty[byteIdx / DISK_SECTORDATASIZE] = 1;
+}
+
+// Marca count blocos consecutivos, a partir de blockIdx, como ocupados ou
+// livres no bitmap em memoria, registrando os setores afetados como sujos
+static void bitmapSetRange(unsigned int blockIdx, unsigned int count, int used) {
+	unsigned int end = blockIdx + count;
+
+	while (blockIdx < end && blockIdx % 8 != 0)
+		bitmapSetBit(blockIdx++, used);
+	if (end - blockIdx >= 8) {
+		unsigned int firstByte = blockIdx / 8;
+		unsigned int numBytes = (end - blockIdx) / 8;
+		memset(bitmapCache + firstByte, used ? 0xFF : 0x00, numBytes);
+		for (unsigned int s = firstByte / DISK_SECTORDATASIZE;
+		     s <= (firstByte + numBytes - 1) / DISK_SECTORDATASIZE; s++)
+			bitmapDirty[s] = 1;
+		blockIdx += numBytes * 8;
 	}
-	
-	if (writeBitmap(d, bitmap, bitmapSizeBytes) < 0) {
-		free(bitmap);
-		return -1;
+	while (blockIdx < end)
+		bitmapSetBit(blockIdx++, used);
+}
+
+// Retorna o numero de zeros a direita do bit 1 menos significativo de w,
+// que nao pode ser 0
+static unsigned int bitCountTrailingZeros(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(w);
+#else
+	unsigned int n = 0;
+	while (!(w & 1)) {
+		w >>= 1;
+		n++;
 	}
-	free(bitmap);
-	
-	// Limpar i-nodes iniciais
-	for (unsigned int i = 1; i <= 100; i++) {
-		Inode *inode = inodeCreate(i, d);
-		if (inode) {
-			free(inode);
+	return n;
+#endif
+}
+
+// Le a palavra de 64 bits de indice wordIdx do bitmap em memoria. O bit i
+// da palavra corresponde ao bloco wordIdx * 64 + i, independente da ordem
+// de bytes da plataforma
+static uint64_t bitmapWord(unsigned int wordIdx) {
+	const unsigned char *p = bitmapCache + wordIdx * 8;
+	uint64_t w = 0;
+	for (int i = 7; i >= 0; i--)
+		w = (w << 8) | p[i];
+	return w;
+}
+
+// Procura o primeiro bloco livre no intervalo [from, to) do bitmap em
+// memoria, examinando 64 blocos por vez. Palavras totalmente ocupadas sao
+// puladas; com AVX2, trechos longos ocupados sao pulados 256 blocos por vez.
+// Retorna o indice do bloco encontrado ou to, se nao houver bloco livre
+static unsigned int bitmapFindFree(unsigned int from, unsigned int to) {
+	unsigned int wordIdx = from / 64;
+	unsigned int endWord = (to + 63) / 64;
+	uint64_t freeBits;
+
+	if (from >= to) return to;
+	freeBits = ~bitmapWord(wordIdx) & (~(uint64_t)0 << (from % 64));
+	while (!freeBits) {
+		wordIdx++;
+#ifdef __AVX2__
+		const __m256i ones = _mm256_set1_epi8((char)0xFF);
+		while (wordIdx + 4 <= endWord) {
+			__m256i v = _mm256_loadu_si256(
+				(const __m256i *)(bitmapCache + wordIdx * 8));
+			if (!_mm256_testc_si256(v, ones)) break;
+			wordIdx += 4;
 		}
+#endif
+		if (wordIdx >= endWord) return to;
+		freeBits = ~bitmapWord(wordIdx);
 	}
-	
-	return totalBlocks;
+	from = wordIdx * 64 + bitCountTrailingZeros(freeBits);
+	return (from < to ? from : to);
 }
 
-//Funcao para montagem/desmontagem do sistema de arquivos, se possível.
-//Na montagem (x=1) e' a chance de se fazer inicializacoes, como carregar
-//o superbloco na memoria. Na desmontagem (x=0), quaisquer dados pendentes
-//de gravacao devem ser persistidos no disco. Retorna um positivo se a
-//montagem ou desmontagem foi bem sucedida ou, caso contrario, 0.
-int myFSxMount (Disk *d, int x) {
-	if (x == 1) {
-		// MONTAGEM
-		if (!d || mountedSB != NULL) {
-			return 0;
-		}
-		
-		// Ler superbloco
-		unsigned char sector[DISK_SECTORDATASIZE];
-		if (diskReadSector(d, SUPERBLOCK_SECTOR, sector) < 0) {
-			return 0;
-		}
-		
-		// Alocar e copiar superbloco
-		mountedSB = malloc(sizeof(Superblock));
-		if (!mountedSB) {
-			return 0;
-		}
-		memcpy(mountedSB, sector, sizeof(Superblock));
-		
-		// Validar numero magico
-		if (mountedSB->magic != MYFS_MAGIC) {
-			free(mountedSB);
-			mountedSB = NULL;
-			return 0;
-		}
-		
-		// Inicializar tabela de descritores
-		for (int i = 0; i < MAX_OPEN_FILES; i++) {
-			fdTable[i].inUse = 0;
-			fdTable[i].inumber = 0;
-			fdTable[i].cursor = 0;
-			fdTable[i].inode = NULL;
-		}
-		
-		mountedDisk = d;
-		return 1;
-		
-	} else {
-		// DESMONTAGEM
-		if (!mountedSB) {
-			return 0;
-		}
-		
-		if (!myFSIsIdle(d)) {
-			return 0;
-		}
-		
-		free(mountedSB);
-		mountedSB = NULL;
-		mountedDisk = NULL;
-		
-		return 1;
+// Procura o primeiro bloco ocupado no intervalo [from, to) do bitmap em
+// memoria, examinando 64 blocos por vez. Retorna o indice do bloco
+// encontrado ou to, se todo o intervalo estiver livre
+static unsigned int bitmapFindUsed(unsigned int from, unsigned int to) {
+	unsigned int wordIdx = from / 64;
+	unsigned int endWord = (to + 63) / 64;
+	uint64_t usedBits;
+
+	if (from >= to) return to;
+	usedBits = bitmapWord(wordIdx) & (~(uint64_t)0 << (from % 64));
+	while (!usedBits) {
+		if (++wordIdx >= endWord) return to;
+		usedBits = bitmapWord(wordIdx);
 	}
+	from = wordIdx * 64 + bitCountTrailingZeros(usedBits);
+	return (from < to ? from : to);
 }
 
-unsigned int dirFind(const char *name) {
-	for (int i = 0; i < rootDirSize; i++) {
-		if (strcmp(rootDir[i].name, name) == 0) {
-			return rootDir[i].inumber;
+// Grava no disco apenas os setores do bitmap modificados desde a ultima
+// sincronizacao, com syncLock obtida. Cada setor e' copiado sob a trava do
+// alocador e gravado fora dela; se a gravacao falhar, volta a ser marcado.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int bitmapSync(Disk *d, Superblock *sb) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	for (unsigned int i = 0; i < sb->bitmapSectors; i++) {
+		pthread_mutex_lock(&allocLock);
+		int dirty = bitmapDirty[i];
+		if (dirty)
+			memcpy(sector, bitmapCache + i * DISK_SECTORDATASIZE,
+			       DISK_SECTORDATASIZE);
+		bitmapDirty[i] = 0;
+		pthread_mutex_unlock(&allocLock);
+		if (dirty && diskWriteSector(d, sb->bitmapStart + i, sector) < 0) {
+			pthread_mutex_lock(&allocLock);
+			bitmapDirty[i] = 1;
+			pthread_mutex_unlock(&allocLock);
+			return -1;
 		}
 	}
 	return 0;
 }
 
-int dirAdd(const char *name, unsigned int inumber) {
-	if (rootDirSize >= MAX_FILES) {
-		return -1;
-	}
+// Libera o cache do bitmap e o indice de extents livres
+static void bitmapRelease(void) {
+	free(bitmapCache);
+	free(bitmapDirty);
+	bitmapCache = NULL;
+	bitmapDirty = NULL;
+	extentTreeDestroy(freeExtents);
+	freeExtents = NULL;
+}
 
-	strncpy(rootDir[rootDirSize].name, name, MAX_FILENAME - 1);
-	rootDir[rootDirSize].name[MAX_FILENAME - 1] = '\0';
-	rootDir[rootDirSize].inumber = inumber;
-	rootDirSize++;
+// Reconstroi o indice de extents livres a partir do bitmap em memoria,
+// percorrendo as sequencias de blocos livres em ordem crescente
+static void freeExtentsBuild(Superblock *sb) {
+	unsigned int pos = 0;
 
-	return 0;
+	extentTreeDestroy(freeExtents);
+	freeExtents = extentTreeCreate();
+	while (freeExtents && pos < sb->totalBlocks) {
+		unsigned int runStart = bitmapFindFree(pos, sb->totalBlocks);
+		if (runStart == sb->totalBlocks) break;
+		pos = bitmapFindUsed(runStart, sb->totalBlocks);
+		if (extentTreeInsert(freeExtents, runStart, pos - runStart) < 0) {
+			extentTreeDestroy(freeExtents);
+			freeExtents = NULL;
+		}
+	}
 }
 
-static Inode* myFSGetOrCreateInode(Disk *d, const char *filename) {
-	if (!d || !filename || strlen(filename) == 0) {
-		return NULL;
+// Marca count blocos a partir de blockIdx como ocupados (used = 1) ou
+// livres (used = 0), no bitmap, no indice de extents e no contador de
+// blocos livres do superbloco
+static void blocksSetUsed(Superblock *sb, unsigned int blockIdx,
+                          unsigned int count, int used) {
+	if (count == 0) return;
+	bitmapSetRange(blockIdx, count, used);
+	if (used) sb->freeBlocks -= count;
+	else sb->freeBlocks += count;
+	if (freeExtents) {
+		int ret = (used ? extentTreeRemove(freeExtents, blockIdx, count)
+		                : extentTreeInsert(freeExtents, blockIdx, count));
+		if (ret < 0) {
+			extentTreeDestroy(freeExtents);
+			freeExtents = NULL;
+		}
 	}
+}
 
-	/* 1. Verifica se o arquivo já existe no diretório */
-	unsigned int inumber = dirFind(filename);
-	if (inumber != 0) {
-		/* Arquivo existe: carrega inode */
-		return inodeLoad(inumber, d);
-	}
+// Retorna a posicao do bloco addr na tabela de referencias ou, se ele nao
+// estiver nela, a posicao vazia onde entraria
+static unsigned int blockRefSlot(unsigned int addr) {
+	unsigned int mask = refTableCap - 1;
+	unsigned int i = (addr * 2654435761u) & mask;
+	while (refTable[i].addr != 0 && refTable[i].addr != addr)
+		i = (i + 1) & mask;
+	return i;
+}
 
-	/* 2. Arquivo não existe: encontrar inode livre */
-	unsigned int freeInumber = inodeFindFreeInode(1, d);
-	if (freeInumber == 0) {
-		return NULL;
+// Retorna o numero de referencias do bloco de endereco addr
+static unsigned int blockRefs(unsigned int addr) {
+	if (refTableCount == 0) return 1;
+	BlockRef *r = &refTable[blockRefSlot(addr)];
+	return (r->addr ? r->refs : 1);
+}
+
+// Altera para refs o numero de referencias do bloco de endereco addr. Com
+// uma unica referencia, o bloco sai da tabela. Retorna 0 em caso de sucesso
+// ou -1 se nao houver memoria
+static int blockRefsSet(unsigned int addr, unsigned int refs) {
+	unsigned int i, j, mask;
+
+	if (refs <= 1) {
+		if (refTableCount == 0) return 0;
+		i = blockRefSlot(addr);
+		if (refTable[i].addr == 0) return 0;
+		// Remocao sem marcas: as entradas seguintes da sequencia que nao
+		// ficariam inalcancaveis sao puxadas para a posicao liberada
+		mask = refTableCap - 1;
+		for (j = (i + 1) & mask; refTable[j].addr != 0; j = (j + 1) & mask) {
+			unsigned int k = (refTable[j].addr * 2654435761u) & mask;
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+			refTable[i] = refTable[j];
+			i = j;
+		}
+		refTable[i].addr = 0;
+		refTableCount--;
+		refTableDirty = 1;
+		return 0;
 	}
 
-	/* 3. Criar inode */
-	Inode *inode = inodeCreate(freeInumber, d);
-	if (!inode) {
-		return NULL;
+	if ((refTableCount + 1) * 4 > refTableCap * 3) {
+		unsigned int cap = (refTableCap ? refTableCap * 2 : 1024);
+		BlockRef *old = refTable;
+		unsigned int oldCap = refTableCap;
+		refTable = calloc(cap, sizeof(BlockRef));
+		if (!refTable) {
+			refTable = old;
+			return -1;
+		}
+		refTableCap = cap;
+		for (i = 0; i < oldCap; i++)
+			if (old[i].addr) refTable[blockRefSlot(old[i].addr)] = old[i];
+		free(old);
 	}
+	i = blockRefSlot(addr);
+	if (refTable[i].addr == 0) {
+		refTable[i].addr = addr;
+		refTableCount++;
+	}
+	refTable[i].refs = refs;
+	refTableDirty = 1;
+	return 0;
+}
 
-	/* 4. Inicialização básica do inode */
-	inodeSetFileType(inode, 1);      /* arquivo regular */
-	inodeSetFileSize(inode, 0);
-	inodeSetRefCount(inode, 0);
-	inodeSave(inode);
+// Descarta a tabela de referencias em memoria
+static void blockRefsRelease(void) {
+	free(refTable);
+	refTable = NULL;
+	refTableCap = 0;
+	refTableCount = 0;
+	refTableDirty = 0;
+}
 
-	/* 5. Registrar no diretório */
-	if (dirAdd(filename, freeInumber) != 0) {
-		/* rollback simples */
-		inodeClear(inode);
-		free(inode);
-		return NULL;
+// Libera os blocos de enderecos addrs[0..n) de uma so' vez: cada sequencia
+// de enderecos consecutivos e' devolvida com uma unica atualizacao do bitmap
+// em memoria, gravado depois apenas nos setores afetados. Um bloco
+// compartilhado com um clone apenas perde uma referencia
+static void blocksRelease(Superblock *sb, const unsigned int *addrs,
+                          unsigned int n) {
+	unsigned int i = 0;
+	while (i < n) {
+		unsigned int run = 1, refs;
+		if (addrs[i] == INODE_HOLE) {
+			i++;
+			continue;
+		}
+		if ((refs = blockRefs(addrs[i])) > 1) {
+			blockRefsSet(addrs[i], refs - 1);
+			i++;
+			continue;
+		}
+		while (i + run < n && addrs[i + run] == addrs[i] + run &&
+		       blockRefs(addrs[i + run]) <= 1)
+			run++;
+		blocksSetUsed(sb, addrs[i] - 1, run, 0);
+		i += run;
 	}
-
-	return inode;
 }
 
-// Função auxiliar para alocar um bloco livre no disco
-static unsigned int allocFreeBlock(Disk *d, Superblock *sb) {
-	if (!d || !sb) return 0;
-	unsigned int totalBlocks = sb->totalBlocks;
-	unsigned int bitmapSizeBytes = (totalBlocks + 7) / 8;
-	unsigned char *bitmap = malloc(bitmapSizeBytes);
-	if (!bitmap) return 0;
-	if (readBitmap(d, bitmap, bitmapSizeBytes) < 0) {
-		free(bitmap);
+// Função auxiliar para alocar uma sequencia contigua de ate' n blocos livres.
+// Com o indice de extents, fica com o menor extent livre de pelo menos n
+// blocos (best-fit). Sem ele, a busca no bitmap parte da dica de alocacao e
+// fica com a primeira sequencia livre de n blocos. Em ambos os casos, se nao
+// houver sequencia de n blocos, fica com a maior sequencia encontrada.
+// O numero de blocos efetivamente alocados e' escrito em *count. Retorna o
+// endereco do primeiro bloco da sequencia ou 0 se nao houver bloco livre
+static unsigned int allocContiguousBlocks(Disk *d, Superblock *sb,
+                                          unsigned int n, unsigned int *count) {
+	*count = 0;
+	if (!d || !sb || !bitmapCache || sb->freeBlocks <= reservedBlocks || n == 0)
 		return 0;
+	if (n > sb->freeBlocks - reservedBlocks) n = sb->freeBlocks - reservedBlocks;
+	unsigned int totalBlocks = sb->totalBlocks;
+	unsigned int start = (allocHint < totalBlocks ? allocHint : 0);
+	unsigned int bestStart = 0, bestLen = 0;
+
+	if (freeExtents) {
+		// Best-fit pelo indice de extents: menor sequencia com n blocos
+		if (extentTreeBestFit(freeExtents, n, &bestStart, &bestLen) < 0)
+			return 0;
+		if (bestLen > n) bestLen = n;
 	}
-	// Procura por um bit livre
-	for (unsigned int i = 0; i < totalBlocks; i++) {
-		unsigned int byteIdx = i / 8;
-		unsigned int bitIdx = i % 8;
-		if (!(bitmap[byteIdx] & (1 << bitIdx))) {
-			// Marca como ocupado
-			bitmap[byteIdx] |= (1 << bitIdx);
-			if (writeBitmap(d, bitmap, bitmapSizeBytes) < 0) {
-				free(bitmap);
-				return 0;
+	// Sem indice, duas passadas: da dica ate' o fim do disco e do inicio ate' a dica
+	for (int pass = 0; pass < 2 && bestLen < n && !freeExtents; pass++) {
+		unsigned int pos = (pass == 0 ? start : 0);
+		unsigned int end = (pass == 0 ? totalBlocks : start);
+		while (pos < end && bestLen < n) {
+			unsigned int runStart = bitmapFindFree(pos, end);
+			if (runStart == end) break;
+			unsigned int limit = (end - runStart > n ? runStart + n : end);
+			unsigned int runEnd = bitmapFindUsed(runStart, limit);
+			if (runEnd - runStart > bestLen) {
+				bestStart = runStart;
+				bestLen = runEnd - runStart;
 			}
-			free(bitmap);
-			sb->freeBlocks--;
-			// Retorna o endereço do bloco (número do bloco)
-			return i + 1; // Blocos numerados a partir de 1
+			pos = runEnd;
 		}
 	}
-	free(bitmap);
-	return 0; // Nenhum bloco livre
-}
-
-// Reposiciona o cursor do arquivo aberto para a posição desejada
-// Retorna 0 em caso de sucesso, -1 em caso de erro
-static int myFSSeek(int fd, unsigned int pos) {
-	int idx = fd - 1;
-	if (idx < 0 || idx >= MAX_OPEN_FILES) return -1;
-	if (!fdTable[idx].inUse) return -1;
-	Inode *inode = fdTable[idx].inode;
-	unsigned int fileSize = inodeGetFileSize(inode);
-	if (pos > fileSize) return -1; // Não permite posicionar além do fim
-	fdTable[idx].cursor = pos;
-	return 0;
+	if (bestLen == 0) return 0;
+
+	blocksSetUsed(sb, bestStart, bestLen, 1);
+	allocHint = bestStart + bestLen;
+	*count = bestLen;
+	return bestStart + 1; // Blocos numerados a partir de 1
 }
 
-//Funcao para abertura de um arquivo, a partir do caminho especificado
-//em path, no disco montado especificado em d, no modo Read/Write,
-//criando o arquivo se nao existir. Retorna um descritor de arquivo,
-//em caso de sucesso. Retorna -1, caso contrario.
-int myFSOpen(Disk *d, const char *path) {
-	if (!mountedSB || d != mountedDisk || !path || strlen(path) == 0) {
-		return -1;
-	}
+// Calcula o intervalo [*first, *end) de indices de blocos cujo primeiro
+// setor esta' no cilindro cyl (grupo de cilindro). O intervalo e' vazio se
+// o cilindro nao contiver o inicio de nenhum bloco de dados
+static void cylGroupRange(Superblock *sb, unsigned long cyl,
+                          unsigned int *first, unsigned int *end) {
+	unsigned long sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
+	unsigned long cylStart = cyl * sectorsPerCylinder;
+	unsigned long cylEnd = cylStart + sectorsPerCylinder;
+	unsigned long dataStart = sb->firstDataBlock;
 
-	Inode *inode = myFSGetOrCreateInode(d, path);
-	if (!inode) {
-		return -1;
+	*first = (cylStart <= dataStart ? 0 :
+	          (cylStart - dataStart + sectorsPerBlock - 1) / sectorsPerBlock);
+	*end = (cylEnd <= dataStart ? 0 :
+	        (cylEnd - dataStart + sectorsPerBlock - 1) / sectorsPerBlock);
+	if (*end > sb->totalBlocks) *end = sb->totalBlocks;
+	if (*first > *end) *first = *end;
+}
+
+// Função auxiliar para alocar ate' n blocos contiguos o mais perto possivel
+// do bloco de indice goal (numerado a partir de 0), em distancia de
+// cilindros. Se o proprio goal estiver livre, a sequencia comeca nele. Caso
+// contrario, procura-se a primeira sequencia livre no grupo de cilindro do
+// goal e, depois, o extent livre mais proximo pelo indice de extents (ou,
+// sem indice, os grupos vizinhos, alternando para fora do goal). O
+// numero de blocos alocados e' escrito em *count. Retorna o endereco do
+// primeiro bloco da sequencia ou 0 se nao houver bloco livre
+static unsigned int allocBlocksNear(Disk *d, Superblock *sb, unsigned int goal,
+                                    unsigned int n, unsigned int *count) {
+	*count = 0;
+	if (!d || !sb || !bitmapCache || sb->freeBlocks <= reservedBlocks || n == 0)
+		return 0;
+	if (n > sb->freeBlocks - reservedBlocks) n = sb->freeBlocks - reservedBlocks;
+	if (goal >= sb->totalBlocks || sectorsPerCylinder == 0)
+		return allocContiguousBlocks(d, sb, n, count);
+
+	unsigned long goalCyl, numCyl = diskGetNumCylinders(d);
+	unsigned int first, end, runStart;
+	if (diskAddrToCylinder(d, blockToSector(goal, sb), &goalCyl) < 0)
+		return allocContiguousBlocks(d, sb, n, count);
+
+	// No grupo do goal: primeiro a partir do goal
+	cylGroupRange(sb, goalCyl, &first, &end);
+	runStart = bitmapFindFree(goal, end);
+	if (runStart == end) {
+		runStart = bitmapFindFree(first, goal);
+		if (runStart == goal) runStart = sb->totalBlocks;
 	}
 
-	int idx;
-	for (idx = 0; idx < MAX_OPEN_FILES; idx++) {
-		if (!fdTable[idx].inUse) break;
+	if (runStart == sb->totalBlocks && freeExtents) {
+		// O indice de extents da' o extent livre mais proximo de cada lado;
+		// fica o de menor distancia em cilindros
+		unsigned int prevStart, prevLen, nextStart, nextLen;
+		unsigned long prevCyl = 0, nextCyl = 0;
+		extentTreeNearest(freeExtents, goal, &prevStart, &prevLen,
+		                  &nextStart, &nextLen);
+		if (prevLen > 0)
+			diskAddrToCylinder(d, blockToSector(prevStart + prevLen - 1, sb),
+			                   &prevCyl);
+		if (nextLen > 0)
+			diskAddrToCylinder(d, blockToSector(nextStart, sb), &nextCyl);
+		if (nextLen > 0 && (prevLen == 0 || nextCyl - goalCyl <= goalCyl - prevCyl))
+			runStart = nextStart;
+		else if (prevLen > 0)
+			// Fica com o fim do extent anterior, encostado no goal
+			runStart = (prevLen > n ? prevStart + prevLen - n : prevStart);
 	}
 
-	if (idx == MAX_OPEN_FILES) {
-		free(inode);
-		return -1;
+	// Sem indice, grupos vizinhos, alternando para fora do goal
+	for (unsigned long dist = 1; runStart == sb->totalBlocks && !freeExtents &&
+	     (dist <= goalCyl || goalCyl + dist < numCyl); dist++) {
+		for (int side = 0; side < 2; side++) {
+			if (side == 0) {
+				if (goalCyl + dist >= numCyl) continue;
+				cylGroupRange(sb, goalCyl + dist, &first, &end);
+			}
+			else {
+				if (dist > goalCyl) continue;
+				cylGroupRange(sb, goalCyl - dist, &first, &end);
+			}
+			runStart = bitmapFindFree(first, end);
+			if (runStart < end) break;
+			runStart = sb->totalBlocks;
+		}
 	}
+	if (runStart == sb->totalBlocks) return 0;
 
-	unsigned int refs = inodeGetRefCount(inode);
-	inodeSetRefCount(inode, refs + 1);
-	inodeSave(inode);
+	unsigned int limit = (sb->totalBlocks - runStart > n
+	                      ? runStart + n : sb->totalBlocks);
+	*count = bitmapFindUsed(runStart, limit) - runStart;
+	blocksSetUsed(sb, runStart, *count, 1);
+	return runStart + 1; // Blocos numerados a partir de 1
+}
 
-	fdTable[idx].inUse   = 1;
-	fdTable[idx].inumber = inodeGetNumber(inode);
-	fdTable[idx].cursor  = 0;
-	fdTable[idx].inode   = inode;
+// Retorna o maior tamanho de arquivo, em bytes: os indices dos blocos de um
+// arquivo precisam caber em unsigned int (abaixo de INODE_HOLE) e o tamanho,
+// no i-node
+static unsigned long long maxFileSize(void) {
+	unsigned long long max = (unsigned long long)(INODE_HOLE - 1)
+	                         * mountedSB->blockSize;
+	return (max < INODE_MAX_FILESIZE ? max : INODE_MAX_FILESIZE);
+}
 
-	return idx + 1;
+// Retorna 1 se a alocacao atrasada estiver ativa ou 0 caso contrario
+static int delayedAllocEnabled(void) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __atomic_load_n(&delayedAlloc, __ATOMIC_RELAXED);
+#else
+	pthread_mutex_lock(&allocLock);
+	int enabled = delayedAlloc;
+	pthread_mutex_unlock(&allocLock);
+	return enabled;
+#endif
 }
-	
-//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
-//existente. Os dados devem ser lidos a partir da posicao atual do cursor
-//e copiados para buf. Terao tamanho maximo de nbytes. Ao fim, o cursor
-//deve ter posicao atualizada para que a proxima operacao ocorra a partir
-//do próximo byte apos o ultimo lido. Retorna o numero de bytes
-//efetivamente lidos em caso de sucesso ou -1, caso contrario.
-int myFSRead (int fd, char *buf, unsigned int nbytes) {
-	int idx = fd - 1;
-	if (idx < 0 || idx >= MAX_OPEN_FILES) return -1;
-	if (!fdTable[idx].inUse) return -1;
-	if (!buf || nbytes == 0) return 0;
-
-	Inode *inode = fdTable[idx].inode;
-	unsigned int cursor = fdTable[idx].cursor;
-	unsigned int fileSize = inodeGetFileSize(inode);
-	unsigned int blockSize = mountedSB->blockSize;
-	Disk *d = mountedDisk;
-	unsigned int readBytes = 0;
 
-	// Não ler além do fim do arquivo
-	if (cursor >= fileSize) return 0;
-	if (nbytes > (fileSize - cursor)) {
-		nbytes = fileSize - cursor;
+// Retorna o endereco do bloco de indice blockNum de um arquivo ou 0 se o
+// bloco nao estiver alocado (alem do fim do mapa ou em um buraco)
+static unsigned int memInodeBlockAddr(MemInode *mi, unsigned int blockNum) {
+	if (blockNum >= mi->numBlocks || mi->blocks[blockNum] == INODE_HOLE)
+		return 0;
+	return mi->blocks[blockNum];
+}
+
+// Garante espaco no mapa de blocos de um arquivo para mais count enderecos.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int memInodeMapReserve(MemInode *mi, unsigned int count) {
+	while (mi->numBlocks + count > mi->blocksCap) {
+		unsigned int cap = (mi->blocksCap ? mi->blocksCap * 2 : 16);
+		unsigned int *blocks = realloc(mi->blocks, cap * sizeof(unsigned int));
+		if (!blocks) return -1;
+		mi->blocks = blocks;
+		mi->blocksCap = cap;
 	}
+	return 0;
+}
 
-	while (readBytes < nbytes) {
-		unsigned int blockNum = (cursor + readBytes) / blockSize;
-		unsigned int blockOffset = (cursor + readBytes) % blockSize;
-		unsigned int blockAddr = inodeGetBlockAddr(inode, blockNum);
-		if (blockAddr == 0) break; // bloco não alocado
+// Acrescenta ao i-node os count enderecos ja' montados no fim do mapa de
+// blocos em memoria, que so' passam a contar depois de aceitos pelo i-node.
+// Retorna o numero de enderecos acrescentados ou -1 em caso de falha
+static int memInodeMapCommit(MemInode *mi, unsigned int count) {
+	int added = inodeAddBlocks(mi->inode, mi->blocks + mi->numBlocks, count);
+	if (added < 0) return -1;
+	mi->dirty = 1;
+	// Blocos que inauguraram novas extensoes do i-node, que ocupam i-nodes
+	unsigned int direct = inodeNumBlockAddresses();
+	pthread_mutex_lock(&allocLock);
+	for (int i = 0; i < added; i++, mi->numBlocks++) {
+		if (mi->numBlocks >= direct &&
+		    (mi->numBlocks - direct) % inodeNumExtBlockAddresses() == 0 &&
+		    mountedSB->freeInodes > 0)
+			mountedSB->freeInodes--;
+	}
+	pthread_mutex_unlock(&allocLock);
+	return added;
+}
 
-		unsigned char sector[DISK_SECTORDATASIZE];
-		unsigned int sectorNum = blockToSector(blockAddr - 1, mountedSB);
-		if (diskReadSector(d, sectorNum, sector) < 0) break;
+// Acrescenta os count blocos contiguos a partir de blockAddr ao fim do
+// arquivo, no i-node em disco e no mapa de blocos em memoria. Com blockAddr
+// igual a INODE_HOLE, acrescenta count buracos. Retorna o numero de blocos
+// acrescentados ou -1 em caso de falha
+static int memInodeAddBlocks(MemInode *mi, unsigned int blockAddr,
+                             unsigned int count) {
+	if (memInodeMapReserve(mi, count) < 0) return -1;
+	unsigned int *addrs = mi->blocks + mi->numBlocks;
+	for (unsigned int i = 0; i < count; i++)
+		addrs[i] = (blockAddr == INODE_HOLE ? INODE_HOLE : blockAddr + i);
+	return memInodeMapCommit(mi, count);
+}
 
-		unsigned int toRead = blockSize - blockOffset;
-		if (toRead > (nbytes - readBytes)) {
-			toRead = nbytes - readBytes;
+// Preenche com blocos novos os buracos entre os blocos de indices firstBlock
+// e lastBlock de um arquivo, todos dentro do mapa de blocos. Cada sequencia
+// de buracos e' alocada perto do bloco alocado anterior. Retorna 0 em caso
+// de sucesso ou -1 caso contrario
+static int allocFileHoles(MemInode *mi, unsigned int firstBlock,
+                          unsigned int lastBlock) {
+	unsigned int blockNum = firstBlock;
+	while (blockNum <= lastBlock) {
+		if (mi->blocks[blockNum] != INODE_HOLE) {
+			blockNum++;
+			continue;
 		}
+		unsigned int holes = 1, count, blockAddr, prevAddr = 0;
+		while (blockNum + holes <= lastBlock &&
+		       mi->blocks[blockNum + holes] == INODE_HOLE)
+			holes++;
+		for (unsigned int b = blockNum; b > 0 && prevAddr == 0; b--)
+			prevAddr = memInodeBlockAddr(mi, b - 1);
+		pthread_mutex_lock(&allocLock);
+		if (prevAddr != 0)
+			blockAddr = allocBlocksNear(mountedDisk, mountedSB, prevAddr,
+			                            holes, &count);
+		else
+			blockAddr = allocContiguousBlocks(mountedDisk, mountedSB, holes,
+			                                  &count);
+		pthread_mutex_unlock(&allocLock);
+		if (blockAddr == 0) return -1;
+		for (unsigned int i = 0; i < count; i++)
+			mi->blocks[blockNum + i] = blockAddr + i;
+		if (inodeSetBlockAddrs(mi->inode, blockNum, mi->blocks + blockNum,
+		                       count) < 0) {
+			for (unsigned int i = 0; i < count; i++)
+				mi->blocks[blockNum + i] = INODE_HOLE;
+			pthread_mutex_lock(&allocLock);
+			blocksSetUsed(mountedSB, blockAddr - 1, count, 0);
+			pthread_mutex_unlock(&allocLock);
+			return -1;
+		}
+		mi->dirty = 1;
+		blockNum += count;
+	}
+	return 0;
+}
 
-		memcpy(buf + readBytes, sector + blockOffset, toRead);
-		readBytes += toRead;
+// Garante que os blocos de indices firstBlock a lastBlock de um arquivo
+// estejam alocados. Os buracos do intervalo sao preenchidos e os blocos que
+// faltam no fim sao alocados de uma so' vez, em sequencias contiguas, e
+// acrescentados ao i-node; entre o fim do mapa e firstBlock ficam buracos.
+// Cada sequencia e' procurada o mais perto possivel do ultimo bloco do
+// arquivo; o primeiro bloco de um arquivo vazio segue a dica de alocacao.
+// Retorna 0 em caso de sucesso ou -1 se nem todos os blocos puderam ser
+// alocados
+static int allocFileBlocks(MemInode *mi, unsigned int firstBlock,
+                           unsigned int lastBlock) {
+	if (firstBlock < mi->numBlocks) {
+		unsigned int last = (lastBlock < mi->numBlocks ? lastBlock
+		                                                : mi->numBlocks - 1);
+		if (allocFileHoles(mi, firstBlock, last) < 0) return -1;
+	}
+	// Os blocos entre o fim do mapa e o intervalo viram buracos
+	if (firstBlock > mi->numBlocks && firstBlock <= lastBlock) {
+		unsigned int holes = firstBlock - mi->numBlocks;
+		int added = memInodeAddBlocks(mi, INODE_HOLE, holes);
+		if (added < 0 || (unsigned int)added < holes) return -1;
 	}
+	unsigned int blockNum = (firstBlock > mi->numBlocks ? firstBlock
+	                                                     : mi->numBlocks);
+	if (blockNum > lastBlock) return 0;
+	unsigned int prevAddr = 0;
+	for (unsigned int b = blockNum; b > 0 && prevAddr == 0; b--)
+		prevAddr = memInodeBlockAddr(mi, b - 1);
 
-	fdTable[idx].cursor += readBytes;
-	return readBytes;
+	while (blockNum <= lastBlock) {
+		unsigned int count, blockAddr;
+		pthread_mutex_lock(&allocLock);
+		if (prevAddr != 0)
+			// prevAddr - 1 e' o indice do ultimo bloco; o alvo e' o seguinte
+			blockAddr = allocBlocksNear(mountedDisk, mountedSB, prevAddr,
+			                            lastBlock - blockNum + 1, &count);
+		else
+			blockAddr = allocContiguousBlocks(mountedDisk, mountedSB,
+			                                  lastBlock - blockNum + 1, &count);
+		pthread_mutex_unlock(&allocLock);
+		if (blockAddr == 0) return -1;
+		prevAddr = blockAddr + count - 1;
+		int added = memInodeAddBlocks(mi, blockAddr, count);
+		if (added < 0) added = 0;
+		blockNum += added;
+		if ((unsigned int)added < count) {
+			// Devolve os blocos que nao entraram no i-node
+			pthread_mutex_lock(&allocLock);
+			blocksSetUsed(mountedSB, blockAddr + added - 1, count - added, 0);
+			pthread_mutex_unlock(&allocLock);
+			return -1;
+		}
+	}
+	return 0;
 }
 
-//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
-//existente. Os dados de buf sao copiados para o disco a partir da posição
-//atual do cursor e terao tamanho maximo de nbytes. Ao fim, o cursor deve
-//ter posicao atualizada para que a proxima operacao ocorra a partir do
-//proximo byte apos o ultimo escrito. Retorna o numero de bytes
-//efetivamente escritos em caso de sucesso ou -1, caso contrario
-int myFSWrite (int fd, const char *buf, unsigned int nbytes) {
-    int idx = fd - 1;
+// Devolve n blocos reservados pela alocacao atrasada
+static void blocksUnreserve(unsigned int n) {
+	pthread_mutex_lock(&allocLock);
+	reservedBlocks -= n;
+	pthread_mutex_unlock(&allocLock);
+}
 
-    if (idx < 0 || idx >= MAX_OPEN_FILES) return -1;
-    if (!fdTable[idx].inUse) return -1;
-    if (!buf || nbytes == 0) return 0;
+// Grava no disco os dados pendentes de alocacao atrasada de um arquivo. Os
+// blocos sao alocados de uma vez, contiguos sempre que possivel, no fim do
+// mapa de blocos em memoria, e os dados gravados neles em uma unica
+// varredura sequencial; so' entao os blocos sao acrescentados ao i-node e a
+// reserva e o buffer descartados. Em caso de falha, os blocos alocados sao
+// devolvidos e a reserva e o buffer ficam como estavam, para nova tentativa.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int memInodeFlushDelayed(MemInode *mi) {
+	if (mi->delayLen == 0) return 0;
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned int sectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
+	unsigned int firstBlock = mi->numBlocks;
+	unsigned int numBlocks = (unsigned int)((mi->delayLen + blockSize - 1)
+	                                        / blockSize);
+	unsigned int allocated = 0, prevAddr = 0;
+	int added = 0;
+
+	if (memInodeMapReserve(mi, numBlocks) < 0) return -1;
+	unsigned int *addrs = mi->blocks + firstBlock;
+	for (unsigned int b = firstBlock; b > 0 && prevAddr == 0; b--)
+		prevAddr = memInodeBlockAddr(mi, b - 1);
+
+	// A reserva vira alocacao efetiva, perto do ultimo bloco do arquivo. Ela
+	// so' e' desfeita com a trava do alocador mantida ate' o fim da alocacao,
+	// para que outra alocacao nao tome os blocos reservados nesse intervalo
+	pthread_mutex_lock(&allocLock);
+	reservedBlocks -= mi->reserved;
+	while (allocated < numBlocks) {
+		unsigned int count, blockAddr;
+		if (prevAddr != 0)
+			blockAddr = allocBlocksNear(mountedDisk, mountedSB, prevAddr,
+			                            numBlocks - allocated, &count);
+		else
+			blockAddr = allocContiguousBlocks(mountedDisk, mountedSB,
+			                                  numBlocks - allocated, &count);
+		if (blockAddr == 0) break;
+		for (unsigned int i = 0; i < count; i++)
+			addrs[allocated + i] = blockAddr + i;
+		allocated += count;
+		prevAddr = blockAddr + count - 1;
+	}
+	if (allocated < numBlocks) {
+		blocksRelease(mountedSB, addrs, allocated);
+		reservedBlocks += mi->reserved;
+		pthread_mutex_unlock(&allocLock);
+		return -1;
+	}
+	pthread_mutex_unlock(&allocLock);
+
+	// O fim do ultimo bloco e' completado com zeros
+	memset(mi->delayBuf + mi->delayLen, 0,
+	       (unsigned long long)numBlocks * blockSize - mi->delayLen);
+	for (unsigned int b = 0; b < numBlocks; ) {
+		// Blocos contiguos no disco sao gravados em uma unica escrita
+		unsigned int run = 1;
+		while (b + run < numBlocks && addrs[b + run] == addrs[b] + run)
+			run++;
+		unsigned int sectorNum = blockToSector(addrs[b] - 1, mountedSB);
+		if (diskWriteSectors(mountedDisk, sectorNum, run * sectorsPerBlock,
+		                     mi->delayBuf + (unsigned long long)b * blockSize) < 0)
+			goto fail;
+		b += run;
+	}
+
+	added = memInodeMapCommit(mi, numBlocks);
+	if (added < 0) added = 0;
+	if ((unsigned int)added < numBlocks) {
+		// O i-node nao aceitou todos os blocos (sem i-nodes para extensoes):
+		// os que entraram saem dele de novo
+		int released = (added > 0 ? inodeTruncateBlocks(mi->inode, firstBlock)
+		                          : 0);
+		if (released < 0) {
+			// Os blocos que ficaram no i-node ja' tem os seus dados: deixam o
+			// buffer e a reserva, e so' os demais sao devolvidos
+			unsigned long long done = (unsigned long long)added * blockSize;
+			memmove(mi->delayBuf, mi->delayBuf + done, mi->delayLen - done);
+			mi->delayLen -= done;
+			mi->reserved -= (unsigned int)added;
+			addrs += added;
+			allocated -= (unsigned int)added;
+		}
+		else {
+			pthread_mutex_lock(&allocLock);
+			mountedSB->freeInodes += released;
+			pthread_mutex_unlock(&allocLock);
+			mi->numBlocks = firstBlock;
+		}
+		goto fail;
+	}
+
+	mi->reserved = 0;
+	free(mi->delayBuf);
+	mi->delayBuf = NULL;
+	mi->delayLen = 0;
+	mi->delayCap = 0;
+	mi->dirty = 1;
+	return 0;
+
+fail:
+	pthread_mutex_lock(&allocLock);
+	blocksRelease(mountedSB, addrs, allocated);
+	reservedBlocks += mi->reserved;
+	pthread_mutex_unlock(&allocLock);
+	return -1;
+}
+
+// Reduz um arquivo aberto para length bytes: descarta os dados com alocacao
+// atrasada alem de length e libera os blocos e extensoes do i-node que
+// deixam de ser necessarios. O tamanho do arquivo no i-node nao e' alterado.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int memInodeTruncate(MemInode *mi, unsigned long long length) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned long long delayStart = (unsigned long long)mi->numBlocks * blockSize;
+	unsigned int keep = (unsigned int)((length + blockSize - 1) / blockSize);
+
+	if (length >= delayStart) {
+		if (mi->delayLen > length - delayStart) {
+			unsigned int needed;
+			mi->delayLen = length - delayStart;
+			needed = (unsigned int)((mi->delayLen + blockSize - 1) / blockSize);
+			blocksUnreserve(mi->reserved - needed);
+			mi->reserved = needed;
+		}
+		return 0;
+	}
+	blocksUnreserve(mi->reserved);
+	mi->reserved = 0;
+	mi->delayLen = 0;
+
+	int released = inodeTruncateBlocks(mi->inode, keep);
+	if (released < 0) return -1;
+	pthread_mutex_lock(&allocLock);
+	mountedSB->freeInodes += released;
+	blocksRelease(mountedSB, mi->blocks + keep, mi->numBlocks - keep);
+	pthread_mutex_unlock(&allocLock);
+	mi->numBlocks = keep;
+	return 0;
+}
+
+// Apaga do disco um arquivo sem mais nenhum link: seus dados pendentes sao
+// descartados e seus blocos e i-nodes liberados. Retorna 0 em caso de
+// sucesso ou -1 caso contrario
+static int memInodeRelease(MemInode *mi) {
+	blocksUnreserve(mi->reserved);
+	mi->reserved = 0;
+	mi->delayLen = 0;
+	mi->dirty = 0;
+
+	int released = inodeFree(mi->inode);
+	if (released < 0) return -1;
+	pthread_mutex_lock(&allocLock);
+	mountedSB->freeInodes += released;
+	blocksRelease(mountedSB, mi->blocks, mi->numBlocks);
+	if (mountedSB->numFiles > 0) mountedSB->numFiles--;
+	pthread_mutex_unlock(&allocLock);
+	mi->numBlocks = 0;
+	return 0;
+}
+
+// Persiste as pendencias de um i-node em memoria: dados com alocacao
+// atrasada e o proprio i-node. Retorna 0 em caso de sucesso ou -1 caso
+// contrario
+static int memInodeSync(MemInode *mi) {
+	if (memInodeFlushDelayed(mi) < 0) return -1;
+	if (mi->dirty) {
+		if (inodeSave(mi->inode) < 0) return -1;
+		mi->dirty = 0;
+	}
+	return 0;
+}
+
+// Procura o arquivo inumber entre os i-nodes em memoria, com memInodesLock
+// obtida. Um i-node ocupado e' esperado, pois so' depois de lido, ou de
+// gravado no ultimo fechamento, ele esta' de acordo com o disco. Retorna o
+// i-node em memoria, com uma abertura a mais, ou NULL se o arquivo nao
+// estiver aberto
+static MemInode* memInodeFind(unsigned int inumber) {
+	MemInode *mi = memInodes;
+	while (mi) {
+		if (mi->inumber != inumber) mi = mi->next;
+		else if (mi->busy) {
+			pthread_cond_wait(&memInodesCond, &memInodesLock);
+			mi = memInodes;
+		}
+		else {
+			mi->openCount++;
+			return mi;
+		}
+	}
+	return NULL;
+}
+
+// Le do disco o i-node de um i-node em memoria e o seu mapa de blocos,
+// percorrendo a cadeia de extensoes uma vez. Retorna 0 em caso de sucesso
+// ou -1 se o i-node nao estiver em uso ou nao houver memoria
+static int memInodeLoad(MemInode *mi) {
+	Inode *inode = inodeLoad(mi->inumber, mountedDisk);
+	if (!inode || inodeGetNumber(inode) != mi->inumber) {
+		free(inode);
+		return -1;
+	}
+	mi->inode = inode;
+	mi->type = inodeGetFileType(inode);
+	for (;;) {
+		unsigned int cap = (mi->blocksCap ? mi->blocksCap * 2 : 16);
+		unsigned int *blocks = realloc(mi->blocks, cap * sizeof(unsigned int));
+		if (!blocks) return -1;
+		mi->blocks = blocks;
+		mi->blocksCap = cap;
+		mi->numBlocks = inodeGetBlockAddrs(inode, blocks, cap);
+		if (mi->numBlocks < cap) break;
+	}
+	return 0;
+}
+
+// Descarta um i-node em memoria que ja' saiu da lista
+static void memInodeFree(MemInode *mi) {
+	pthread_rwlock_destroy(&mi->lock);
+	free(mi->delayBuf);
+	free(mi->dirIndex);
+	free(mi->blocks);
+	free(mi->inode);
+	free(mi);
+}
+
+// Retira um i-node em memoria da lista, com memInodesLock obtida
+static void memInodeUnlink(MemInode *mi) {
+	MemInode **prev = &memInodes;
+	while (*prev != mi) prev = &(*prev)->next;
+	*prev = mi->next;
+}
+
+// Obtem o i-node em memoria do arquivo inumber, lido do disco se o arquivo
+// nao estiver aberto, e incrementa o seu numero de aberturas. O i-node entra
+// na lista ocupado antes da leitura, que e' feita sem trava, de modo que
+// outra thread que abra o mesmo arquivo espera por ele. Retorna NULL se
+// inumber nao for um i-node em uso ou em caso de falha
+static MemInode* memInodeGet(unsigned int inumber) {
+	MemInode *mi;
+	int ret;
+
+	if (inumber == 0 || inumber > mountedSB->inodeCount) return NULL;
+	pthread_mutex_lock(&memInodesLock);
+	mi = memInodeFind(inumber);
+	if (!mi && (mi = calloc(1, sizeof(MemInode))) != NULL) {
+		mi->inumber = inumber;
+		mi->openCount = 1;
+		mi->busy = 1;
+		pthread_rwlock_init(&mi->lock, NULL);
+		mi->next = memInodes;
+		memInodes = mi;
+		pthread_mutex_unlock(&memInodesLock);
+
+		ret = memInodeLoad(mi);
+		pthread_mutex_lock(&memInodesLock);
+		mi->busy = 0;
+		if (ret < 0) memInodeUnlink(mi);
+		pthread_cond_broadcast(&memInodesCond);
+		if (ret < 0) {
+			pthread_mutex_unlock(&memInodesLock);
+			memInodeFree(mi);
+			return NULL;
+		}
+	}
+	pthread_mutex_unlock(&memInodesLock);
+	return mi;
+}
+
+// Acrescenta uma abertura a um i-node em memoria ja' aberto
+static void memInodeRef(MemInode *mi) {
+	pthread_mutex_lock(&memInodesLock);
+	mi->openCount++;
+	pthread_mutex_unlock(&memInodesLock);
+}
+
+// Libera uma abertura de um i-node em memoria. Na ultima, as pendencias do
+// arquivo sao persistidas, ou o arquivo e' apagado se nao tiver mais links,
+// e o i-node em memoria e' descartado. Enquanto isso, o i-node fica ocupado:
+// so' esta thread o usa, sem trava, e quem o procura espera. Se a gravacao
+// das pendencias falhar, o i-node continua na lista, sem aberturas e com os
+// seus dados: a proxima abertura o reaproveita e myFSSync tenta de novo.
+// Nao pode ser chamada com a trava de um i-node, de nomes ou do alocador
+// obtida. Retorna 0 em caso de sucesso ou -1 caso contrario
+static int memInodePut(MemInode *mi) {
+	pthread_mutex_lock(&memInodesLock);
+	if (--mi->openCount > 0) {
+		pthread_mutex_unlock(&memInodesLock);
+		return 0;
+	}
+	mi->busy = 1;
+	pthread_mutex_unlock(&memInodesLock);
+
+	int linked = (inodeGetRefCount(mi->inode) != 0);
+	int ret = (linked ? memInodeSync(mi) : memInodeRelease(mi));
+
+	pthread_mutex_lock(&memInodesLock);
+	if (linked && ret < 0) {
+		mi->busy = 0;
+		pthread_cond_broadcast(&memInodesCond);
+		pthread_mutex_unlock(&memInodesLock);
+		return -1;
+	}
+	memInodeUnlink(mi);
+	pthread_cond_broadcast(&memInodesCond);
+	pthread_mutex_unlock(&memInodesLock);
+	blocksUnreserve(mi->reserved);
+	memInodeFree(mi);
+	return ret;
+}
+
+// Escrita com alocacao atrasada dos bytes de buf a partir de offset, que
+// deve estar na area ainda sem blocos do arquivo. Os dados sao copiados
+// para o buffer do i-node em memoria e apenas os blocos necessarios sao
+// reservados. Retorna o numero de bytes aceitos, que e' menor que nbytes se
+// nao houver espaco livre para reservar
+static unsigned long long memInodeDelayedWrite(MemInode *mi,
+                                               unsigned long long offset,
+                                               const char *buf,
+                                               unsigned long long nbytes) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned long long delayStart = (unsigned long long)mi->numBlocks * blockSize;
+	unsigned long long end = offset + nbytes - delayStart;
+
+	if (end > mi->delayLen) {
+		// Reserva os blocos que faltam para cobrir o novo fim
+		unsigned long long needed = (end + blockSize - 1) / blockSize
+		                            - mi->reserved;
+		pthread_mutex_lock(&allocLock);
+		unsigned int available = mountedSB->freeBlocks - reservedBlocks;
+		if (needed > available) needed = available;
+		reservedBlocks += (unsigned int)needed;
+		pthread_mutex_unlock(&allocLock);
+		if ((mi->reserved + needed) * blockSize < end) {
+			end = (mi->reserved + needed) * blockSize;
+			if (end <= offset - delayStart) {
+				blocksUnreserve((unsigned int)needed);
+				return 0;
+			}
+			nbytes = end - (offset - delayStart);
+		}
+		// O buffer cresce em blocos inteiros, para a gravacao no flush
+		if ((mi->reserved + needed) * blockSize > mi->delayCap) {
+			unsigned long long cap = (mi->delayCap ? mi->delayCap : blockSize);
+			while (cap < (mi->reserved + needed) * blockSize) cap *= 2;
+			unsigned char *delayBuf = realloc(mi->delayBuf, cap);
+			if (!delayBuf) {
+				blocksUnreserve((unsigned int)needed);
+				return 0;
+			}
+			mi->delayBuf = delayBuf;
+			mi->delayCap = cap;
+		}
+		mi->reserved += (unsigned int)needed;
+		// Entre os dados anteriores e os novos, o arquivo tem zeros
+		if (offset - delayStart > mi->delayLen)
+			memset(mi->delayBuf + mi->delayLen, 0,
+			       offset - delayStart - mi->delayLen);
+		mi->delayLen = end;
+	}
+	memcpy(mi->delayBuf + (offset - delayStart), buf, nbytes);
+	return nbytes;
+}
+
+// Le len bytes do disco para buf, a partir do byte skip do setor sectorNum.
+// Os setores inteiros vao direto para buf, em uma unica leitura; apenas o
+// primeiro e o ultimo setor, se lidos em parte, passam por um buffer
+// auxiliar. Retorna 0 em caso de sucesso ou -1 caso contrario
+static int memInodeReadSectors(Disk *d, unsigned int sectorNum,
+                               unsigned int skip, unsigned char *buf,
+                               unsigned long long len) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+
+	if (skip > 0) {
+		unsigned int part = DISK_SECTORDATASIZE - skip;
+		if (part > len) part = (unsigned int)len;
+		if (diskReadSector(d, sectorNum, sector) < 0) return -1;
+		memcpy(buf, sector + skip, part);
+		buf += part;
+		len -= part;
+		sectorNum++;
+	}
+	if (len >= DISK_SECTORDATASIZE) {
+		unsigned long long count = len / DISK_SECTORDATASIZE;
+		if (diskReadSectors(d, sectorNum, count, buf) < 0) return -1;
+		buf += count * DISK_SECTORDATASIZE;
+		len -= count * DISK_SECTORDATASIZE;
+		sectorNum += count;
+	}
+	if (len > 0) {
+		if (diskReadSector(d, sectorNum, sector) < 0) return -1;
+		memcpy(buf, sector, len);
+	}
+	return 0;
+}
+
+// Posicao na memoria de uma leitura ou escrita de arquivo: um unico buffer
+// ou, na leitura e escrita vetorizadas, os trechos de um vetor FSIovec,
+// percorridos em sequencia
+typedef struct ioCursor {
+	const FSIovec *iov;		// NULL com um unico buffer
+	unsigned int iovcnt;
+	unsigned int next;		// Proximo trecho de iov
+	char *buf;			// Posicao atual no trecho atual
+	unsigned long long avail;	// Bytes restantes no trecho atual
+} IoCursor;
+
+// Inicia um cursor sobre os nbytes de buf
+static void ioCursorInit(IoCursor *c, char *buf, unsigned long long nbytes) {
+	c->iov = NULL;
+	c->iovcnt = c->next = 0;
+	c->buf = buf;
+	c->avail = nbytes;
+}
+
+// Inicia um cursor sobre os iovcnt trechos de iov
+static void ioCursorInitv(IoCursor *c, const FSIovec *iov,
+                          unsigned int iovcnt) {
+	c->iov = iov;
+	c->iovcnt = iovcnt;
+	c->next = 0;
+	c->buf = NULL;
+	c->avail = 0;
+}
+
+// Retorna a posicao atual de um cursor, com o numero de bytes contiguos a
+// partir dela em *len, limitado a max. Trechos vazios sao pulados
+static char* ioCursorPeek(IoCursor *c, unsigned long long max,
+                          unsigned long long *len) {
+	while (c->avail == 0 && c->iov && c->next < c->iovcnt) {
+		c->buf = c->iov[c->next].base;
+		c->avail = c->iov[c->next].len;
+		c->next++;
+	}
+	*len = (c->avail < max ? c->avail : max);
+	return c->buf;
+}
+
+// Avanca n bytes um cursor, dentro do trecho atual
+static void ioCursorAdvance(IoCursor *c, unsigned long long n) {
+	c->buf += n;
+	c->avail -= n;
+}
+
+// Copia n bytes entre buf e a memoria do cursor, atravessando os seus
+// trechos: para o cursor se toCursor, ou dele para buf, e o avanca
+static void ioCursorCopy(IoCursor *c, char *buf, unsigned long long n,
+                         int toCursor) {
+	unsigned long long len;
+	while (n > 0) {
+		char *p = ioCursorPeek(c, n, &len);
+		if (len == 0) break;
+		if (toCursor) memcpy(p, buf, len);
+		else memcpy(buf, p, len);
+		ioCursorAdvance(c, len);
+		buf += len;
+		n -= len;
+	}
+}
+
+// Le ate' nbytes do arquivo de um i-node em memoria, a partir de offset,
+// para a memoria indicada pelo cursor c, sem ultrapassar o fim do arquivo.
+// Os setores inteiros de cada trecho do cursor sao lidos diretamente para
+// ele; um setor dividido entre trechos e' lido uma vez e espalhado. Os dados com
+// alocacao atrasada sao lidos do buffer em memoria e os buracos (blocos sem
+// endereco) sao lidos como zeros, sem acesso ao disco. Retorna o numero de
+// bytes lidos
+static unsigned long long memInodeReadIo(MemInode *mi, unsigned long long offset,
+                                         IoCursor *c, unsigned long long nbytes) {
+	unsigned long long fileSize = inodeGetFileSize(mi->inode);
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned long long delayStart = (unsigned long long)mi->numBlocks * blockSize;
+	Disk *d = mountedDisk;
+	unsigned long long readBytes = 0;
+	unsigned long long avail;
+
+	// Não ler além do fim do arquivo
+	if (offset >= fileSize) return 0;
+	if (nbytes > (fileSize - offset)) {
+		nbytes = fileSize - offset;
+	}
+
+	while (readBytes < nbytes) {
+		char *buf = ioCursorPeek(c, nbytes - readBytes, &avail);
+		if (avail == 0) break;
+
+		// Dados com alocacao atrasada estao apenas em memoria
+		if (mi->delayLen > 0 && offset + readBytes >= delayStart) {
+			unsigned long long pos = offset + readBytes - delayStart;
+			unsigned long long toCopy = avail;
+			if (pos >= mi->delayLen) {
+				// Buraco depois dos dados em memoria, ate' o fim do arquivo
+				memset(buf, 0, toCopy);
+			}
+			else {
+				if (toCopy > mi->delayLen - pos) toCopy = mi->delayLen - pos;
+				memcpy(buf, mi->delayBuf + pos, toCopy);
+			}
+			ioCursorAdvance(c, toCopy);
+			readBytes += toCopy;
+			continue;
+		}
+
+		unsigned int blockNum = (unsigned int)((offset + readBytes) / blockSize);
+		unsigned int blockOffset = (offset + readBytes) % blockSize;
+		unsigned int blockAddr = memInodeBlockAddr(mi, blockNum);
+		unsigned int lastBlock = (unsigned int)((offset + nbytes - 1) / blockSize);
+		if (blockAddr == 0) {
+			// Buraco: zeros ate' o proximo bloco alocado ou o fim da leitura
+			unsigned int holeEnd = blockNum + 1;
+			while (holeEnd <= lastBlock && holeEnd < mi->numBlocks &&
+			       memInodeBlockAddr(mi, holeEnd) == 0)
+				holeEnd++;
+			unsigned long long toZero = (blockNum >= mi->numBlocks ||
+			                             holeEnd > lastBlock
+			                             ? nbytes - readBytes
+			                             : (unsigned long long)holeEnd * blockSize
+			                               - (offset + readBytes));
+			if (toZero > avail) toZero = avail;
+			memset(buf, 0, toZero);
+			ioCursorAdvance(c, toZero);
+			readBytes += toZero;
+			continue;
+		}
+
+		// Blocos seguintes contiguos no disco entram na mesma transferencia
+		unsigned int runBlocks = 1;
+		while (blockNum + runBlocks <= lastBlock &&
+		       memInodeBlockAddr(mi, blockNum + runBlocks) == blockAddr + runBlocks)
+			runBlocks++;
+
+		unsigned long long toRead = (unsigned long long)runBlocks * blockSize
+		                            - blockOffset;
+		if (toRead > (nbytes - readBytes)) {
+			toRead = nbytes - readBytes;
+		}
+		unsigned int skip = blockOffset % DISK_SECTORDATASIZE;
+		unsigned int sectorNum = blockToSector(blockAddr - 1, mountedSB)
+		                         + blockOffset / DISK_SECTORDATASIZE;
+		if (toRead > avail && skip + avail < DISK_SECTORDATASIZE) {
+			// O trecho atual do cursor termina dentro deste setor
+			unsigned char sector[DISK_SECTORDATASIZE];
+			if (toRead > DISK_SECTORDATASIZE - skip)
+				toRead = DISK_SECTORDATASIZE - skip;
+			if (diskReadSector(d, sectorNum, sector) < 0) break;
+			ioCursorCopy(c, (char *)sector + skip, toRead, 1);
+		}
+		else {
+			// Ate' o ultimo setor que termina dentro do trecho atual
+			if (toRead > avail)
+				toRead = avail - (skip + avail) % DISK_SECTORDATASIZE;
+			if (memInodeReadSectors(d, sectorNum, skip, (unsigned char *)buf,
+			                        toRead) < 0)
+				break;
+			ioCursorAdvance(c, toRead);
+		}
+		readBytes += toRead;
+	}
+	return readBytes;
+}
+
+// Le ate' nbytes do arquivo de um i-node em memoria, a partir de offset,
+// para buf, como memInodeReadIo. Retorna o numero de bytes lidos
+static unsigned long long memInodeRead(MemInode *mi, unsigned long long offset,
+                                       char *buf, unsigned long long nbytes) {
+	IoCursor c;
+	ioCursorInit(&c, buf, nbytes);
+	return memInodeReadIo(mi, offset, &c, nbytes);
+}
+
+// Procura, a partir de offset (dentro do arquivo), o primeiro byte com
+// dados (data = 1) ou de buraco (data = 0) do arquivo de um i-node em
+// memoria. Dados sao os blocos alocados e os mantidos em memoria pela
+// alocacao atrasada; o fim do arquivo conta como buraco. Retorna a posicao
+// encontrada ou -1 se nao houver dados a partir de offset
+static long long memInodeSeekData(MemInode *mi, unsigned long long offset,
+                                  int data) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned long long fileSize = inodeGetFileSize(mi->inode);
+	// Blocos com dados: os do mapa que nao sao buracos e os em memoria
+	unsigned int dataEnd = mi->numBlocks
+	                       + (unsigned int)((mi->delayLen + blockSize - 1)
+	                                        / blockSize);
+	unsigned int b = (unsigned int)(offset / blockSize);
+
+	while (b < dataEnd &&
+	       (b < mi->numBlocks && mi->blocks[b] == INODE_HOLE) == data)
+		b++;
+	if (data && b >= dataEnd) return -1;
+	unsigned long long pos = (unsigned long long)b * blockSize;
+	if (pos < offset) pos = offset;
+	if (pos >= fileSize) return (data ? -1 : (long long)fileSize);
+	return (long long)pos;
+}
+
+// Grava os len bytes de buf no disco, a partir do byte skip do setor
+// sectorNum. Os setores inteiros sao gravados direto de buf, em uma unica
+// escrita. Um primeiro ou ultimo setor gravado em parte so' e' lido antes
+// (leitura-modificacao-escrita) se tiver dados do arquivo: existing e' o
+// numero de bytes validos a partir do inicio de sectorNum; o restante de
+// um setor novo e' completado com zeros. Retorna 0 em caso de sucesso ou
+// -1 caso contrario
+static int memInodeWriteSectors(Disk *d, unsigned int sectorNum,
+                                unsigned int skip, const unsigned char *buf,
+                                unsigned long long len,
+                                unsigned long long existing) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+
+	if (skip > 0 || len < DISK_SECTORDATASIZE) {
+		unsigned int part = DISK_SECTORDATASIZE - skip;
+		if (part > len) part = (unsigned int)len;
+		if ((skip > 0 && existing > 0) || existing > skip + part) {
+			if (diskReadSector(d, sectorNum, sector) < 0) return -1;
+		}
+		else memset(sector, 0, DISK_SECTORDATASIZE);
+		memcpy(sector + skip, buf, part);
+		if (diskWriteSector(d, sectorNum, sector) < 0) return -1;
+		buf += part;
+		len -= part;
+		sectorNum++;
+		existing = (existing > DISK_SECTORDATASIZE ?
+		            existing - DISK_SECTORDATASIZE : 0);
+	}
+	if (len >= DISK_SECTORDATASIZE) {
+		unsigned long long count = len / DISK_SECTORDATASIZE;
+		if (diskWriteSectors(d, sectorNum, count, (unsigned char *)buf) < 0)
+			return -1;
+		buf += count * DISK_SECTORDATASIZE;
+		len -= count * DISK_SECTORDATASIZE;
+		sectorNum += count;
+		existing = (existing > count * DISK_SECTORDATASIZE ?
+		            existing - count * DISK_SECTORDATASIZE : 0);
+	}
+	if (len > 0) {
+		if (existing > len) {
+			if (diskReadSector(d, sectorNum, sector) < 0) return -1;
+		}
+		else memset(sector, 0, DISK_SECTORDATASIZE);
+		memcpy(sector, buf, len);
+		if (diskWriteSector(d, sectorNum, sector) < 0) return -1;
+	}
+	return 0;
+}
+
+// Troca por blocos novos, antes da gravacao dos bytes [from, to) de um
+// arquivo, os blocos do trecho compartilhados com clones (copy-on-write).
+// Cada sequencia e' alocada perto do bloco original; apenas os blocos
+// gravados em parte tem o conteudo copiado. A copia e' feita fora da trava
+// do alocador; se, nesse meio tempo, o clone tambem trocou o bloco, a
+// referencia devolvida e' a ultima e o bloco original e' liberado. Retorna
+// 0 em caso de sucesso ou -1 caso contrario
+static int memInodeUnshare(MemInode *mi, unsigned long long from,
+                           unsigned long long to) {
+	pthread_mutex_lock(&allocLock);
+	int shared = (refTableCount > 0);
+	pthread_mutex_unlock(&allocLock);
+	if (!shared || from >= to || mi->numBlocks == 0) return 0;
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned int sectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
+	unsigned long long last = (to - 1) / blockSize;
+	unsigned char *copy = NULL;
+	int ret = 0;
+
+	if (last >= mi->numBlocks) last = mi->numBlocks - 1;
+	for (unsigned int b = (unsigned int)(from / blockSize);
+	     b <= last && ret == 0; ) {
+		unsigned int addr = memInodeBlockAddr(mi, b), next, count;
+		pthread_mutex_lock(&allocLock);
+		if (addr == 0 || blockRefs(addr) <= 1) {
+			pthread_mutex_unlock(&allocLock);
+			b++;
+			continue;
+		}
+		unsigned int run = 1;
+		while (b + run <= last && (next = memInodeBlockAddr(mi, b + run)) != 0
+		       && blockRefs(next) > 1)
+			run++;
+		unsigned int newAddr = allocBlocksNear(mountedDisk, mountedSB, addr,
+		                                       run, &count);
+		pthread_mutex_unlock(&allocLock);
+		if (newAddr == 0) {
+			ret = -1;
+			break;
+		}
+
+		for (unsigned int i = 0; i < count && ret == 0; i++) {
+			unsigned int old = mi->blocks[b + i];
+			unsigned long long start = (unsigned long long)(b + i) * blockSize;
+			if (start < from || start + blockSize > to) {
+				if (!copy && !(copy = malloc(blockSize))) ret = -1;
+				else if (diskReadSectors(mountedDisk,
+				                         blockToSector(old - 1, mountedSB),
+				                         sectorsPerBlock, copy) < 0 ||
+				         diskWriteSectors(mountedDisk,
+				                          blockToSector(newAddr + i - 1,
+				                                        mountedSB),
+				                          sectorsPerBlock, copy) < 0)
+					ret = -1;
+			}
+			pthread_mutex_lock(&allocLock);
+			if (ret < 0) {
+				blocksSetUsed(mountedSB, newAddr + i - 1, count - i, 0);
+				pthread_mutex_unlock(&allocLock);
+				count = i;
+				break;
+			}
+			mi->blocks[b + i] = newAddr + i;
+			blocksRelease(mountedSB, &old, 1);
+			pthread_mutex_unlock(&allocLock);
+		}
+		if (count > 0 &&
+		    inodeSetBlockAddrs(mi->inode, b, mi->blocks + b, count) < 0)
+			ret = -1;
+		mi->dirty = 1;
+		b += count;
+	}
+	free(copy);
+	return ret;
+}
+
+// Grava zeros nos bytes [from, to) de um arquivo que caem em blocos ja'
+// alocados no disco, como os pre-alocados alem do fim. Buracos e o trecho
+// alem do mapa de blocos ja' sao lidos como zeros e ficam como estao. Os
+// bytes antes de valid guardam dados do arquivo e sao preservados nos
+// setores gravados em parte. Retorna 0 em caso de sucesso ou -1 caso
+// contrario
+static int memInodeZero(MemInode *mi, unsigned long long from,
+                        unsigned long long to, unsigned long long valid) {
+	static const unsigned char zeros[MAX_BLOCKSIZE];
+	unsigned int blockSize = mountedSB->blockSize;
+
+	if (memInodeUnshare(mi, from, to) < 0) return -1;
+
+	for (unsigned int b = (unsigned int)(from / blockSize);
+	     from < to && b < mi->numBlocks &&
+	     (unsigned long long)b * blockSize < to; b++) {
+		unsigned int blockAddr = memInodeBlockAddr(mi, b);
+		if (blockAddr == 0) continue;
+		unsigned long long blockStart = (unsigned long long)b * blockSize;
+		unsigned long long start = (from > blockStart ? from : blockStart);
+		unsigned long long end = blockStart + blockSize;
+		if (end > to) end = to;
+		unsigned int skip = start % DISK_SECTORDATASIZE;
+		unsigned long long sectorPos = start - skip;
+		unsigned int sectorNum = blockToSector(blockAddr - 1, mountedSB)
+		                         + (start % blockSize) / DISK_SECTORDATASIZE;
+		if (memInodeWriteSectors(mountedDisk, sectorNum, skip, zeros,
+		                         end - start,
+		                         valid > sectorPos ? valid - sectorPos : 0) < 0)
+			return -1;
+	}
+	return 0;
+}
 
-    Inode *inode = fdTable[idx].inode;
-    unsigned int cursor = fdTable[idx].cursor;
-    unsigned int written = 0;
+// Escreve nbytes da memoria indicada pelo cursor c no arquivo de um i-node
+// em memoria, a partir de offset, alocando de uma vez os blocos que
+// faltarem e atualizando o tamanho do arquivo uma vez. Os setores inteiros
+// de cada trecho do cursor sao gravados diretamente dele; um setor dividido
+// entre trechos e' montado e gravado uma vez. Uma escrita alem do fim deixa um
+// buraco entre o fim anterior e offset, sem blocos para os blocos inteiros
+// do intervalo. Retorna o numero de bytes escritos
+static unsigned long long memInodeWriteIo(MemInode *mi,
+                                          unsigned long long offset,
+                                          IoCursor *c,
+                                          unsigned long long nbytes) {
+    Inode *inode = mi->inode;
+    unsigned long long written = 0;
+    unsigned long long avail;
     unsigned int blockSize = mountedSB->blockSize;
-    unsigned int fileSize = inodeGetFileSize(inode);
+    unsigned long long fileSize = inodeGetFileSize(inode);
     Disk *d = mountedDisk;
+    int delayed = delayedAllocEnabled();
+
+    // Nada e' escrito alem do maior tamanho de arquivo
+    if (offset >= maxFileSize()) return 0;
+    if (nbytes > maxFileSize() - offset) nbytes = maxFileSize() - offset;
+
+    // Escrita alem do fim: o que houver de blocos alocados entre o fim e
+    // offset e' zerado; o restante do intervalo e' buraco
+    if (offset > fileSize) {
+        if (memInodeZero(mi, fileSize, offset, fileSize) < 0) return 0;
+        fileSize = offset;
+    }
+    // Os dados com alocacao atrasada seguem o mapa de blocos. Antes de um
+    // buraco de blocos inteiros, eles vao para o disco e o buraco entra no
+    // mapa, para nao ocupar memoria nem blocos
+    if ((delayed || mi->delayLen > 0) && offset / blockSize >
+        mi->numBlocks + (mi->delayLen + blockSize - 1) / blockSize) {
+        if (memInodeFlushDelayed(mi) < 0) return 0;
+        unsigned int holes = (unsigned int)(offset / blockSize) - mi->numBlocks;
+        int added = memInodeAddBlocks(mi, INODE_HOLE, holes);
+        if (added < 0 || (unsigned int)added < holes) return 0;
+    }
+
+    // Com alocacao atrasada, apenas a parte da escrita que cai em blocos ja'
+    // alocados vai para o disco; o restante fica em memoria
+    unsigned long long toDisk = nbytes;
+    if (delayed || mi->delayLen > 0) {
+        unsigned long long delayStart = (unsigned long long)mi->numBlocks
+                                        * blockSize;
+        toDisk = (offset >= delayStart ? 0 : delayStart - offset);
+        if (toDisk > nbytes) toDisk = nbytes;
+    }
+
+    // Aloca de uma vez os blocos que faltam para toda a escrita, para que
+    // fiquem contiguos no disco. Um bloco novo escrito em parte tem o
+    // restante zerado: antes dos dados e, se ainda dentro do arquivo, depois.
+    // Sem espaco para todos, a escrita fica com os blocos do inicio do
+    // intervalo que puderam ser alocados, sempre por inteiro; se os zeros
+    // nao puderem ser gravados, nada e' escrito
+    if (toDisk > 0) {
+        unsigned int firstBlk = (unsigned int)(offset / blockSize);
+        unsigned int lastBlk = (unsigned int)((offset + toDisk - 1) / blockSize);
+        unsigned long long end = offset + toDisk;
+        unsigned long long headStart = (unsigned long long)firstBlk * blockSize;
+        unsigned long long tailStart = (unsigned long long)lastBlk * blockSize;
+        int headFresh = (memInodeBlockAddr(mi, firstBlk) == 0);
+        int tailFresh = (memInodeBlockAddr(mi, lastBlk) == 0);
+        if (allocFileBlocks(mi, firstBlk, lastBlk) < 0) {
+            unsigned int b = firstBlk;
+            while (b <= lastBlk && memInodeBlockAddr(mi, b) != 0) b++;
+            if (b == firstBlk) return 0;
+            end = (unsigned long long)b * blockSize;
+            toDisk = nbytes = end - offset;
+        }
+        if (headFresh && offset % blockSize != 0 &&
+            memInodeZero(mi, headStart, offset, headStart) < 0)
+            return 0;
+        if (tailFresh && end % blockSize != 0 && end < fileSize &&
+            memInodeZero(mi, end, (tailStart + blockSize < fileSize ?
+                                   tailStart + blockSize : fileSize),
+                         tailStart) < 0)
+            return 0;
+    }
+
+    // Blocos compartilhados com clones sao trocados antes de alterados,
+    // apenas no trecho que sera' de fato escrito: os cobertos por inteiro
+    // nao tem o conteudo copiado. Se a troca parar no meio, a escrita fica
+    // com os blocos do inicio que ja' nao sao compartilhados
+    if (toDisk > 0 && memInodeUnshare(mi, offset, offset + toDisk) < 0) {
+        unsigned int b = (unsigned int)(offset / blockSize);
+        pthread_mutex_lock(&allocLock);
+        while ((unsigned long long)b * blockSize < offset + toDisk &&
+               blockRefs(memInodeBlockAddr(mi, b)) <= 1)
+            b++;
+        pthread_mutex_unlock(&allocLock);
+        if ((unsigned long long)b * blockSize <= offset) return 0;
+        if ((unsigned long long)b * blockSize < offset + toDisk)
+            toDisk = nbytes = (unsigned long long)b * blockSize - offset;
+    }
 
-    while (written < nbytes) {
-        unsigned int blockNum = (cursor + written) / blockSize;
-        unsigned int blockOffset = (cursor + written) % blockSize;
+    while (written < toDisk) {
+        const char *buf = ioCursorPeek(c, toDisk - written, &avail);
+        if (avail == 0) break;
+        unsigned int blockNum = (unsigned int)((offset + written) / blockSize);
+        unsigned int blockOffset = (offset + written) % blockSize;
 
-        unsigned int blockAddr = inodeGetBlockAddr(inode, blockNum);
+        unsigned int blockAddr = memInodeBlockAddr(mi, blockNum);
         if (blockAddr == 0) {
             // Aloca novo bloco
-            blockAddr = allocFreeBlock(d, mountedSB);
-            if (blockAddr == 0) break;
-            if (inodeAddBlock(inode, blockAddr) < 0) break;
+            if (allocFileBlocks(mi, blockNum, blockNum) < 0) break;
+            blockAddr = memInodeBlockAddr(mi, blockNum);
         }
 
-        unsigned char sector[blockSize];
-        // Lê o bloco atual do disco
-        unsigned int sectorNum = blockToSector(blockNum, mountedSB);
-        if (diskReadSector(d, sectorNum, sector) < 0) break;
+        // Blocos seguintes contiguos no disco entram na mesma transferencia
+        unsigned int lastBlock = (unsigned int)((offset + toDisk - 1)
+                                                / blockSize);
+        unsigned int runBlocks = 1;
+        while (blockNum + runBlocks <= lastBlock &&
+               memInodeBlockAddr(mi, blockNum + runBlocks) == blockAddr + runBlocks)
+            runBlocks++;
 
-        // Calcula quantos bytes pode escrever neste bloco
-        unsigned int toWrite = blockSize - blockOffset;
-        if (toWrite > (nbytes - written)) {
-            toWrite = nbytes - written;
+        // Calcula quantos bytes pode escrever nesta sequencia de blocos
+        unsigned long long toWrite = (unsigned long long)runBlocks * blockSize
+                                     - blockOffset;
+        if (toWrite > (toDisk - written)) {
+            toWrite = toDisk - written;
         }
 
-        // Copia os dados para o bloco
-        memcpy(sector + blockOffset, buf + written, toWrite);
-
-        // Escreve o bloco de volta no disco
-        if (diskWriteSector(d, sectorNum, sector) < 0) break;
+        // Bytes do arquivo ja' existentes a partir do primeiro setor
+        // atingido; alem deles, o conteudo antigo do disco nao importa
+        unsigned int skip = blockOffset % DISK_SECTORDATASIZE;
+        unsigned long long sectorPos = offset + written - skip;
+        unsigned long long existing = (fileSize > sectorPos ? fileSize - sectorPos
+                                                            : 0);
 
+        unsigned int sectorNum = blockToSector(blockAddr - 1, mountedSB)
+                                 + blockOffset / DISK_SECTORDATASIZE;
+        if (toWrite > avail && skip + avail < DISK_SECTORDATASIZE) {
+            // O trecho atual do cursor termina dentro deste setor
+            unsigned char sector[DISK_SECTORDATASIZE];
+            if (toWrite > DISK_SECTORDATASIZE - skip)
+                toWrite = DISK_SECTORDATASIZE - skip;
+            ioCursorCopy(c, (char *)sector, toWrite, 0);
+            if (memInodeWriteSectors(d, sectorNum, skip, sector, toWrite,
+                                     existing) < 0)
+                break;
+        }
+        else {
+            // Ate' o ultimo setor que termina dentro do trecho atual
+            if (toWrite > avail)
+                toWrite = avail - (skip + avail) % DISK_SECTORDATASIZE;
+            if (memInodeWriteSectors(d, sectorNum, skip,
+                                     (const unsigned char *)buf, toWrite,
+                                     existing) < 0)
+                break;
+            ioCursorAdvance(c, toWrite);
+        }
         written += toWrite;
     }
 
-    // Atualiza cursor e tamanho do arquivo
-    fdTable[idx].cursor += written;
-    if (fdTable[idx].cursor > fileSize) {
-        inodeSetFileSize(inode, fdTable[idx].cursor);
+    // O restante vai para o buffer da alocacao atrasada, trecho a trecho
+    if (written == toDisk) {
+        while (written < nbytes) {
+            const char *buf = ioCursorPeek(c, nbytes - written, &avail);
+            if (avail == 0) break;
+            unsigned long long accepted = memInodeDelayedWrite(mi,
+                                                               offset + written,
+                                                               buf, avail);
+            ioCursorAdvance(c, accepted);
+            written += accepted;
+            if (accepted < avail) break;
+        }
+    }
+
+    // Atualiza o tamanho do arquivo. O i-node so' e' gravado no fechamento
+    // ou na sincronizacao (fsync/syncfs)
+    if (offset + written > fileSize) {
+        inodeSetFileSize(inode, offset + written);
     }
-    inodeSave(inode);
+    mi->dirty = 1;
 
     return written;
 }
 
-//Funcao para fechar um arquivo, a partir de um descritor de arquivo
-//existente. Retorna 0 caso bem sucedido, ou -1 caso contrario
-int myFSClose(int fd) {
-	int idx = fd - 1;  // conversão OBRIGATÓRIA
+// Escreve os nbytes de buf no arquivo de um i-node em memoria, a partir de
+// offset, como memInodeWriteIo. Retorna o numero de bytes escritos
+static unsigned long long memInodeWrite(MemInode *mi, unsigned long long offset,
+                                        const char *buf,
+                                        unsigned long long nbytes) {
+    IoCursor c;
+    ioCursorInit(&c, (char *)buf, nbytes);
+    return memInodeWriteIo(mi, offset, &c, nbytes);
+}
+
+// Grava o superbloco no disco, com os contadores de blocos, i-nodes e
+// arquivos atualizados, copiados sob a trava do alocador. Chamada com
+// syncLock. Retorna 0 em caso de sucesso ou -1 caso contrario
+static int superblockSync(Disk *d, Superblock *sb) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	memset(sector, 0, DISK_SECTORDATASIZE);
+	pthread_mutex_lock(&allocLock);
+	memcpy(sector, sb, sizeof(Superblock));
+	pthread_mutex_unlock(&allocLock);
+	return (diskWriteSector(d, SUPERBLOCK_SECTOR, sector) < 0 ? -1 : 0);
+}
+
+// Carrega a tabela de referencias de blocos do arquivo indicado no
+// superbloco, se houver, mantendo o arquivo aberto durante a montagem.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int refTableLoad(void) {
+	if (mountedSB->refTableInode == 0) return 0;
+	if (!(refFile = memInodeGet(mountedSB->refTableInode))) return -1;
+
+	unsigned int size = inodeGetFileSize(refFile->inode);
+	unsigned char *buf = malloc(size ? size : 1);
+	if (!buf || memInodeRead(refFile, 0, (char *)buf, size) != size) {
+		free(buf);
+		return -1;
+	}
+	for (unsigned int p = 0; p + 8 <= size; p += 8) {
+		unsigned int addr, refs;
+		char2ul(buf + p, &addr);
+		char2ul(buf + p + 4, &refs);
+		if (blockRefsSet(addr, refs) < 0) {
+			free(buf);
+			return -1;
+		}
+	}
+	free(buf);
+	refTableDirty = 0;
+	return 0;
+}
+
+// Grava a tabela de referencias de blocos, se alterada, no seu arquivo,
+// criado na primeira gravacao com blocos compartilhados. A tabela e' copiada
+// sob a trava do alocador e gravada fora dela. Chamada com syncLock.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int refTableSync(void) {
+	pthread_mutex_lock(&allocLock);
+	int dirty = refTableDirty;
+	if (dirty && !refFile && refTableCount == 0) dirty = refTableDirty = 0;
+	pthread_mutex_unlock(&allocLock);
+	if (!dirty) return 0;
+	if (!refFile) {
+		Inode *inode = inodeCreateFree(1, mountedDisk);
+		if (!inode) return -1;
+		unsigned int inumber = inodeGetNumber(inode);
+		inodeSetFileType(inode, FILETYPE_REGULAR);
+		inodeSetRefCount(inode, 1);
+		if (inodeSave(inode) < 0 || !(refFile = memInodeGet(inumber))) {
+			inodeFree(inode);
+			free(inode);
+			return -1;
+		}
+		free(inode);
+		pthread_mutex_lock(&allocLock);
+		mountedSB->refTableInode = inumber;
+		if (mountedSB->freeInodes > 0) mountedSB->freeInodes--;
+		pthread_mutex_unlock(&allocLock);
+	}
 
-	if (idx < 0 || idx >= MAX_OPEN_FILES) {
+	pthread_mutex_lock(&allocLock);
+	unsigned int size = refTableCount * 8, p = 0;
+	unsigned char *buf = malloc(size ? size : 1);
+	if (!buf) {
+		pthread_mutex_unlock(&allocLock);
 		return -1;
 	}
+	for (unsigned int i = 0; i < refTableCap; i++) {
+		if (refTable[i].addr == 0) continue;
+		ul2char(refTable[i].addr, buf + p);
+		ul2char(refTable[i].refs, buf + p + 4);
+		p += 8;
+	}
+	refTableDirty = 0;
+	pthread_mutex_unlock(&allocLock);
+
+	pthread_rwlock_wrlock(&refFile->lock);
+	int ret = 0;
+	if (size > 0 && memInodeWrite(refFile, 0, (char *)buf, size) != size)
+		ret = -1;
+	else if (size < inodeGetFileSize(refFile->inode)) {
+		if (memInodeTruncate(refFile, size) < 0) ret = -1;
+		else {
+			inodeSetFileSize(refFile->inode, size);
+			refFile->dirty = 1;
+		}
+	}
+	if (ret == 0) ret = memInodeSync(refFile);
+	pthread_rwlock_unlock(&refFile->lock);
+	free(buf);
+	if (ret < 0) {
+		pthread_mutex_lock(&allocLock);
+		refTableDirty = 1;
+		pthread_mutex_unlock(&allocLock);
+	}
+	return ret;
+}
 
-	if (!fdTable[idx].inUse) {
+// Grava os metadados globais: a tabela de referencias de blocos, o bitmap e
+// o superbloco. Chamada com syncLock. Retorna 0 em caso de sucesso ou -1
+// caso contrario
+static int metaSync(void) {
+	if (refTableSync() < 0 || bitmapSync(mountedDisk, mountedSB) < 0)
 		return -1;
+	return superblockSync(mountedDisk, mountedSB);
+}
+
+// Persiste no disco os dados pendentes mantidos em memoria pelo sistema
+// de arquivos montado: dados com alocacao atrasada e i-nodes dos arquivos
+// abertos, a tabela de referencias de blocos, o bitmap e o superbloco. Os
+// arquivos abertos sao percorridos um a um, cada um com a sua trava e
+// mantido aberto enquanto isso; os que estao ocupados se gravam sozinhos
+// no fechamento. Retorna 0 em caso de sucesso ou -1 caso contrario
+static int myFSSync(Disk *d) {
+	MemInode *mi, *next;
+	int ret = 0;
+
+	if (!mountedSB || d != mountedDisk) return -1;
+	pthread_mutex_lock(&syncLock);
+	pthread_mutex_lock(&memInodesLock);
+	for (mi = memInodes; mi && mi->busy; mi = mi->next);
+	if (mi) mi->openCount++;
+	pthread_mutex_unlock(&memInodesLock);
+	while (mi) {
+		pthread_rwlock_wrlock(&mi->lock);
+		if (memInodeSync(mi) < 0) ret = -1;
+		pthread_rwlock_unlock(&mi->lock);
+		pthread_mutex_lock(&memInodesLock);
+		for (next = mi->next; next && next->busy; next = next->next);
+		if (next) next->openCount++;
+		pthread_mutex_unlock(&memInodesLock);
+		if (memInodePut(mi) < 0) ret = -1;
+		mi = next;
+	}
+	if (ret == 0) ret = metaSync();
+	pthread_mutex_unlock(&syncLock);
+	return ret;
+}
+
+// Decodifica a entrada de diretorio que comeca em p
+static void direntDecode(const unsigned char *p, DirEntry *e) {
+	char2ul((unsigned char *)p, &e->inumber);
+	e->recLen = p[4] | (p[5] << 8);
+	e->nameLen = p[6];
+	e->type = p[7];
+	e->name = p + DIRENT_HEADER;
+}
+
+// Altera o recLen da entrada de diretorio que comeca em p
+static void direntSetRecLen(unsigned char *p, unsigned int recLen) {
+	p[4] = recLen & 0xFF;
+	p[5] = (recLen >> 8) & 0xFF;
+}
+
+// Codifica em p uma entrada de diretorio
+static void direntEncode(unsigned char *p, unsigned int inumber,
+                         unsigned int recLen, const char *name,
+                         unsigned int nameLen, unsigned int type) {
+	ul2char(inumber, p);
+	direntSetRecLen(p, recLen);
+	p[6] = nameLen;
+	p[7] = type;
+	memcpy(p + DIRENT_HEADER, name, nameLen);
+}
+
+// As funcoes de diretorio a seguir supoem a trava do diretorio obtida: para
+// leitura nas buscas e para escrita nas alteracoes.
+
+// Le o bloco de indice blockNum do diretorio dir para block. Retorna 0 em
+// caso de sucesso ou -1 se o bloco nao existir
+static int dirReadBlock(MemInode *dir, unsigned int blockNum,
+                        unsigned char *block) {
+	unsigned int blockSize = mountedSB->blockSize;
+	return (memInodeRead(dir, blockNum * blockSize, (char *)block, blockSize)
+	        == blockSize ? 0 : -1);
+}
+
+// Grava block no bloco de indice blockNum do diretorio dir, que pode ser o
+// seguinte ao ultimo, mantendo a raiz do indice em cache atualizada.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int dirWriteBlock(MemInode *dir, unsigned int blockNum,
+                         const unsigned char *block) {
+	unsigned int blockSize = mountedSB->blockSize;
+	if (blockNum == 0 && dir->dirIndex) memcpy(dir->dirIndex, block, blockSize);
+	return (memInodeWrite(dir, blockNum * blockSize, (const char *)block,
+	                      blockSize) == blockSize ? 0 : -1);
+}
+
+// Retorna a raiz do indice do diretorio dir, lida do disco apenas no
+// primeiro acesso. Leitores do mesmo diretorio podem le-la ao mesmo tempo;
+// so' a primeira copia e' publicada, sob nameLock. Retorna NULL se o
+// diretorio estiver vazio ou invalido
+static unsigned char* dirRootIndex(MemInode *dir) {
+	unsigned int magic;
+	pthread_rwlock_rdlock(&nameLock);
+	unsigned char *idx = dir->dirIndex;
+	pthread_rwlock_unlock(&nameLock);
+	if (idx) return idx;
+	if (inodeGetFileSize(dir->inode) == 0) return NULL;
+	if (!(idx = malloc(mountedSB->blockSize))) return NULL;
+	if (dirReadBlock(dir, 0, idx) < 0 || (char2ul(idx, &magic), magic) !=
+	    DIRINDEX_MAGIC) {
+		free(idx);
+		return NULL;
+	}
+	pthread_rwlock_wrlock(&nameLock);
+	if (dir->dirIndex) {
+		free(idx);
+		idx = dir->dirIndex;
+	}
+	else dir->dirIndex = idx;
+	pthread_rwlock_unlock(&nameLock);
+	return idx;
+}
+
+// Hash FNV-1a de 32 bits de um nome. Faz parte do formato em disco
+static unsigned int nameHash(const char *name, unsigned int nameLen) {
+	unsigned int h = 2166136261u;
+	for (unsigned int i = 0; i < nameLen; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// Posicao inicial de sondagem de (dir, hash) na tabela de nomes
+static unsigned int nameTableSlot(unsigned int dir, unsigned int hash) {
+	return (hash ^ (dir * 0x9E3779B9u)) & (nameTableCap - 1);
+}
+
+// Procura (dir, name) na tabela de nomes. Retorna a posicao da entrada ou
+// -1 se nao existir
+static int nameTableFind(unsigned int dir, const char *name, unsigned int hash) {
+	if (!nameTable) return -1;
+	for (unsigned int i = nameTableSlot(dir, hash); nameTable[i].dir != 0;
+	     i = (i + 1) & (nameTableCap - 1)) {
+		if (nameTable[i].dir == dir && nameTable[i].hash == hash &&
+		    strcmp(nameTable[i].name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+// Insere (dir, name) -> (inumber, type) na tabela de nomes, que dobra de
+// tamanho quando passa da metade da ocupacao. Retorna 0 em caso de sucesso
+// ou -1 se nao houver memoria
+static int nameTableInsert(unsigned int dir, const char *name,
+                           unsigned int hash, unsigned int inumber,
+                           unsigned int type) {
+	if (2 * (nameTableCount + 1) > nameTableCap) {
+		unsigned int oldCap = nameTableCap;
+		NameEntry *old = nameTable;
+		unsigned int cap = (oldCap ? oldCap * 2 : 256);
+		NameEntry *table = calloc(cap, sizeof(NameEntry));
+		if (!table) return -1;
+		nameTable = table;
+		nameTableCap = cap;
+		for (unsigned int i = 0; i < oldCap; i++) {
+			if (old[i].dir == 0) continue;
+			unsigned int j = nameTableSlot(old[i].dir, old[i].hash);
+			while (nameTable[j].dir != 0) j = (j + 1) & (cap - 1);
+			nameTable[j] = old[i];
+		}
+		free(old);
+	}
+
+	char *copy = malloc(strlen(name) + 1);
+	if (!copy) return -1;
+	strcpy(copy, name);
+	unsigned int i = nameTableSlot(dir, hash);
+	while (nameTable[i].dir != 0) i = (i + 1) & (nameTableCap - 1);
+	nameTable[i].dir = dir;
+	nameTable[i].inumber = inumber;
+	nameTable[i].hash = hash;
+	nameTable[i].type = type;
+	nameTable[i].name = copy;
+	nameTableCount++;
+	if (dir != ROOT_INUMBER) dcacheCount++;
+	return 0;
+}
+
+// Remove a entrada da posicao found da tabela de nomes. As entradas
+// seguintes da mesma sequencia de sondagem sao recuadas, sem deixar marcas
+// de remocao
+static void nameTableRemoveAt(unsigned int found) {
+	unsigned int mask = nameTableCap - 1;
+	unsigned int i = found, j = found;
+
+	if (nameTable[i].dir != ROOT_INUMBER) dcacheCount--;
+	free(nameTable[i].name);
+	for (;;) {
+		j = (j + 1) & mask;
+		if (nameTable[j].dir == 0) break;
+		unsigned int k = nameTableSlot(nameTable[j].dir, nameTable[j].hash);
+		// A entrada em j pode ocupar a lacuna i se sua posicao inicial k
+		// nao estiver (ciclicamente) entre i e j
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			nameTable[i] = nameTable[j];
+			i = j;
+		}
+	}
+	nameTable[i].dir = 0;
+	nameTable[i].name = NULL;
+	nameTableCount--;
+}
+
+// Libera toda a tabela de nomes
+static void nameTableClear(void) {
+	for (unsigned int i = 0; i < nameTableCap; i++)
+		free(nameTable[i].name);
+	free(nameTable);
+	nameTable = NULL;
+	nameTableCap = 0;
+	nameTableCount = 0;
+	rootNamesLoaded = 0;
+	dcacheCount = 0;
+	dcacheHand = 0;
+}
+
+// Consulta a cache de nomes por (dir, name). Retorna 1 se a resposta for
+// conhecida, com o i-node (0 se o nome nao existir) e o tipo da entrada em
+// *inumber e *type, ou 0 se for preciso procurar no disco
+static int dcacheLookup(unsigned int dir, const char *name, unsigned int hash,
+                        unsigned int *inumber, unsigned int *type) {
+	int i, found = 0;
+	pthread_rwlock_rdlock(&nameLock);
+	if (dir != ROOT_INUMBER || rootNamesLoaded) {
+		if ((i = nameTableFind(dir, name, hash)) >= 0) {
+			*inumber = nameTable[i].inumber;
+			*type = nameTable[i].type;
+			found = 1;
+		}
+		else if (dir == ROOT_INUMBER) {
+			// Com a tabela completa, um nome ausente nao existe no raiz
+			*inumber = 0;
+			found = 1;
+		}
+	}
+	pthread_rwlock_unlock(&nameLock);
+	return found;
+}
+
+// Descarta uma entrada da cache que nao seja do raiz, percorrendo a tabela
+// circularmente a partir da ultima posicao descartada
+static void dcacheEvict(void) {
+	unsigned int mask = nameTableCap - 1;
+	for (unsigned int n = 0; n < nameTableCap; n++) {
+		unsigned int i = (dcacheHand + n) & mask;
+		if (nameTable[i].dir != 0 && nameTable[i].dir != ROOT_INUMBER) {
+			nameTableRemoveAt(i);
+			dcacheHand = (i + 1) & mask;
+			return;
+		}
 	}
+}
 
-	if (fdTable[idx].inode) {
-		free(fdTable[idx].inode);
+// Registra na cache que (dir, name) aponta para o i-node inumber do tipo
+// type, ou que nao existe (inumber 0). A tabela completa do raiz guarda
+// apenas os nomes existentes; as demais entradas sao descartadas quando a
+// cache passa de DCACHE_MAX_ENTRIES. Chamada com a trava do diretorio, para
+// que uma resposta antiga nao substitua a de uma alteracao mais recente
+static void dcacheStore(unsigned int dir, const char *name, unsigned int hash,
+                        unsigned int inumber, unsigned int type) {
+	int i;
+	pthread_rwlock_wrlock(&nameLock);
+	if (dir == ROOT_INUMBER && !rootNamesLoaded) goto out;
+	i = nameTableFind(dir, name, hash);
+	if (dir == ROOT_INUMBER && inumber == 0) {
+		if (i >= 0) nameTableRemoveAt(i);
+		goto out;
 	}
+	if (i >= 0) {
+		nameTable[i].inumber = inumber;
+		nameTable[i].type = type;
+		goto out;
+	}
+	if (dir != ROOT_INUMBER && dcacheCount >= DCACHE_MAX_ENTRIES) dcacheEvict();
+	// Sem memoria, o raiz deixa de ter tabela completa e vai ao disco
+	if (nameTableInsert(dir, name, hash, inumber, type) < 0 &&
+	    dir == ROOT_INUMBER)
+		rootNamesLoaded = 0;
+out:
+	pthread_rwlock_unlock(&nameLock);
+}
 
-	fdTable[idx].inUse = 0;
-	fdTable[idx].inumber = 0;
-	fdTable[idx].cursor = 0;
-	fdTable[idx].inode = NULL;
+// Remove da cache todas as entradas do diretorio dir, apagado do disco
+static void dcachePurge(unsigned int dir) {
+	pthread_rwlock_wrlock(&nameLock);
+	for (unsigned int i = 0; i < nameTableCap; ) {
+		// A remocao pode recuar outra entrada para a posicao i
+		if (nameTable[i].dir == dir) nameTableRemoveAt(i);
+		else i++;
+	}
+	pthread_rwlock_unlock(&nameLock);
+}
+
+// Retorna o numero de pares do bloco de indice idx
+static unsigned int dirIndexCount(unsigned char *idx) {
+	unsigned int count;
+	char2ul(idx + 4, &count);
+	return count;
+}
+
+// Retorna o numero maximo de pares em um bloco de indice
+static unsigned int dirIndexCapacity(void) {
+	return (mountedSB->blockSize - DIRINDEX_HEADER) / 8;
+}
+
+// Inicializa em idx um bloco de indice vazio com o nivel levels
+static void dirIndexInit(unsigned char *idx, unsigned int levels) {
+	memset(idx, 0, mountedSB->blockSize);
+	ul2char(DIRINDEX_MAGIC, idx);
+	ul2char(levels, idx + 8);
+}
+
+// Le o par de posicao i do bloco de indice idx
+static void dirIndexGet(unsigned char *idx, unsigned int i, unsigned int *hash,
+                        unsigned int *block) {
+	char2ul(idx + DIRINDEX_HEADER + 8 * i, hash);
+	char2ul(idx + DIRINDEX_HEADER + 8 * i + 4, block);
+}
+
+// Insere o par (hash, block) na posicao i do bloco de indice idx, que nao
+// pode estar cheio
+static void dirIndexInsert(unsigned char *idx, unsigned int i,
+                           unsigned int hash, unsigned int block) {
+	unsigned int count = dirIndexCount(idx);
+	unsigned char *p = idx + DIRINDEX_HEADER + 8 * i;
+	memmove(p + 8, p, 8 * (count - i));
+	ul2char(hash, p);
+	ul2char(block, p + 4);
+	ul2char(count + 1, idx + 4);
+}
+
+// Retorna a posicao do par do bloco de indice idx cuja faixa contem hash:
+// o ultimo par com hash inicial menor ou igual a hash
+static unsigned int dirIndexFind(unsigned char *idx, unsigned int hash) {
+	unsigned int lo = 0, hi = dirIndexCount(idx);
+	while (hi - lo > 1) {
+		unsigned int mid = (lo + hi) / 2, h, blk;
+		dirIndexGet(idx, mid, &h, &blk);
+		if (h <= hash) lo = mid;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// Procura a entrada name na folha block. Se encontrada, sua posicao e a da
+// anterior (-1 se for a primeira) ficam em *pos e *prevPos. Retorna o
+// numero do i-node da entrada ou 0
+static unsigned int dirLeafFind(unsigned char *block, const char *name,
+                                unsigned int nameLen, int *pos, int *prevPos) {
+	unsigned int blockSize = mountedSB->blockSize;
+	int prev = -1;
+	DirEntry e;
+
+	for (unsigned int p = DIRLEAF_HEADER; p + DIRENT_HEADER <= blockSize;
+	     p += e.recLen) {
+		direntDecode(block + p, &e);
+		if (e.recLen < DIRENT_HEADER || p + e.recLen > blockSize) break;
+		if (e.inumber != 0 && e.nameLen == nameLen &&
+		    memcmp(e.name, name, nameLen) == 0) {
+			*pos = p;
+			*prevPos = prev;
+			return e.inumber;
+		}
+		prev = p;
+	}
+	return 0;
+}
+
+// Entrada de uma folha sendo reorganizada
+typedef struct {
+	unsigned int hash;
+	unsigned int size;
+	DirEntry e;
+} LeafEntry;
+
+// Ordena as entradas pelo hash e, entre hashes iguais, pelo nome, para que
+// a ordem de uma folha nao dependa da sequencia das insercoes
+static int leafEntryCompare(const void *a, const void *b) {
+	const LeafEntry *x = a, *y = b;
+	if (x->hash != y->hash) return (x->hash < y->hash ? -1 : 1);
+	unsigned int n = (x->e.nameLen < y->e.nameLen ? x->e.nameLen : y->e.nameLen);
+	int c = memcmp(x->e.name, y->e.name, n);
+	if (c != 0) return c;
+	return (x->e.nameLen < y->e.nameLen ? -1 : x->e.nameLen > y->e.nameLen);
+}
+
+// Le para v as entradas ocupadas da folha block, acrescidas da nova entrada
+// (name, inumber, type) se name nao for NULL, em ordem. v deve ter espaco para
+// blockSize / DIRENT_HEADER + 1 entradas. Retorna o numero de entradas; a
+// soma dos seus tamanhos fica em *total
+static unsigned int dirLeafCollect(const unsigned char *block, LeafEntry *v,
+                                   const char *name, unsigned int nameLen,
+                                   unsigned int inumber, unsigned int type,
+                                   unsigned int *total) {
+	unsigned int blockSize = mountedSB->blockSize, n = 0;
+	DirEntry e;
+
+	*total = 0;
+	for (unsigned int p = DIRLEAF_HEADER; p + DIRENT_HEADER <= blockSize;
+	     p += e.recLen) {
+		direntDecode(block + p, &e);
+		if (e.recLen < DIRENT_HEADER || p + e.recLen > blockSize) break;
+		if (e.inumber == 0) continue;
+		v[n].e = e;
+		v[n].hash = nameHash((const char *)e.name, e.nameLen);
+		v[n].size = DIRENT_SIZE(e.nameLen);
+		*total += v[n++].size;
+	}
+	if (name) {
+		v[n].e.inumber = inumber;
+		v[n].e.nameLen = nameLen;
+		v[n].e.type = type;
+		v[n].e.name = (const unsigned char *)name;
+		v[n].hash = nameHash(name, nameLen);
+		v[n].size = DIRENT_SIZE(nameLen);
+		*total += v[n++].size;
+	}
+	qsort(v, n, sizeof(LeafEntry), leafEntryCompare);
+	return n;
+}
+
+// Grava em block uma folha com as entradas v[0..n) em sequencia, a ultima
+// ficando com o espaco livre ate' o fim do bloco, encadeada 'a folha next
+static void dirLeafFill(unsigned char *block, LeafEntry *v, unsigned int n,
+                        unsigned int next) {
+	unsigned int blockSize = mountedSB->blockSize, p = DIRLEAF_HEADER;
+	memset(block, 0, blockSize);
+	ul2char(DIRLEAF_MAGIC, block);
+	ul2char(next, block + 4);
+	if (n == 0) {
+		direntEncode(block + p, 0, blockSize - p, "", 0, 0);
+		return;
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned int recLen = (i == n - 1 ? blockSize - p : v[i].size);
+		direntEncode(block + p, v[i].e.inumber, recLen,
+		             (const char *)v[i].e.name, v[i].e.nameLen, v[i].e.type);
+		p += v[i].size;
+	}
+}
+
+// Insere uma entrada na folha block, na sua posicao na ordem das entradas.
+// Retorna 0 em caso de sucesso ou -1 se nao houver espaco
+static int dirLeafInsert(unsigned char *block, const char *name,
+                         unsigned int nameLen, unsigned int inumber,
+                         unsigned int type) {
+	unsigned int blockSize = mountedSB->blockSize, n, total, next;
+	LeafEntry *v = malloc((blockSize / DIRENT_HEADER + 1) * sizeof(LeafEntry));
+	unsigned char *tmp = malloc(blockSize);
+	int ret = -1;
+
+	if (!v || !tmp) goto out;
+	n = dirLeafCollect(block, v, name, nameLen, inumber, type, &total);
+	if (total > blockSize - DIRLEAF_HEADER) goto out;
+	// As entradas apontam para block: a folha e' montada a parte
+	char2ul(block + 4, &next);
+	dirLeafFill(tmp, v, n, next);
+	memcpy(block, tmp, blockSize);
+	ret = 0;
+out:
+	free(v);
+	free(tmp);
+	return ret;
+}
+
+// Divide a folha cheia block, acrescida da nova entrada (name, inumber,
+// type) se name nao for NULL, entre block e upper, que sera' gravada no
+// bloco upperNum e entra na cadeia logo depois de block: as entradas de
+// menor hash ficam em block e as de maior hash vao para upper, cujo hash
+// inicial e' escrito em *splitHash. Entradas de mesmo hash nao sao
+// separadas. Retorna 0 em caso de sucesso, -2 se as entradas nao couberem
+// em duas folhas (block fica inalterado) ou -1 caso contrario
+static int dirLeafSplit(unsigned char *block, unsigned char *upper,
+                        const char *name, unsigned int nameLen,
+                        unsigned int inumber, unsigned int type,
+                        unsigned int upperNum, unsigned int *splitHash) {
+	unsigned int blockSize = mountedSB->blockSize, space = blockSize - DIRLEAF_HEADER;
+	unsigned int n, total, best = 0, bestMax = space + 1, prefix = 0, next;
+	LeafEntry *v = malloc((blockSize / DIRENT_HEADER + 1) * sizeof(LeafEntry));
+	unsigned char *lower = malloc(blockSize);
+	int ret = -1;
+
+	if (!v || !lower) goto out;
+	n = dirLeafCollect(block, v, name, nameLen, inumber, type, &total);
+
+	// Ponto de divisao entre hashes diferentes que mais equilibra as folhas
+	for (unsigned int k = 1; k < n; k++) {
+		prefix += v[k - 1].size;
+		if (v[k].hash == v[k - 1].hash) continue;
+		unsigned int max = (prefix > total - prefix ? prefix : total - prefix);
+		if (max < bestMax) {
+			bestMax = max;
+			best = k;
+		}
+	}
+	if (best == 0 || bestMax > space) {
+		ret = -2;
+		goto out;
+	}
+
+	// As entradas apontam para block: as duas folhas sao montadas a parte
+	char2ul(block + 4, &next);
+	dirLeafFill(lower, v, best, upperNum);
+	dirLeafFill(upper, v + best, n - best, next);
+	memcpy(block, lower, blockSize);
+	*splitHash = v[best].hash;
+	ret = 0;
+out:
+	free(v);
+	free(lower);
+	return ret;
+}
+
+// Desce a arvore do diretorio dir da raiz ate' a folha que cobre hash,
+// registrando o caminho em path. Os blocos de indice sao lidos para nodes:
+// com keep, cada um fica em nodes + i * blockSize (a raiz, copiada, em
+// nodes); sem keep, nodes e' usado apenas como area de leitura de um bloco.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int dirFindLeaf(MemInode *dir, unsigned int hash, DirPath *path,
+                       unsigned char *nodes, int keep) {
+	unsigned int blockSize = mountedSB->blockSize, num = 0, level, h, magic;
+	unsigned char *node = dirRootIndex(dir);
+
+	path->depth = 0;
+	if (!node) return -1;
+	if (keep) {
+		memcpy(nodes, node, blockSize);
+		node = nodes;
+	}
+	for (;;) {
+		unsigned int d = path->depth++;
+		char2ul(node + 8, &level);
+		path->num[d] = num;
+		path->pos[d] = dirIndexFind(node, hash);
+		dirIndexGet(node, path->pos[d], &h, &num);
+		if (level == 0) break;
+		if (path->depth >= DIRTREE_MAX_DEPTH) return -1;
+		node = nodes + (keep ? path->depth * blockSize : 0);
+		if (dirReadBlock(dir, num, node) < 0) return -1;
+		char2ul(node, &magic);
+		if (magic != DIRINDEX_MAGIC) return -1;
+	}
+	path->leaf = num;
+	return 0;
+}
+
+// Procura a entrada name no diretorio dir em disco, descendo a arvore ate'
+// a folha correspondente ao hash do nome. Se encontrada, a folha fica em
+// block, seu numero em *blockNum e a posicao da entrada e da anterior na
+// folha em *pos e *prevPos. Retorna o numero do i-node da entrada ou 0
+static unsigned int dirScan(MemInode *dir, const char *name,
+                            unsigned char *block, unsigned int *blockNum,
+                            int *pos, int *prevPos) {
+	unsigned int nameLen = strlen(name);
+	DirPath path;
+
+	if (dirFindLeaf(dir, nameHash(name, nameLen), &path, block, 0) < 0)
+		return 0;
+	*blockNum = path.leaf;
+	if (dirReadBlock(dir, *blockNum, block) < 0) return 0;
+	return dirLeafFind(block, name, nameLen, pos, prevPos);
+}
+
+// Le para block a primeira folha do diretorio dir, na ordem dos hashes.
+// Retorna o numero do bloco da folha ou 0 se o diretorio estiver vazio ou em
+// caso de falha
+static unsigned int dirFirstLeaf(MemInode *dir, unsigned char *block) {
+	DirPath path;
+	if (inodeGetFileSize(dir->inode) == 0) return 0;
+	if (dirFindLeaf(dir, 0, &path, block, 0) < 0 ||
+	    dirReadBlock(dir, path.leaf, block) < 0) return 0;
+	return path.leaf;
+}
+
+// Le para block a folha seguinte 'a que esta' em block, pela cadeia das
+// folhas. Retorna o numero do seu bloco ou 0 se block for a ultima folha ou
+// em caso de falha
+static unsigned int dirNextLeaf(MemInode *dir, unsigned char *block) {
+	unsigned int next, magic;
+	char2ul(block + 4, &next);
+	if (next == 0 || dirReadBlock(dir, next, block) < 0) return 0;
+	char2ul(block, &magic);
+	return (magic == DIRLEAF_MAGIC ? next : 0);
+}
+
+// Carrega na tabela de nomes todas as entradas do diretorio raiz,
+// percorrendo a cadeia das folhas. Se faltar memoria, a tabela fica
+// incompleta e as buscas no raiz vao ao disco
+static void dirLoadRootNames(void) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned int numBlocks = inodeGetFileSize(rootDir->inode) / blockSize;
+	unsigned char *block = malloc(blockSize);
+	char name[MAX_FILENAME_LENGTH + 1];
+	DirEntry e;
+
+	rootNamesLoaded = 0;
+	if (!block) return;
+	if (numBlocks > 0 && dirFirstLeaf(rootDir, block) == 0) goto out;
+	// A cadeia tem no maximo numBlocks folhas, mesmo se estiver corrompida
+	for (unsigned int n = 0; numBlocks > 0 && n < numBlocks; n++) {
+		for (unsigned int p = DIRLEAF_HEADER; p + DIRENT_HEADER <= blockSize;
+		     p += e.recLen) {
+			direntDecode(block + p, &e);
+			if (e.recLen < DIRENT_HEADER || p + e.recLen > blockSize) break;
+			if (e.inumber == 0) continue;
+			memcpy(name, e.name, e.nameLen);
+			name[e.nameLen] = '\0';
+			if (nameTableInsert(ROOT_INUMBER, name, nameHash(name, e.nameLen),
+			                    e.inumber, e.type) < 0) goto out;
+		}
+		if (dirNextLeaf(rootDir, block) == 0) break;
+	}
+	rootNamesLoaded = 1;
+out:
+	free(block);
+}
+
+// Retorna o numero do i-node da entrada name do diretorio dir ou 0 se nao
+// existir. O tipo da entrada fica em *type. A busca passa pela cache de
+// nomes e so' vai ao disco se a resposta nao estiver nela
+static unsigned int dirFind(MemInode *dir, const char *name,
+                            unsigned int *type) {
+	unsigned int hash = nameHash(name, strlen(name));
+	unsigned int blockNum, inumber;
+	int pos, prevPos;
+	DirEntry e;
+
+	if (dcacheLookup(dir->inumber, name, hash, &inumber, type)) return inumber;
+	unsigned char *block = malloc(mountedSB->blockSize);
+	if (!block) return 0;
+	inumber = dirScan(dir, name, block, &blockNum, &pos, &prevPos);
+	*type = 0;
+	if (inumber != 0) {
+		direntDecode(block + pos, &e);
+		*type = e.type;
+	}
+	free(block);
+	dcacheStore(dir->inumber, name, hash, inumber, *type);
+	return inumber;
+}
+
+// Divide a folha cheia leaf, ao fim do caminho path, acrescida da entrada
+// (name, inumber, type) se name nao for NULL, e sobe pela arvore o par da
+// nova folha, dividindo os blocos de indice cheios; a divisao da raiz
+// aumenta a altura da arvore. nodes tem os blocos de indice do caminho, e
+// pool espaco para path->depth + 2 blocos novos. Todos os blocos alterados
+// sao gravados. Retorna 0 em caso de sucesso, -2 se as entradas nao couberem
+// em duas folhas (nada e' alterado) ou -1 caso contrario
+static int dirSplit(MemInode *dir, DirPath *path, unsigned char *nodes,
+                    unsigned char *pool, unsigned char *leaf, const char *name,
+                    unsigned int nameLen, unsigned int inumber,
+                    unsigned int type) {
+	unsigned int blockSize = mountedSB->blockSize, cap = dirIndexCapacity();
+	unsigned int next = inodeGetFileSize(dir->inode) / blockSize;
+	unsigned int key, child, numNew = 0, numOld = 0;
+	unsigned int newNum[DIRTREE_MAX_DEPTH + 2], oldNum[DIRTREE_MAX_DEPTH];
+	unsigned char *newBuf[DIRTREE_MAX_DEPTH + 2], *oldBuf[DIRTREE_MAX_DEPTH];
+
+	// As entradas de maior hash vao para uma nova folha
+	newNum[numNew] = next++;
+	newBuf[numNew] = pool;
+	int ret = dirLeafSplit(leaf, newBuf[numNew], name, nameLen, inumber, type,
+	                       newNum[numNew], &key);
+	if (ret < 0) return ret;
+	child = newNum[numNew++];
+
+	// O par (key, child) sobe pela arvore enquanto os blocos estiverem cheios
+	for (int d = path->depth - 1; ; d--) {
+		unsigned char *node = nodes + d * blockSize;
+		unsigned int count = dirIndexCount(node), at = path->pos[d] + 1;
+		if (count < cap) {
+			dirIndexInsert(node, at, key, child);
+			oldNum[numOld] = path->num[d];
+			oldBuf[numOld++] = node;
+			break;
+		}
+
+		// Bloco de indice cheio: a metade superior vai para um novo bloco
+		unsigned int half = count / 2, sibHash, nodeLevel, h;
+		unsigned char *sib = pool + numNew * blockSize;
+		char2ul(node + 8, &nodeLevel);
+		dirIndexInit(sib, nodeLevel);
+		memcpy(sib + DIRINDEX_HEADER, node + DIRINDEX_HEADER + 8 * half,
+		       8 * (count - half));
+		ul2char(count - half, sib + 4);
+		ul2char(half, node + 4);
+		if (at <= half) dirIndexInsert(node, at, key, child);
+		else dirIndexInsert(sib, at - half, key, child);
+		dirIndexGet(sib, 0, &sibHash, &h);
+		if (d > 0) {
+			newNum[numNew] = next++;
+			newBuf[numNew] = sib;
+			oldNum[numOld] = path->num[d];
+			oldBuf[numOld++] = node;
+			key = sibHash;
+			child = newNum[numNew++];
+			continue;
+		}
+
+		// Raiz cheia: suas duas metades vao para novos blocos e ela passa a
+		// apontar para eles, um nivel acima
+		if (nodeLevel + 1 >= DIRTREE_MAX_DEPTH) return -1;
+		unsigned char *low = pool + (numNew + 1) * blockSize;
+		memcpy(low, node, blockSize);
+		newNum[numNew] = next++;
+		newBuf[numNew++] = low;
+		newNum[numNew] = next++;
+		newBuf[numNew++] = sib;
+		dirIndexInit(node, nodeLevel + 1);
+		dirIndexInsert(node, 0, 0, newNum[numNew - 2]);
+		dirIndexInsert(node, 1, sibHash, newNum[numNew - 1]);
+		oldNum[numOld] = 0;
+		oldBuf[numOld++] = node;
+		break;
+	}
+
+	// Blocos novos primeiro, em ordem crescente (o arquivo e' denso); depois
+	// os blocos de indice alterados, de baixo para cima, e por ultimo a folha
+	// reduzida, para que nenhuma entrada fique inacessivel no caminho
+	for (unsigned int i = 0; i < numNew; i++)
+		if (dirWriteBlock(dir, newNum[i], newBuf[i]) < 0) return -1;
+	for (unsigned int i = 0; i < numOld; i++)
+		if (dirWriteBlock(dir, oldNum[i], oldBuf[i]) < 0) return -1;
+	return dirWriteBlock(dir, path->leaf, leaf);
+}
+
+// Acrescenta ao diretorio dir a entrada name, apontando para o i-node
+// inumber do tipo type, na folha da faixa do seu hash, que e' dividida se
+// estiver cheia. Retorna 0 em caso de sucesso ou -1 caso contrario
+static int dirAdd(MemInode *dir, const char *name, unsigned int inumber,
+                  unsigned int type) {
+	unsigned int blockSize = mountedSB->blockSize, level;
+	unsigned int nameLen = strlen(name), hash = nameHash(name, nameLen);
+	unsigned char *leaf = malloc(blockSize), *nodes = NULL, *pool = NULL;
+	unsigned char *root;
+	DirPath path;
+	int ret = -1;
+	if (!leaf) goto out;
+
+	if (inodeGetFileSize(dir->inode) == 0) {
+		// Diretorio vazio: raiz com uma unica folha para todos os hashes
+		nodes = malloc(blockSize);
+		if (!nodes) goto out;
+		dirIndexInit(nodes, 0);
+		dirIndexInsert(nodes, 0, 0, 1);
+		dirLeafFill(leaf, NULL, 0, 0);
+		if (dirLeafInsert(leaf, name, nameLen, inumber, type) == 0 &&
+		    dirWriteBlock(dir, 0, nodes) == 0 && dirWriteBlock(dir, 1, leaf) == 0)
+			ret = 0;
+		goto out;
+	}
+
+	for (;;) {
+		// Um bloco para cada nivel do caminho e os novos da divisao
+		if (!(root = dirRootIndex(dir))) goto out;
+		char2ul(root + 8, &level);
+		if (level >= DIRTREE_MAX_DEPTH) goto out;
+		free(nodes);
+		free(pool);
+		nodes = malloc((level + 1) * blockSize);
+		pool = malloc((level + 3) * blockSize);
+		if (!nodes || !pool) goto out;
+		if (dirFindLeaf(dir, hash, &path, nodes, 1) < 0 ||
+		    dirReadBlock(dir, path.leaf, leaf) < 0) goto out;
+		if (dirLeafInsert(leaf, name, nameLen, inumber, type) == 0) {
+			ret = dirWriteBlock(dir, path.leaf, leaf);
+			goto out;
+		}
+
+		// Folha cheia: e' dividida junto com a nova entrada. Se as entradas
+		// nao couberem em duas folhas (nomes longos em blocos pequenos), as
+		// existentes sao divididas antes e a insercao recomeca
+		ret = dirSplit(dir, &path, nodes, pool, leaf, name, nameLen, inumber,
+		               type);
+		if (ret != -2) goto out;
+		ret = -1;
+		if (dirSplit(dir, &path, nodes, pool, leaf, NULL, 0, 0, 0) < 0) goto out;
+	}
+out:
+	if (ret == 0) dcacheStore(dir->inumber, name, hash, inumber, type);
+	free(leaf);
+	free(nodes);
+	free(pool);
+	return ret;
+}
+
+// Remove o par de posicao i do bloco de indice idx. Se for o primeiro, o
+// seguinte herda o seu hash, que marca o inicio da faixa coberta pelo bloco
+static void dirIndexRemove(unsigned char *idx, unsigned int i) {
+	unsigned int count = dirIndexCount(idx), hash;
+	unsigned char *p = idx + DIRINDEX_HEADER + 8 * i;
+	char2ul(p, &hash);
+	memmove(p, p + 8, 8 * (count - i - 1));
+	memset(idx + DIRINDEX_HEADER + 8 * (count - 1), 0, 8);
+	ul2char(count - 1, idx + 4);
+	if (i == 0 && count > 1) ul2char(hash, idx + DIRINDEX_HEADER);
+}
+
+// Retorna 1 se a folha block tiver alguma entrada, com o hash da primeira
+// em *hash, ou 0 se estiver vazia
+static int dirLeafFirstHash(unsigned char *block, unsigned int *hash) {
+	unsigned int blockSize = mountedSB->blockSize;
+	DirEntry e;
+
+	for (unsigned int p = DIRLEAF_HEADER; p + DIRENT_HEADER <= blockSize;
+	     p += e.recLen) {
+		direntDecode(block + p, &e);
+		if (e.recLen < DIRENT_HEADER || p + e.recLen > blockSize) break;
+		if (e.inumber != 0) {
+			*hash = nameHash((const char *)e.name, e.nameLen);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Le para block a folha anterior, na cadeia, 'a do fim do caminho path, cujos
+// blocos de indice estao em nodes: a ultima da subarvore 'a esquerda no
+// bloco mais baixo do caminho que tenha uma. Seu numero fica em *num, ou 0
+// se a folha do caminho for a primeira. Retorna 0 em caso de sucesso ou -1
+// caso contrario
+static int dirPrevLeaf(MemInode *dir, const DirPath *path, unsigned char *nodes,
+                       unsigned char *block, unsigned int *num) {
+	unsigned int blockSize = mountedSB->blockSize, h, magic;
+	int d = (int)path->depth - 1;
+
+	*num = 0;
+	while (d >= 0 && path->pos[d] == 0) d--;
+	if (d < 0) return 0;
+	dirIndexGet(nodes + d * blockSize, path->pos[d] - 1, &h, num);
+	for (d++; d < (int)path->depth; d++) {
+		if (dirReadBlock(dir, *num, block) < 0) return -1;
+		char2ul(block, &magic);
+		if (magic != DIRINDEX_MAGIC || dirIndexCount(block) == 0) return -1;
+		dirIndexGet(block, dirIndexCount(block) - 1, &h, num);
+	}
+	if (dirReadBlock(dir, *num, block) < 0) return -1;
+	char2ul(block, &magic);
+	return (magic == DIRLEAF_MAGIC ? 0 : -1);
+}
+
+// Reduz o diretorio dir para numBlocks blocos, liberando os demais. Sem
+// nenhum bloco, o diretorio fica vazio e a raiz do indice sai da cache.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int dirTruncate(MemInode *dir, unsigned int numBlocks) {
+	unsigned long long size =
+		(unsigned long long)numBlocks * mountedSB->blockSize;
+	if (memInodeTruncate(dir, size) < 0) return -1;
+	inodeSetFileSize(dir->inode, size);
+	dir->dirty = 1;
+	if (numBlocks == 0) {
+		pthread_rwlock_wrlock(&nameLock);
+		free(dir->dirIndex);
+		dir->dirIndex = NULL;
+		pthread_rwlock_unlock(&nameLock);
+	}
+	return 0;
+}
+
+// Move o bloco from do diretorio dir, folha ou bloco de indice, para o
+// bloco to, fora da arvore, e atualiza o par que aponta para ele e, se for
+// uma folha, o encadeamento da anterior. O bloco e' achado descendo a
+// arvore pelo hash da sua primeira entrada ou par. nodes tem espaco para um
+// bloco por nivel da arvore; block e tmp, para um bloco cada. Retorna 0 em
+// caso de sucesso ou -1 caso contrario
+static int dirMoveBlock(MemInode *dir, unsigned int from, unsigned int to,
+                        unsigned char *nodes, unsigned char *block,
+                        unsigned char *tmp) {
+	unsigned int blockSize = mountedSB->blockSize, magic, hash, child, t;
+	unsigned int level = 0, rootLevel, prev, next;
+	DirPath path;
+
+	if (dirReadBlock(dir, from, block) < 0) return -1;
+	char2ul(block, &magic);
+	int leaf = (magic == DIRLEAF_MAGIC);
+	if (leaf) {
+		if (!dirLeafFirstHash(block, &hash)) return -1;
+	}
+	else if (magic == DIRINDEX_MAGIC && dirIndexCount(block) > 0) {
+		char2ul(block + 8, &level);
+		dirIndexGet(block, 0, &hash, &child);
+	}
+	else return -1;
+	if (dirFindLeaf(dir, hash, &path, nodes, 1) < 0) return -1;
+	char2ul(nodes + 8, &rootLevel);
+	t = (leaf ? path.depth : rootLevel - level);
+	if (t == 0 || t > path.depth ||
+	    (t < path.depth ? path.num[t] : path.leaf) != from) return -1;
+
+	// A copia primeiro; depois o par do bloco de indice, que guia as buscas,
+	// e por ultimo a cadeia das folhas
+	unsigned char *parent = nodes + (t - 1) * blockSize;
+	ul2char(to, parent + DIRINDEX_HEADER + 8 * path.pos[t - 1] + 4);
+	if (dirWriteBlock(dir, to, block) < 0 ||
+	    dirWriteBlock(dir, path.num[t - 1], parent) < 0) return -1;
+	if (!leaf) return 0;
+	if (dirPrevLeaf(dir, &path, nodes, tmp, &prev) < 0) return -1;
+	if (prev == 0) return 0;
+	char2ul(tmp + 4, &next);
+	if (next != from) return -1;
+	ul2char(to, tmp + 4);
+	return dirWriteBlock(dir, prev, tmp);
+}
+
+// Retira da arvore do diretorio dir a folha vazia que cobre hash. Seu par
+// sai do bloco de indice, e os blocos de indice que ficam vazios saem do
+// bloco de cima; so' depois a folha sai da cadeia, para que nenhuma folha
+// alcancavel pelas buscas fique fora dela. Os ultimos blocos do arquivo
+// ocupam os liberados, e o arquivo e' reduzido; sem nenhuma folha, o
+// diretorio fica vazio. Retorna 0 em caso de sucesso ou -1 caso contrario
+static int dirDropLeaf(MemInode *dir, unsigned int hash) {
+	unsigned int blockSize = mountedSB->blockSize, level, h, next, prev, link;
+	unsigned int numBlocks = inodeGetFileSize(dir->inode) / blockSize;
+	unsigned int freed[DIRTREE_MAX_DEPTH + 1], numFreed = 0;
+	unsigned char *root = dirRootIndex(dir), *nodes = NULL;
+	unsigned char *block = malloc(blockSize), *tmp = malloc(blockSize);
+	DirPath path;
+	int ret = -1, d;
+
+	if (!root || !block || !tmp) goto out;
+	char2ul(root + 8, &level);
+	if (level >= DIRTREE_MAX_DEPTH) goto out;
+	if (!(nodes = malloc((level + 1) * blockSize))) goto out;
+	if (dirFindLeaf(dir, hash, &path, nodes, 1) < 0 ||
+	    dirReadBlock(dir, path.leaf, block) < 0 ||
+	    dirLeafFirstHash(block, &h)) goto out;
+	char2ul(block + 4, &next);
+	if (dirPrevLeaf(dir, &path, nodes, tmp, &prev) < 0) goto out;
+	if (prev != 0 && (char2ul(tmp + 4, &link), link) != path.leaf) goto out;
+
+	freed[numFreed++] = path.leaf;
+	for (d = (int)path.depth - 1; ; d--) {
+		dirIndexRemove(nodes + d * blockSize, path.pos[d]);
+		if (d == 0 || dirIndexCount(nodes + d * blockSize) > 0) break;
+		freed[numFreed++] = path.num[d];
+	}
+	if (dirIndexCount(nodes + d * blockSize) == 0) {
+		ret = dirTruncate(dir, 0);
+		goto out;
+	}
+	if (dirWriteBlock(dir, path.num[d], nodes + d * blockSize) < 0) goto out;
+	if (prev != 0) {
+		ul2char(next, tmp + 4);
+		if (dirWriteBlock(dir, prev, tmp) < 0) goto out;
+	}
+
+	// Os blocos liberados, do maior para o menor, recebem o ultimo do arquivo
+	for (unsigned int i = 1; i < numFreed; i++)
+		for (unsigned int j = i; j > 0 && freed[j] > freed[j - 1]; j--) {
+			unsigned int swap = freed[j];
+			freed[j] = freed[j - 1];
+			freed[j - 1] = swap;
+		}
+	for (unsigned int i = 0; i < numFreed; i++) {
+		numBlocks--;
+		if (freed[i] != numBlocks &&
+		    dirMoveBlock(dir, numBlocks, freed[i], nodes, block, tmp) < 0)
+			goto out;
+	}
+	ret = dirTruncate(dir, numBlocks);
+out:
+	free(block);
+	free(tmp);
+	free(nodes);
+	return ret;
+}
+
+// Remove a entrada name do diretorio dir. O espaco da entrada passa para a
+// anterior na folha ou, se for a primeira, a entrada fica livre; a folha que
+// fica vazia sai da arvore. Retorna o numero do i-node da entrada removida
+// ou 0 se nao existir
+static unsigned int dirRemove(MemInode *dir, const char *name) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned char *block = malloc(blockSize);
+	unsigned int blockNum, inumber;
+	int pos, prevPos;
+	DirEntry e, prev;
+	if (!block) return 0;
+
+	inumber = dirScan(dir, name, block, &blockNum, &pos, &prevPos);
+	if (inumber != 0) {
+		direntDecode(block + pos, &e);
+		if (prevPos >= 0) {
+			direntDecode(block + prevPos, &prev);
+			direntSetRecLen(block + prevPos, prev.recLen + e.recLen);
+		}
+		else ul2char(0, block + pos);
+		if (dirWriteBlock(dir, blockNum, block) < 0) inumber = 0;
+	}
+	if (inumber != 0) {
+		unsigned int hash = nameHash(name, strlen(name)), h;
+		dcacheStore(dir->inumber, name, hash, 0, 0);
+		// A entrada ja' saiu: uma falha aqui so' deixa a folha vazia na arvore
+		if (!dirLeafFirstHash(block, &h)) dirDropLeaf(dir, hash);
+	}
+	free(block);
+	return inumber;
+}
+
+// Retorna 1 se o diretorio dir nao tiver nenhuma entrada ou 0 caso
+// contrario (inclusive em caso de falha na leitura)
+static int dirIsEmpty(MemInode *dir) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned int numBlocks = inodeGetFileSize(dir->inode) / blockSize;
+	unsigned char *block;
+	int empty = 1;
+	DirEntry e;
+
+	if (numBlocks == 0) return 1;
+	if (!(block = malloc(blockSize))) return 0;
+	if (dirFirstLeaf(dir, block) == 0) empty = 0;
+	for (unsigned int n = 0; empty && n < numBlocks; n++) {
+		for (unsigned int p = DIRLEAF_HEADER; p + DIRENT_HEADER <= blockSize;
+		     p += e.recLen) {
+			direntDecode(block + p, &e);
+			if (e.recLen < DIRENT_HEADER || p + e.recLen > blockSize) break;
+			if (e.inumber != 0) {
+				empty = 0;
+				break;
+			}
+		}
+		if (empty && dirNextLeaf(dir, block) == 0) break;
+	}
+	free(block);
+	return empty;
+}
+
+// Mantem o diretorio dir aberto entre os usados mais recentemente. Se a
+// lista estiver cheia, o diretorio menos recente e' fechado, fora da trava
+// da lista, pois o fechamento pode gravar o diretorio
+static void dirCacheTouch(MemInode *dir) {
+	MemInode *evicted = NULL;
+	unsigned int i;
+	if (dir == rootDir) return;
+	pthread_mutex_lock(&dirCacheLock);
+	for (i = 0; i < DIRCACHE_SIZE - 1 && dirCache[i] != dir; i++);
+	if (dirCache[i] != dir) {
+		evicted = dirCache[i];
+		memInodeRef(dir);
+	}
+	memmove(dirCache + 1, dirCache, i * sizeof(MemInode *));
+	dirCache[0] = dir;
+	pthread_mutex_unlock(&dirCacheLock);
+	if (evicted) memInodePut(evicted);
+}
+
+// Fecha o diretorio inumber, se estiver entre os mantidos abertos, ou todos
+// eles se inumber for 0
+static void dirCacheDrop(unsigned int inumber) {
+	MemInode *dropped[DIRCACHE_SIZE];
+	unsigned int n = 0;
+	pthread_mutex_lock(&dirCacheLock);
+	for (unsigned int i = 0; i < DIRCACHE_SIZE; i++) {
+		if (!dirCache[i] || (inumber && dirCache[i]->inumber != inumber))
+			continue;
+		dropped[n++] = dirCache[i];
+		memmove(dirCache + i, dirCache + i + 1,
+		        (DIRCACHE_SIZE - 1 - i) * sizeof(MemInode *));
+		dirCache[DIRCACHE_SIZE - 1] = NULL;
+		i--;
+	}
+	pthread_mutex_unlock(&dirCacheLock);
+	while (n > 0) memInodePut(dropped[--n]);
+}
+
+// Retorna o segmento s da tabela de descritores ou NULL se ainda nao
+// existir. O segmento e' publicado por fdGrow so' depois de inicializado,
+// de modo que pode ser lido sem trava
+static FileDescriptor* fdSegment(unsigned int s) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __atomic_load_n(&fdSegments[s], __ATOMIC_ACQUIRE);
+#else
+	pthread_mutex_lock(&fdTableLock);
+	FileDescriptor *seg = fdSegments[s];
+	pthread_mutex_unlock(&fdTableLock);
+	return seg;
+#endif
+}
+
+// Retorna o descritor de indice idx (numerado a partir de 0) ou NULL se ele
+// estiver alem da tabela. O segmento s comeca no indice
+// FDTABLE_MIN * (2^s - 1)
+static FileDescriptor* fdGet(int idx) {
+	if (idx < 0) return NULL;
+	unsigned int n = (unsigned int)idx / FDTABLE_MIN + 1, s = 0;
+	while (n >> (s + 1)) s++;
+	if (s >= FDTABLE_SEGMENTS) return NULL;
+	FileDescriptor *seg = fdSegment(s);
+	return (seg ? &seg[idx - FDTABLE_MIN * ((1u << s) - 1)] : NULL);
+}
+
+// Acrescenta um segmento a' tabela de descritores, com os novos descritores
+// na lista de livres em ordem crescente. Chamada com fdTableLock. Retorna 0
+// em caso de sucesso ou -1 se a tabela estiver no limite ou sem memoria
+static int fdGrow(void) {
+	unsigned int s = fdNumSegments;
+	if (s >= FDTABLE_SEGMENTS) return -1;
+	unsigned int n = FDTABLE_MIN << s, first = FDTABLE_MIN * ((1u << s) - 1);
+	FileDescriptor *seg = calloc(n, sizeof(FileDescriptor));
+	if (!seg) return -1;
+	for (unsigned int i = n; i > 0; i--) {
+		pthread_rwlock_init(&seg[i - 1].lock, NULL);
+		seg[i - 1].nextFree = fdFreeHead;
+		fdFreeHead = first + i - 1;
+	}
+#if defined(__GNUC__) || defined(__clang__)
+	__atomic_store_n(&fdSegments[s], seg, __ATOMIC_RELEASE);
+#else
+	fdSegments[s] = seg;
+#endif
+	fdNumSegments++;
+	return 0;
+}
+
+// Descarta a tabela de descritores, sem nenhum em uso
+static void fdTableRelease(void) {
+	for (unsigned int s = 0; s < fdNumSegments; s++) {
+		unsigned int n = FDTABLE_MIN << s;
+		for (unsigned int i = 0; i < n; i++)
+			pthread_rwlock_destroy(&fdSegments[s][i].lock);
+		free(fdSegments[s]);
+		fdSegments[s] = NULL;
+	}
+	fdNumSegments = 0;
+	fdFreeHead = -1;
+	fdOpenCount = 0;
+}
+
+// Obtem um descritor livre, do inicio da lista de livres, acrescentando um
+// segmento a' tabela se todos estiverem em uso, e o associa ao arquivo mi,
+// um diretorio se isDir. Retorna o numero do descritor (a partir de 1) ou
+// -1 se nao houver memoria
+static int fdAlloc(MemInode *mi, int isDir) {
+	pthread_mutex_lock(&fdTableLock);
+	if (fdFreeHead < 0 && fdGrow() < 0) {
+		pthread_mutex_unlock(&fdTableLock);
+		return -1;
+	}
+	int idx = fdFreeHead;
+	FileDescriptor *f = fdGet(idx);
+	fdFreeHead = f->nextFree;
+	fdOpenCount++;
+	pthread_mutex_unlock(&fdTableLock);
+
+	pthread_rwlock_wrlock(&f->lock);
+	f->isDir = isDir;
+	f->inumber = mi->inumber;
+	f->cursor = 0;
+	f->dirSkip = 0;
+	f->mi = mi;
+	f->buffered = 0;
+	f->wbufStart = 0;
+	f->wbufLen = 0;
+	f->inUse = 1;
+	pthread_rwlock_unlock(&f->lock);
+	return idx + 1;
+}
+
+// Tira de uso o descritor f, obtido com fdLock, liberando seu buffer de
+// escrita e a sua trava, e o devolve a' lista de livres
+static void fdRelease(FileDescriptor *f, int fd) {
+	f->inUse = 0;
+	f->mi = NULL;
+	free(f->wbuf);
+	f->wbuf = NULL;
+	pthread_rwlock_unlock(&f->lock);
+
+	pthread_mutex_lock(&fdTableLock);
+	f->nextFree = fdFreeHead;
+	fdFreeHead = fd - 1;
+	fdOpenCount--;
+	pthread_mutex_unlock(&fdTableLock);
+}
+
+// Obtem o descritor fd em uso, do tipo kind (FD_FILE, FD_DIR ou FD_ANY),
+// com a sua trava, para escrita se exclusive ou para leitura caso
+// contrario. A trava serializa as operacoes que usam o cursor ou o buffer de
+// escrita do descritor. Retorna NULL, sem trava, se o descritor nao estiver
+// em uso ou for de outro tipo
+static FileDescriptor* fdLock(int fd, int kind, int exclusive) {
+	FileDescriptor *f = (fd > 0 ? fdGet(fd - 1) : NULL);
+	if (!f) return NULL;
+	if (exclusive) pthread_rwlock_wrlock(&f->lock);
+	else pthread_rwlock_rdlock(&f->lock);
+	if (!f->inUse || (kind != FD_ANY && f->isDir != kind)) {
+		pthread_rwlock_unlock(&f->lock);
+		return NULL;
+	}
+	return f;
+}
+
+// Libera a trava de um descritor obtido com fdLock
+static void fdUnlock(FileDescriptor *f) {
+	pthread_rwlock_unlock(&f->lock);
+}
+
+//Funcao para verificacao se o sistema de arquivos está ocioso, ou seja,
+//se nao ha quisquer descritores de arquivos em uso atualmente. Retorna
+//um positivo se ocioso ou, caso contrario, 0.
+int myFSIsIdle (Disk *d) {
+	pthread_mutex_lock(&fdTableLock);
+	int idle = (fdOpenCount == 0);
+	pthread_mutex_unlock(&fdTableLock);
+	pthread_rwlock_rdlock(&mapLock);
+	idle = idle && !mappings;
+	pthread_rwlock_unlock(&mapLock);
+	return idle;
+}
+
+//Funcao para formatacao de um disco com o novo sistema de arquivos
+//com tamanho de blocos igual a blockSize. Retorna o numero total de
+//blocos disponiveis no disco, se formatado com sucesso. Caso contrario,
+//retorna -1.
+int myFSFormat (Disk *d, unsigned int blockSize) {
+	if (!d || blockSize < DISK_SECTORDATASIZE || blockSize > MAX_BLOCKSIZE ||
+	    blockSize % DISK_SECTORDATASIZE != 0) {
+		return -1;
+	}
+	
+	unsigned int totalSectors = diskGetNumSectors(d);
+	unsigned int sectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
+	
+	// Calcular area de i-nodes. O bitmap vem logo depois dela, para que
+	// possa ocupar quantos setores forem necessarios. A area cresce com o
+	// disco: arquivos grandes ocupam muitas extensoes de i-node
+	unsigned int inodeAreaStart = inodeAreaBeginSector();
+	unsigned int inodesPerSector = inodeNumInodesPerSector();
+	unsigned int inodeAreaSectors = totalSectors / INODE_AREA_RATIO;
+	if (inodeAreaSectors < INODE_AREA_SECTORS)
+		inodeAreaSectors = INODE_AREA_SECTORS;
+	unsigned int bitmapStart = inodeAreaStart + inodeAreaSectors;
+	
+	// Estimar numero de blocos
+	unsigned int firstDataSector = bitmapStart + 1;
+	if (totalSectors <= firstDataSector) {
+		return -1;
+	}
+	unsigned int availableDataSectors = totalSectors - firstDataSector;
+	unsigned int totalBlocks = availableDataSectors / sectorsPerBlock;
+	
+	// Calcular tamanho do bitmap
+	unsigned int bitmapSizeBytes = (totalBlocks + 7) / 8;
+	unsigned int bitmapSectors = bytesToSectors(bitmapSizeBytes);
+	
+	// Reajustar firstDataSector
+	firstDataSector = bitmapStart + bitmapSectors;
+	availableDataSectors = totalSectors - firstDataSector;
+	totalBlocks = availableDataSectors / sectorsPerBlock;
+	bitmapSizeBytes = (totalBlocks + 7) / 8;
+	
+	// Criar superbloco
+	Superblock sb;
+	memset(&sb, 0, sizeof(Superblock));
+	sb.magic = MYFS_MAGIC;
+	sb.blockSize = blockSize;
+	sb.totalBlocks = totalBlocks;
+	sb.freeBlocks = totalBlocks;
+	sb.firstDataBlock = firstDataSector;
+	sb.bitmapSectors = bitmapSectors;
+	sb.bitmapStart = bitmapStart;
+	sb.inodeCount = inodeAreaSectors * inodesPerSector;
+	sb.freeInodes = sb.inodeCount - 1;	// Diretorio raiz
+	sb.numFiles = 0;
+	
+	// Escrever superbloco
+	unsigned char sector[DISK_SECTORDATASIZE];
+	memset(sector, 0, DISK_SECTORDATASIZE);
+	memcpy(sector, &sb, sizeof(Superblock));
+	
+	if (diskWriteSector(d, SUPERBLOCK_SECTOR, sector) < 0) {
+		return -1;
+	}
+	
+	// Inicializar bitmap (todos livres)
+	unsigned char *bitmap = calloc(bitmapSizeBytes, 1);
+	if (!bitmap) {
+		return -1;
+	}
+	
+	if (writeBitmap(d, bitmapStart, bitmap, bitmapSizeBytes) < 0) {
+		free(bitmap);
+		return -1;
+	}
+	free(bitmap);
+	
+	// Limpar a area de i-nodes: i-node com numero 0 e' livre
+	memset(sector, 0, DISK_SECTORDATASIZE);
+	for (unsigned int i = 0; i < inodeAreaSectors; i++) {
+		if (diskWriteSector(d, inodeAreaStart + i, sector) < 0) {
+			return -1;
+		}
+	}
+	
+	// Criar o diretorio raiz, vazio
+	Inode *root = inodeCreate(ROOT_INUMBER, d);
+	if (!root) {
+		return -1;
+	}
+	inodeSetFileType(root, FILETYPE_DIR);
+	inodeSetRefCount(root, 1);
+	int ret = inodeSave(root);
+	free(root);
+	if (ret < 0) {
+		return -1;
+	}
+	
+	return totalBlocks;
+}
+
+//Funcao para montagem/desmontagem do sistema de arquivos, se possível.
+//Na montagem (x=1) e' a chance de se fazer inicializacoes, como carregar
+//o superbloco na memoria. Na desmontagem (x=0), quaisquer dados pendentes
+//de gravacao devem ser persistidos no disco. Retorna um positivo se a
+//montagem ou desmontagem foi bem sucedida ou, caso contrario, 0.
+int myFSxMount (Disk *d, int x) {
+	if (x == 1) {
+		// MONTAGEM
+		if (!d || mountedSB != NULL) {
+			return 0;
+		}
+		
+		// Ler superbloco
+		unsigned char sector[DISK_SECTORDATASIZE];
+		if (diskReadSector(d, SUPERBLOCK_SECTOR, sector) < 0) {
+			return 0;
+		}
+		
+		// Alocar e copiar superbloco
+		mountedSB = malloc(sizeof(Superblock));
+		if (!mountedSB) {
+			return 0;
+		}
+		memcpy(mountedSB, sector, sizeof(Superblock));
+		
+		// Validar numero magico e o layout com o bitmap apos os i-nodes.
+		// Volumes formatados antes dele (bitmapStart 0, bitmap no setor 1)
+		// nao sao montados: nao guardam diretorios no disco, de modo que
+		// seus arquivos nao tem nome, nem contadores de i-nodes, e marcam
+		// os i-nodes livres de outra forma. Devem ser reformatados
+		if (mountedSB->magic != MYFS_MAGIC || mountedSB->bitmapStart == 0) {
+			free(mountedSB);
+			mountedSB = NULL;
+			return 0;
+		}
+		
+		// Carregar bitmap de blocos livres
+		if (bitmapLoad(d, mountedSB) < 0) {
+			free(mountedSB);
+			mountedSB = NULL;
+			return 0;
+		}
+		allocHint = 0;
+		freeExtentsBuild(mountedSB);
+		inodeSetNumInodes(mountedSB->inodeCount);
+		sectorsPerCylinder = diskGetNumSectors(d) / diskGetNumCylinders(d);
+		
+		// Inicializar tabela de descritores, alocada sob demanda
+		fdTableRelease();
+		
+		mountedDisk = d;
+		
+		// Abrir o diretorio raiz. Suas entradas sao lidas sob demanda
+		rootDir = memInodeGet(ROOT_INUMBER);
+		if (rootDir && rootDir->type != FILETYPE_DIR) {
+			memInodePut(rootDir);
+			rootDir = NULL;
+		}
+		if (!rootDir || refTableLoad() < 0) {
+			if (rootDir) memInodePut(rootDir);
+			rootDir = NULL;
+			if (refFile) memInodePut(refFile);
+			refFile = NULL;
+			blockRefsRelease();
+			bitmapRelease();
+			inodeSetNumInodes(0);
+			free(mountedSB);
+			mountedSB = NULL;
+			mountedDisk = NULL;
+			return 0;
+		}
+		dirLoadRootNames();
+		return 1;
+		
+	} else {
+		// DESMONTAGEM
+		if (!mountedSB) {
+			return 0;
+		}
+		
+		if (!myFSIsIdle(d)) {
+			return 0;
+		}
+		
+		dirCacheDrop(0);
+		if (myFSSync(d) < 0) {
+			return 0;
+		}
+		// A raiz e a tabela de referencias so' sao liberadas depois da
+		// sincronizacao. memInodePut sempre consome a abertura: se falhar,
+		// o i-node fica em memoria e e' reaberto, e o volume continua
+		// montado
+		int failed = (memInodePut(rootDir) < 0);
+		rootDir = NULL;
+		if (refFile && memInodePut(refFile) < 0) failed = 1;
+		refFile = NULL;
+		if (failed) {
+			rootDir = memInodeGet(ROOT_INUMBER);
+			if (mountedSB->refTableInode != 0)
+				refFile = memInodeGet(mountedSB->refTableInode);
+			return 0;
+		}
+		blockRefsRelease();
+		nameTableClear();
+		bitmapRelease();
+		fdTableRelease();
+		inodeSetNumInodes(0);
+		
+		free(mountedSB);
+		mountedSB = NULL;
+		mountedDisk = NULL;
+		
+		return 1;
+	}
+}
+
+// Retorna o i-node em memoria do diretorio inumber, aberto para a busca ou
+// alteracao de entradas, sem ler o disco se ele ja' estiver aberto. O
+// diretorio passa a ser o usado mais recentemente. Retorna NULL se inumber
+// nao for um diretorio ou em caso de falha
+static MemInode* dirGet(unsigned int inumber) {
+	MemInode *mi = memInodeGet(inumber);
+	if (!mi) return NULL;
+	if (mi->type != FILETYPE_DIR) {
+		memInodePut(mi);
+		return NULL;
+	}
+	dirCacheTouch(mi);
+	return mi;
+}
+
+// Procura name no diretorio dir. A cache de nomes e' consultada antes, e o
+// diretorio so' e' aberto se a resposta nao estiver nela. Retorna o numero
+// do i-node da entrada, com o seu tipo em *type, ou 0 se nao existir
+static unsigned int dirLookup(unsigned int dir, const char *name,
+                              unsigned int *type) {
+	unsigned int inumber;
+	if (dcacheLookup(dir, name, nameHash(name, strlen(name)), &inumber, type))
+		return inumber;
+	MemInode *mi = dirGet(dir);
+	if (!mi) return 0;
+	pthread_rwlock_rdlock(&mi->lock);
+	inumber = dirFind(mi, name, type);
+	pthread_rwlock_unlock(&mi->lock);
+	memInodePut(mi);
+	return inumber;
+}
+
+// Retorna 1 se name puder ser nome de uma entrada de diretorio: nao vazio,
+// sem barras, com no maximo MAX_FILENAME_LENGTH caracteres e diferente de
+// "." e "..". Retorna 0 caso contrario
+static int validName(const char *name) {
+	return (name[0] != '\0' && !strchr(name, '/') &&
+	        strlen(name) <= MAX_FILENAME_LENGTH &&
+	        strcmp(name, ".") != 0 && strcmp(name, "..") != 0);
+}
+
+// Percorre path a partir do diretorio raiz ate' o diretorio que contem o
+// ultimo componente, cujo i-node fica em *parent, e copia o ultimo
+// componente para name (vazio se path indicar o proprio raiz). Componentes
+// "." sao ignorados e ".." nao e' suportado. Os diretorios intermediarios
+// sao resolvidos pela cache de nomes sempre que possivel. Retorna 0 em caso
+// de sucesso ou -1 se o caminho for invalido ou se algum componente
+// intermediario nao existir ou nao for um diretorio
+static int pathWalk(const char *path, unsigned int *parent, char *name) {
+	unsigned int dir = ROOT_INUMBER, type;
+	name[0] = '\0';
+
+	for (;;) {
+		while (*path == '/') path++;
+		if (*path == '\0') break;
+		unsigned int len = strcspn(path, "/");
+		if (len == 1 && path[0] == '.') {
+			path++;
+			continue;
+		}
+		if (len > MAX_FILENAME_LENGTH || (len == 2 && strncmp(path, "..", 2) == 0))
+			return -1;
+		// Ha' um componente depois do anterior: ele e' um diretorio
+		if (name[0] != '\0') {
+			dir = dirLookup(dir, name, &type);
+			if (dir == 0 || type != FILETYPE_DIR) return -1;
+		}
+		memcpy(name, path, len);
+		name[len] = '\0';
+		path += len;
+	}
+	*parent = dir;
+	return 0;
+}
+
+// Abre a entrada name do diretorio dir, com a trava do diretorio obtida, se
+// ela for do tipo type. *exists indica se a entrada existe, de qualquer
+// tipo. Retorna o i-node em memoria do arquivo ou NULL
+static MemInode* dirOpenEntry(MemInode *dir, const char *name,
+                              unsigned int type, int *exists) {
+	unsigned int ftype, inumber = dirFind(dir, name, &ftype);
+	*exists = (inumber != 0);
+	return (inumber != 0 && ftype == type ? memInodeGet(inumber) : NULL);
+}
+
+// Cria um arquivo vazio do tipo type com o nome name no diretorio dir, com
+// a trava do diretorio obtida para escrita. Um diretorio ja' removido nao
+// recebe novas entradas. Retorna o i-node em memoria do arquivo ou NULL em
+// caso de falha
+static MemInode* dirCreateEntry(MemInode *dir, const char *name,
+                                unsigned int type) {
+	if (inodeGetRefCount(dir->inode) == 0) return NULL;
+
+	/* 1. Encontrar e ocupar um inode livre */
+	Inode *inode = inodeCreateFree(1, mountedDisk);
+	if (!inode) return NULL;
+	unsigned int inumber = inodeGetNumber(inode);
+
+	/* 2. Inicialização básica do inode */
+	inodeSetFileType(inode, type);
+	inodeSetFileSize(inode, 0);
+	inodeSetRefCount(inode, 1);      /* link do diretorio */
+
+	/* 3. Registrar no diretório */
+	if (inodeSave(inode) < 0 || dirAdd(dir, name, inumber, type) != 0) {
+		/* rollback simples */
+		inodeFree(inode);
+		free(inode);
+		return NULL;
+	}
+	free(inode);
+	pthread_mutex_lock(&allocLock);
+	if (mountedSB->freeInodes > 0) mountedSB->freeInodes--;
+	mountedSB->numFiles++;
+	pthread_mutex_unlock(&allocLock);
+	return memInodeGet(inumber);
+}
+
+// Abre o arquivo indicado por path, que deve ser do tipo type, criando-o no
+// seu diretorio se nao existir. O caminho "/" corresponde ao diretorio
+// raiz. A busca obtem a trava do diretorio para leitura, de modo que
+// aberturas no mesmo diretorio seguem em paralelo; so' a criacao a obtem
+// para escrita, repetindo a busca, pois outra thread pode ter criado o
+// arquivo no intervalo. Retorna o i-node em memoria do arquivo, com uma
+// abertura a mais, ou NULL em caso de falha
+static MemInode* myFSGetOrCreate(Disk *d, const char *path,
+                                 unsigned int type) {
+	char filename[MAX_FILENAME_LENGTH + 1];
+	unsigned int parent;
+	MemInode *dir, *mi;
+	int exists;
+
+	if (!d || !path || pathWalk(path, &parent, filename) < 0) {
+		return NULL;
+	}
+	if (filename[0] == '\0') {
+		if (type != FILETYPE_DIR) return NULL;
+		memInodeRef(rootDir);
+		return rootDir;
+	}
+	if (!(dir = dirGet(parent))) {
+		return NULL;
+	}
+
+	pthread_rwlock_rdlock(&dir->lock);
+	mi = dirOpenEntry(dir, filename, type, &exists);
+	pthread_rwlock_unlock(&dir->lock);
+	if (!exists) {
+		pthread_rwlock_wrlock(&dir->lock);
+		mi = dirOpenEntry(dir, filename, type, &exists);
+		if (!exists) mi = dirCreateEntry(dir, filename, type);
+		pthread_rwlock_unlock(&dir->lock);
+	}
+
+	if (memInodePut(dir) < 0 && mi) {
+		memInodePut(mi);
+		return NULL;
+	}
+	return mi;
+}
+
+//Funcao para ativar (enable = 1) ou desativar (enable = 0) a alocacao
+//atrasada de blocos nas escritas do MyFS. Com ela ativa, escritas alem dos
+//blocos ja' alocados de um arquivo apenas reservam espaco e mantem os dados
+//em memoria; os blocos sao alocados e gravados no fechamento do arquivo ou
+//na sincronizacao/desmontagem do sistema de arquivos. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int myFSSetDelayedAlloc (Disk *d, int enable) {
+	if (!d) return -1;
+#if defined(__GNUC__) || defined(__clang__)
+	__atomic_store_n(&delayedAlloc, (enable != 0), __ATOMIC_RELAXED);
+#else
+	pthread_mutex_lock(&allocLock);
+	delayedAlloc = (enable != 0);
+	pthread_mutex_unlock(&allocLock);
+#endif
+	return 0;
+}
+
+// Le do arquivo de um i-node em memoria, como memInodeRead, com a trava do
+// i-node obtida para leitura: leituras do mesmo arquivo seguem em paralelo
+static unsigned long long fileRead(MemInode *mi, unsigned long long offset,
+                                   char *buf, unsigned long long nbytes) {
+	pthread_rwlock_rdlock(&mi->lock);
+	unsigned long long ret = memInodeRead(mi, offset, buf, nbytes);
+	pthread_rwlock_unlock(&mi->lock);
+	return ret;
+}
+
+// Escreve no arquivo de um i-node em memoria, como memInodeWrite, com a
+// trava do i-node obtida para escrita
+static unsigned long long fileWrite(MemInode *mi, unsigned long long offset,
+                                    const char *buf,
+                                    unsigned long long nbytes) {
+	pthread_rwlock_wrlock(&mi->lock);
+	unsigned long long ret = memInodeWrite(mi, offset, buf, nbytes);
+	pthread_rwlock_unlock(&mi->lock);
+	return ret;
+}
+
+// Le ate' nbytes do arquivo de um i-node em memoria, a partir de offset,
+// diretamente para os iovcnt trechos de iov, com a trava do i-node obtida
+// para leitura
+static unsigned long long fileReadv(MemInode *mi, unsigned long long offset,
+                                    const FSIovec *iov, unsigned int iovcnt,
+                                    unsigned long long nbytes) {
+	IoCursor c;
+	ioCursorInitv(&c, iov, iovcnt);
+	pthread_rwlock_rdlock(&mi->lock);
+	unsigned long long ret = memInodeReadIo(mi, offset, &c, nbytes);
+	pthread_rwlock_unlock(&mi->lock);
+	return ret;
+}
+
+// Escreve no arquivo de um i-node em memoria os nbytes dos iovcnt trechos
+// de iov, diretamente deles, com a trava do i-node obtida para escrita
+static unsigned long long fileWritev(MemInode *mi, unsigned long long offset,
+                                     const FSIovec *iov, unsigned int iovcnt,
+                                     unsigned long long nbytes) {
+	IoCursor c;
+	ioCursorInitv(&c, iov, iovcnt);
+	pthread_rwlock_wrlock(&mi->lock);
+	unsigned long long ret = memInodeWriteIo(mi, offset, &c, nbytes);
+	pthread_rwlock_unlock(&mi->lock);
+	return ret;
+}
+
+// Grava no arquivo os dados acumulados no buffer de escrita de um
+// descritor, obtido com fdLock para escrita. Retorna 0 em caso de sucesso ou
+// -1 caso contrario; em ambos os casos o buffer fica vazio
+static int fdFlushWrites(FileDescriptor *f) {
+	unsigned int len = f->wbufLen;
+	if (len == 0) return 0;
+	f->wbufLen = 0;
+	return (fileWrite(f->mi, f->wbufStart, (const char *)f->wbuf, len)
+	        == len ? 0 : -1);
+}
+
+// Acumula no buffer de escrita de um descritor os nbytes de buf, a serem
+// gravados na posicao do cursor. O buffer e' gravado ao completar um bloco
+// do arquivo, de modo que escritas pequenas e sequenciais resultem em uma
+// gravacao por bloco. Retorna nbytes em caso de sucesso ou -1 caso contrario
+static int fdBufferWrite(FileDescriptor *f, const char *buf,
+                         unsigned int nbytes) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned int done = 0;
+
+	// Uma escrita que nao continua a anterior descarrega o buffer
+	if (f->wbufLen > 0 && f->cursor != f->wbufStart + f->wbufLen &&
+	    fdFlushWrites(f) < 0)
+		return -1;
+	if (!f->wbuf && !(f->wbuf = malloc(blockSize))) return -1;
+	if (f->wbufLen == 0) f->wbufStart = f->cursor;
+
+	while (done < nbytes) {
+		unsigned long long end = f->wbufStart + f->wbufLen;
+		unsigned int chunk = blockSize - end % blockSize;
+		if (chunk > nbytes - done) chunk = nbytes - done;
+		memcpy(f->wbuf + f->wbufLen, buf + done, chunk);
+		f->wbufLen += chunk;
+		done += chunk;
+		if ((end + chunk) % blockSize == 0) {
+			if (fdFlushWrites(f) < 0) return -1;
+			f->wbufStart = end + chunk;
+		}
+	}
+	f->cursor += nbytes;
+	return nbytes;
+}
+
+//Funcao para abertura de um arquivo, a partir do caminho especificado
+//em path, no disco montado especificado em d, no modo Read/Write,
+//criando o arquivo se nao existir. Retorna um descritor de arquivo,
+//em caso de sucesso. Retorna -1, caso contrario.
+int myFSOpen(Disk *d, const char *path) {
+	if (!mountedSB || d != mountedDisk || !path || strlen(path) == 0) {
+		return -1;
+	}
+
+	MemInode *mi = myFSGetOrCreate(d, path, FILETYPE_REGULAR);
+	if (!mi) {
+		return -1;
+	}
+
+	int fd = fdAlloc(mi, 0);
+	if (fd < 0) {
+		memInodePut(mi);
+		return -1;
+	}
+	return fd;
+}
+	
+//Funcao para a leitura de um arquivo, como myFSRead, mas com tamanho e
+//retorno de 64 bits, para transferencias de mais de 2 GB de uma vez.
+//Retorna o numero de bytes efetivamente lidos em caso de sucesso ou -1,
+//caso contrario.
+long long myFSRead64 (int fd, char *buf, unsigned long long nbytes) {
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	long long ret = 0;
+	if (!f) return -1;
+	if (nbytes > LLONG_MAX) nbytes = LLONG_MAX;
+	if (buf && nbytes > 0) {
+		if (fdFlushWrites(f) < 0) ret = -1;
+		else {
+			ret = (long long)fileRead(f->mi, f->cursor, buf, nbytes);
+			f->cursor += ret;
+		}
+	}
+	fdUnlock(f);
+	return ret;
+}
+
+//Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
+//existente. Os dados devem ser lidos a partir da posicao atual do cursor
+//e copiados para buf. Terao tamanho maximo de nbytes. Ao fim, o cursor
+//deve ter posicao atualizada para que a proxima operacao ocorra a partir
+//do próximo byte apos o ultimo lido. Retorna o numero de bytes
+//efetivamente lidos em caso de sucesso ou -1, caso contrario.
+int myFSRead (int fd, char *buf, unsigned int nbytes) {
+	if (nbytes > INT_MAX) nbytes = INT_MAX;
+	return (int)myFSRead64(fd, buf, nbytes);
+}
+
+//Funcao para a escrita de um arquivo, como myFSWrite, mas com tamanho e
+//retorno de 64 bits, para transferencias de mais de 2 GB de uma vez. A
+//escrita para no maior tamanho de arquivo suportado. Retorna o numero de
+//bytes efetivamente escritos em caso de sucesso ou -1, caso contrario
+long long myFSWrite64 (int fd, const char *buf, unsigned long long nbytes) {
+    FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+    long long ret = -1;
+
+    if (!f) return -1;
+    if (nbytes > LLONG_MAX) nbytes = LLONG_MAX;
+    if (!buf || nbytes == 0) ret = 0;
+    else if (f->cursor >= maxFileSize()) ret = -1;
+    // Escritas menores que um bloco vao para o buffer do descritor, se ativo
+    else if (f->buffered && nbytes < mountedSB->blockSize &&
+             f->cursor + nbytes <= maxFileSize())
+        ret = fdBufferWrite(f, buf, (unsigned int)nbytes);
+    else if (fdFlushWrites(f) == 0) {
+        ret = (long long)fileWrite(f->mi, f->cursor, buf, nbytes);
+        f->cursor += ret;
+    }
+    fdUnlock(f);
+    return ret;
+}
+
+//Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
+//existente. Os dados de buf sao copiados para o disco a partir da posição
+//atual do cursor e terao tamanho maximo de nbytes. Ao fim, o cursor deve
+//ter posicao atualizada para que a proxima operacao ocorra a partir do
+//proximo byte apos o ultimo escrito. Retorna o numero de bytes
+//efetivamente escritos em caso de sucesso ou -1, caso contrario
+int myFSWrite (int fd, const char *buf, unsigned int nbytes) {
+    if (nbytes > INT_MAX) nbytes = INT_MAX;
+    return (int)myFSWrite64(fd, buf, nbytes);
+}
+
+// Soma os tamanhos dos iovcnt trechos de iov. Retorna -1 se algum trecho
+// nao tiver endereco ou se a soma nao couber no retorno de readv/writev
+static int iovTotal(const FSIovec *iov, unsigned int iovcnt) {
+	unsigned int total = 0;
+	if (!iov && iovcnt > 0) return -1;
+	for (unsigned int i = 0; i < iovcnt; i++) {
+		if (iov[i].len == 0) continue;
+		if (!iov[i].base || iov[i].len > INT_MAX - total) return -1;
+		total += iov[i].len;
+	}
+	return total;
+}
+
+//Funcao para a leitura vetorizada de um arquivo, a partir de um descritor de
+//arquivo existente. Os dados a partir do cursor sao lidos em uma unica
+//passagem pelos blocos, diretamente para os iovcnt trechos de iov, em
+//sequencia, sem buffer intermediario. Retorna o numero total de bytes
+//efetivamente lidos em caso de sucesso ou -1, caso contrario.
+int myFSReadv (int fd, const FSIovec *iov, unsigned int iovcnt) {
+	int total = iovTotal(iov, iovcnt);
+	if (total < 0) return -1;
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) return -1;
+	int ret = 0;
+	if (total > 0 && fdFlushWrites(f) < 0) ret = -1;
+	else if (total > 0) {
+		ret = (int)fileReadv(f->mi, f->cursor, iov, iovcnt, total);
+		f->cursor += ret;
+	}
+	fdUnlock(f);
+	return ret;
+}
+
+//Funcao para a escrita vetorizada de um arquivo, a partir de um descritor de
+//arquivo existente. Os iovcnt trechos de iov sao escritos em sequencia a
+//partir do cursor como uma unica escrita, diretamente deles, sem buffer
+//intermediario: uma passagem pelos blocos, uma alocacao e uma atualizacao do
+//i-node. Retorna o numero total de bytes efetivamente escritos em caso de
+//sucesso ou -1, caso contrario.
+int myFSWritev (int fd, const FSIovec *iov, unsigned int iovcnt) {
+	int total = iovTotal(iov, iovcnt);
+	if (total < 0) return -1;
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) return -1;
+	int ret = total;
+
+	// Com o buffer do descritor ativo, os trechos de uma escrita pequena
+	// sao acumulados nele diretamente
+	if (total > 0 && f->buffered &&
+	    (unsigned int)total < mountedSB->blockSize) {
+		for (unsigned int i = 0; i < iovcnt && ret >= 0; i++)
+			if (iov[i].len > 0 &&
+			    fdBufferWrite(f, iov[i].base, iov[i].len) < 0)
+				ret = -1;
+	}
+	else if (total > 0) {
+		if (fdFlushWrites(f) < 0) ret = -1;
+		else {
+			ret = (int)fileWritev(f->mi, f->cursor, iov, iovcnt, total);
+			f->cursor += ret;
+		}
+	}
+	fdUnlock(f);
+	return ret;
+}
+
+// Obtem o descritor fd de um arquivo para uma operacao em posicao dada
+// (pread/pwrite), que nao usa o cursor: a trava do descritor e' obtida para
+// leitura, de modo que essas operacoes seguem em paralelo. Se o buffer de
+// escrita tiver dados, ele e' antes gravado, com a trava para escrita, que
+// e' mantida. *ret fica com -1 se a gravacao falhar. Retorna NULL se o
+// descritor nao estiver em uso
+static FileDescriptor* fdLockAt(int fd, int *ret) {
+	FileDescriptor *f = fdLock(fd, FD_FILE, 0);
+	*ret = 0;
+	if (f && f->wbufLen > 0) {
+		fdUnlock(f);
+		if ((f = fdLock(fd, FD_FILE, 1)) != NULL) *ret = fdFlushWrites(f);
+	}
+	return f;
+}
+
+//Funcao para a leitura de um arquivo a partir da posicao offset, como
+//myFSPread, mas com posicao, tamanho e retorno de 64 bits. Retorna o numero
+//de bytes efetivamente lidos em caso de sucesso ou -1, caso contrario.
+long long myFSPread64 (int fd, char *buf, unsigned long long nbytes,
+                       unsigned long long offset) {
+	int ret;
+	FileDescriptor *f = fdLockAt(fd, &ret);
+	if (!f) return -1;
+	if (nbytes > LLONG_MAX) nbytes = LLONG_MAX;
+	long long readBytes = (ret < 0 ? -1 : 0);
+	if (ret == 0 && buf && nbytes > 0)
+		readBytes = (long long)fileRead(f->mi, offset, buf, nbytes);
+	fdUnlock(f);
+	return readBytes;
+}
+
+//Funcao para a leitura de um arquivo a partir da posicao offset, dada na
+//chamada, e nao do cursor do descritor de arquivo existente, que nao e'
+//alterado. Assim, varios leitores podem compartilhar um descritor, inclusive
+//em paralelo. Retorna o numero de bytes efetivamente lidos em caso de
+//sucesso ou -1, caso contrario.
+int myFSPread (int fd, char *buf, unsigned int nbytes, unsigned int offset) {
+	if (nbytes > INT_MAX) nbytes = INT_MAX;
+	return (int)myFSPread64(fd, buf, nbytes, offset);
+}
+
+//Funcao para a escrita de um arquivo a partir da posicao offset, como
+//myFSPwrite, mas com posicao, tamanho e retorno de 64 bits. Retorna o numero
+//de bytes efetivamente escritos em caso de sucesso ou -1, caso contrario
+long long myFSPwrite64 (int fd, const char *buf, unsigned long long nbytes,
+                        unsigned long long offset) {
+	int ret;
+	FileDescriptor *f = fdLockAt(fd, &ret);
+	if (!f) return -1;
+	if (nbytes > LLONG_MAX) nbytes = LLONG_MAX;
+	long long written = (ret < 0 ? -1 : 0);
+	if (ret == 0 && buf && nbytes > 0)
+		written = (offset >= maxFileSize() ? -1 :
+		           (long long)fileWrite(f->mi, offset, buf, nbytes));
+	fdUnlock(f);
+	return written;
+}
+
+//Funcao para a escrita de um arquivo a partir da posicao offset, dada na
+//chamada, e nao do cursor do descritor de arquivo existente, que nao e'
+//alterado. Um offset alem do fim do arquivo deixa um buraco antes dos
+//dados escritos. Retorna o numero de bytes efetivamente escritos em caso de
+//sucesso ou -1, caso contrario
+int myFSPwrite (int fd, const char *buf, unsigned int nbytes,
+                unsigned int offset) {
+	if (nbytes > INT_MAX) nbytes = INT_MAX;
+	return (int)myFSPwrite64(fd, buf, nbytes, offset);
+}
+
+// Reposiciona o cursor do descritor fd, como em myFSLseek, desde que a nova
+// posicao nao passe de max; caso contrario, o cursor fica onde estava.
+// Retorna a nova posicao ou -1 em caso de falha
+static long long fdSeek(int fd, long long offset, int whence, long long max) {
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) return -1;
+	if (fdFlushWrites(f) < 0) {
+		fdUnlock(f);
+		return -1;
+	}
+
+	long long base, pos = -1;
+	pthread_rwlock_rdlock(&f->mi->lock);
+	unsigned long long fileSize = inodeGetFileSize(f->mi->inode);
+	switch (whence) {
+		case VFS_SEEK_SET: base = 0; break;
+		case VFS_SEEK_CUR: base = (long long)f->cursor; break;
+		case VFS_SEEK_END: base = (long long)fileSize; break;
+		case VFS_SEEK_DATA:
+		case VFS_SEEK_HOLE:
+			base = -1;
+			if (offset >= 0 && (unsigned long long)offset < fileSize)
+				base = memInodeSeekData(f->mi, offset,
+				                        whence == VFS_SEEK_DATA);
+			offset = 0;
+			break;
+		default: base = -1; break;
+	}
+	pthread_rwlock_unlock(&f->mi->lock);
+	if (base >= 0 && !(offset > 0 && base > LLONG_MAX - offset)) {
+		pos = base + offset;
+		if (pos < 0 || pos > max) pos = -1;
+		else f->cursor = (unsigned long long)pos;
+	}
+	fdUnlock(f);
+	return pos;
+}
+
+//Funcao para reposicionar o cursor de um descritor de arquivo existente, como
+//myFSLseek, mas com posicao e retorno de 64 bits. Retorna a nova posicao do
+//cursor em caso de sucesso ou -1, caso contrario.
+long long myFSLseek64 (int fd, long long offset, int whence) {
+	return fdSeek(fd, offset, whence, LLONG_MAX);
+}
+
+//Funcao para reposicionar o cursor de um descritor de arquivo existente em
+//offset bytes a partir do inicio (VFS_SEEK_SET), da posicao atual
+//(VFS_SEEK_CUR) ou do fim do arquivo (VFS_SEEK_END). A nova posicao pode
+//passar do fim; uma escrita ali deixa um buraco. Com VFS_SEEK_DATA e
+//VFS_SEEK_HOLE, o cursor vai para o primeiro byte com dados ou de buraco a
+//partir de offset (o fim do arquivo conta como buraco). Retorna a nova
+//posicao do cursor em caso de sucesso ou -1, caso contrario (inclusive se
+//nao houver dados a partir de offset).
+int myFSLseek (int fd, int offset, int whence) {
+	return (int)fdSeek(fd, offset, whence, INT_MAX);
+}
+
+//Funcao para ativar (enable = 1) ou desativar (enable = 0) o buffer de
+//escrita de um descritor de arquivo existente. Com ele ativo, escritas
+//menores que um bloco sao acumuladas em memoria e gravadas ao completar um
+//bloco, ao mudar de posicao, em leituras pelo mesmo descritor, no flush e
+//no fechamento; ate' la', outros descritores do arquivo nao as enxergam.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int myFSSetBuffered (int fd, int enable) {
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) return -1;
+
+	int ret = 0;
+	if (!enable) {
+		ret = fdFlushWrites(f);
+		free(f->wbuf);
+		f->wbuf = NULL;
+	}
+	f->buffered = (enable != 0);
+	fdUnlock(f);
+	return ret;
+}
+
+//Funcao para gravar no arquivo os dados acumulados no buffer de escrita de
+//um descritor de arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario.
+int myFSFlush (int fd) {
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) return -1;
+	int ret = fdFlushWrites(f);
+	fdUnlock(f);
+	return ret;
+}
+
+// Retorna o bit b de um mapa de bits de um mapeamento
+static int mapBitGet(const unsigned char *bits, unsigned int b) {
+	return (bits[b / 8] >> (b % 8)) & 1;
+}
+
+// Liga (set = 1) ou desliga (set = 0) os count bits de um mapa de bits de um
+// mapeamento a partir do bit b
+static void mapBitsSet(unsigned char *bits, unsigned int b, unsigned int count,
+                       int set) {
+	for (unsigned int i = b; i < b + count; i++) {
+		if (set) bits[i / 8] |= (unsigned char)(1u << (i % 8));
+		else bits[i / 8] &= (unsigned char)~(1u << (i % 8));
+	}
+}
+
+// Traz para a memoria os blocos first a last de um mapeamento, com a sua
+// trava obtida. Cada sequencia de blocos ausentes e' lida do arquivo de uma
+// vez, e a leitura continua pela janela de leitura antecipada depois de
+// last, ate' o fim do mapeamento ou o primeiro bloco ja' presente. A janela
+// dobra quando o acesso continua a leitura anterior, ate' MAP_READAHEAD_MAX
+// blocos, e volta a MAP_READAHEAD_MIN nos demais. O que estiver alem do fim
+// do arquivo fica com zeros. So' os blocos de fato lidos passam a presentes;
+// uma falha de leitura encerra a leitura antecipada. Retorna 0 se os blocos
+// first a last estiverem presentes ou -1 caso contrario
+static int mapRegionFault(MapRegion *m, unsigned int first, unsigned int last) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned int numBlocks = (unsigned int)(m->length / blockSize);
+	unsigned int b = first;
+
+	while (b <= last && mapBitGet(m->present, b)) b++;
+	if (b > last) return 0;
+	if (b != m->raNext) m->raBlocks = MAP_READAHEAD_MIN;
+	else if (m->raBlocks < MAP_READAHEAD_MAX) m->raBlocks *= 2;
+	unsigned int end = (numBlocks - last - 1 > m->raBlocks
+	                    ? last + 1 + m->raBlocks : numBlocks);
+
+	while (b < end) {
+		if (mapBitGet(m->present, b)) {
+			if (b > last) break;
+			b++;
+			continue;
+		}
+		unsigned int run = 1;
+		while (b + run < end && !mapBitGet(m->present, b + run)) run++;
+		// Alem do fim do arquivo nao ha' o que ler; o restante fica zerado
+		unsigned long long pos = m->offset + (unsigned long long)b * blockSize;
+		unsigned long long len = (unsigned long long)run * blockSize;
+		pthread_rwlock_rdlock(&m->mi->lock);
+		unsigned long long fileSize = inodeGetFileSize(m->mi->inode);
+		unsigned long long expected = (pos >= fileSize ? 0 :
+		                               fileSize - pos < len ? fileSize - pos
+		                                                    : len);
+		unsigned long long got = memInodeRead(m->mi, pos,
+		                                      (char *)m->data
+		                                      + (unsigned long long)b * blockSize,
+		                                      expected);
+		pthread_rwlock_unlock(&m->mi->lock);
+		if (got < expected) {
+			mapBitsSet(m->present, b, (unsigned int)(got / blockSize), 1);
+			b += (unsigned int)(got / blockSize);
+			m->raNext = b;
+			return (b > last ? 0 : -1);
+		}
+		mapBitsSet(m->present, b, run, 1);
+		b += run;
+	}
+	m->raNext = b;
+	return 0;
+}
+
+// Grava no arquivo os blocos de um mapeamento, entre os indices first e
+// last (relativos ao mapeamento), marcados como alterados, e os marca como
+// gravados. Blocos alterados consecutivos sao gravados juntos; nada e'
+// gravado alem do fim do arquivo. Obtem a trava do mapeamento e a do
+// arquivo, para escrita. Retorna 0 em caso de sucesso ou -1 caso contrario
+static int mapRegionSync(MapRegion *m, unsigned int first, unsigned int last) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned int b = first;
+	int ret = 0;
+
+	pthread_mutex_lock(&m->lock);
+	pthread_rwlock_wrlock(&m->mi->lock);
+	while (b <= last) {
+		if (!mapBitGet(m->dirty, b)) {
+			b++;
+			continue;
+		}
+		unsigned int run = 1;
+		while (b + run <= last && mapBitGet(m->dirty, b + run))
+			run++;
+		unsigned long long pos = m->offset + (unsigned long long)b * blockSize;
+		unsigned long long fileSize = inodeGetFileSize(m->mi->inode);
+		unsigned long long len = (pos < fileSize ? fileSize - pos : 0);
+		if (len > (unsigned long long)run * blockSize)
+			len = (unsigned long long)run * blockSize;
+		if (len > 0 &&
+		    memInodeWrite(m->mi, pos, (const char *)m->data
+		                  + (unsigned long long)b * blockSize,
+		                  len) != len) {
+			ret = -1;
+			break;
+		}
+		mapBitsSet(m->dirty, b, run, 0);
+		b += run;
+	}
+	pthread_rwlock_unlock(&m->mi->lock);
+	pthread_mutex_unlock(&m->lock);
+	return ret;
+}
+
+// Grava os trechos alterados dos mapeamentos do arquivo mi, ou de todos os
+// arquivos se mi for NULL. Retorna 0 em caso de sucesso ou -1 caso
+// contrario
+static int mapRegionsSync(MemInode *mi) {
+	int ret = 0;
+	pthread_rwlock_rdlock(&mapLock);
+	for (MapRegion *m = mappings; m; m = m->next)
+		if ((!mi || m->mi == mi) && m->dirty &&
+		    mapRegionSync(m, 0, (unsigned int)(m->length
+		                                        / mountedSB->blockSize) - 1) < 0)
+			ret = -1;
+	pthread_rwlock_unlock(&mapLock);
+	return ret;
+}
+
+//Funcao para persistir no disco os dados e metadados de um arquivo, a partir
+//de um descritor de arquivo existente: o buffer de escrita do descritor, os
+//trechos alterados de seus mapeamentos, os dados com alocacao atrasada, o
+//i-node e a tabela de referencias, o bitmap de blocos e o superbloco, que
+//registram os blocos alocados. Ate' la', essas alteracoes ficam em memoria (write-back).
+//Retorna 0 caso bem sucedido, ou -1 caso contrario
+int myFSFsync (int fd) {
+	FileDescriptor *f = fdLock(fd, FD_ANY, 1);
+	if (!f) return -1;
+
+	MemInode *mi = f->mi;
+	int ret = fdFlushWrites(f);
+	if (ret == 0) ret = mapRegionsSync(mi);
+	if (ret == 0) {
+		pthread_rwlock_wrlock(&mi->lock);
+		ret = memInodeSync(mi);
+		pthread_rwlock_unlock(&mi->lock);
+	}
+	fdUnlock(f);
+	if (ret < 0) return -1;
+
+	pthread_mutex_lock(&syncLock);
+	ret = metaSync();
+	pthread_mutex_unlock(&syncLock);
+	return ret;
+}
+
+//Funcao para persistir no disco todas as alteracoes mantidas em memoria pelo
+//sistema de arquivos montado em d: buffers de escrita dos descritores,
+//mapeamentos em memoria, dados com alocacao atrasada, i-nodes dos arquivos
+//abertos, bitmap e superbloco. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario
+int myFSSyncfs (Disk *d) {
+	int ret = 0;
+	if (!mountedSB || d != mountedDisk) return -1;
+	for (unsigned int s = 0; s < FDTABLE_SEGMENTS; s++) {
+		FileDescriptor *seg = fdSegment(s);
+		if (!seg) break;
+		unsigned int n = FDTABLE_MIN << s;
+		for (unsigned int i = 0; i < n; i++) {
+			pthread_rwlock_wrlock(&seg[i].lock);
+			if (seg[i].inUse && fdFlushWrites(&seg[i]) < 0) ret = -1;
+			pthread_rwlock_unlock(&seg[i].lock);
+		}
+	}
+	if (ret < 0 || mapRegionsSync(NULL) < 0) return -1;
+	return myFSSync(d);
+}
+
+//Funcao para mapear em memoria length bytes de um arquivo, com posicao e
+//tamanho de 64 bits, a partir da posicao offset (multipla do tamanho de
+//bloco), a partir de um descritor de arquivo existente. O tamanho e'
+//limitado pelo espaco de enderecamento. Nada e' lido do arquivo no
+//mapeamento: os blocos sao trazidos para a memoria sob demanda, em
+//myFSMfault, com leitura antecipada.
+//Com prot incluindo VFS_PROT_WRITE, os blocos declarados como alterados em
+//myFSMfault sao gravados no arquivo em myFSMsync e myFSMunmap, sem
+//aumenta'-lo. Um bloco nao enxerga escritas feitas pelos descritores depois
+//de trazido para a memoria, e o mapeamento continua valido depois que o
+//descritor e' fechado. Retorna o endereco do trecho mapeado, ou NULL caso
+//contrario
+void* myFSMmap64 (int fd, unsigned long long offset, unsigned long long length,
+                  int prot) {
+	unsigned int blockSize = mountedSB ? mountedSB->blockSize : 0;
+	if (!mountedSB || length == 0 || offset % blockSize != 0) return NULL;
+	if (length > ULLONG_MAX - blockSize + 1 || offset + length < offset)
+		return NULL;
+	length = (length + blockSize - 1) / blockSize * blockSize;
+	if (length > SIZE_MAX || length / blockSize > UINT_MAX) return NULL;
+	size_t bitmapBytes = (size_t)(length / blockSize + 7) / 8;
+
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) return NULL;
+	// O espaco dos dados e' zerado sob demanda pelo sistema (calloc), de modo
+	// que os blocos nunca acessados nao ocupam memoria
+	MapRegion *m = calloc(1, sizeof(MapRegion));
+	void *addr = NULL;
+	if (m) m->data = calloc(1, (size_t)length);
+	if (m) m->present = calloc(1, bitmapBytes);
+	if (m && (prot & VFS_PROT_WRITE)) m->dirty = calloc(1, bitmapBytes);
+	if (!m || !m->data || !m->present ||
+	    ((prot & VFS_PROT_WRITE) && !m->dirty) || fdFlushWrites(f) < 0) {
+		if (m) {
+			free(m->data);
+			free(m->present);
+			free(m->dirty);
+			free(m);
+		}
+		fdUnlock(f);
+		return NULL;
+	}
+
+	m->mi = f->mi;
+	memInodeRef(m->mi);
+	m->offset = offset;
+	m->length = length;
+	m->prot = prot;
+	m->raNext = 0;
+	m->raBlocks = MAP_READAHEAD_MIN;
+	pthread_mutex_init(&m->lock, NULL);
+	addr = m->data;
+	pthread_rwlock_wrlock(&mapLock);
+	m->next = mappings;
+	mappings = m;
+	pthread_rwlock_unlock(&mapLock);
+	fdUnlock(f);
+	return addr;
+}
+
+//Funcao para mapear em memoria length bytes de um arquivo, a partir da
+//posicao offset (multipla do tamanho de bloco), a partir de um descritor de
+//arquivo existente, como myFSMmap64. Retorna o endereco do trecho mapeado,
+//ou NULL caso contrario
+void* myFSMmap (int fd, unsigned int offset, unsigned int length, int prot) {
+	return myFSMmap64(fd, offset, length, prot);
+}
+
+
+//Funcao para trazer para a memoria os blocos de um trecho mapeado, entre
+//addr e addr + length, contido em um mapeamento de myFSMmap, antes de
+//acessa-los. Os blocos ausentes sao lidos do arquivo, com leitura
+//antecipada dos seguintes; os ja' presentes nao custam E/S. Com prot
+//incluindo VFS_PROT_WRITE, os blocos sao marcados como alterados, para
+//gravacao em myFSMsync ou myFSMunmap. Retorna 0 caso bem sucedido, ou -1
+//caso contrario, inclusive se a leitura do disco falhar: os blocos nao lidos
+//continuam ausentes e sao lidos de novo no proximo acesso
+int myFSMfault (void *addr, unsigned int length, int prot) {
+	unsigned char *p = addr;
+	MapRegion *m;
+	int ret = -1;
+	if (!mountedSB || !p) return -1;
+	pthread_rwlock_rdlock(&mapLock);
+	for (m = mappings; m; m = m->next)
+		if (p >= m->data && p < m->data + m->length) break;
+	if (m && length == 0) ret = 0;
+	else if (m && (!(prot & VFS_PROT_WRITE) || m->dirty)) {
+		unsigned int blockSize = mountedSB->blockSize;
+		unsigned long long start = p - m->data;
+		unsigned long long end = (length > m->length - start ? m->length
+		                                                     : start + length);
+		unsigned int first = (unsigned int)(start / blockSize);
+		unsigned int last = (unsigned int)((end - 1) / blockSize);
+		pthread_mutex_lock(&m->lock);
+		ret = mapRegionFault(m, first, last);
+		if (ret == 0 && (prot & VFS_PROT_WRITE))
+			mapBitsSet(m->dirty, first, last - first + 1, 1);
+		pthread_mutex_unlock(&m->lock);
+	}
+	pthread_rwlock_unlock(&mapLock);
+	return ret;
+}
+
+//Funcao para gravar no arquivo os blocos alterados de um trecho mapeado em
+//memoria, entre addr e addr + length, contido em um mapeamento de
+//myFSMmap. Apenas os blocos marcados como alterados em myFSMfault desde a
+//ultima gravacao sao escritos; alteracoes posteriores precisam ser
+//marcadas de novo. Retorna 0 caso bem sucedido, ou -1 caso contrario
+int myFSMsync (void *addr, unsigned int length) {
+	unsigned char *p = addr;
+	MapRegion *m;
+	int ret = -1;
+	if (!mountedSB || !p) return -1;
+	pthread_rwlock_rdlock(&mapLock);
+	for (m = mappings; m; m = m->next)
+		if (p >= m->data && p < m->data + m->length) break;
+	if (m && (!m->dirty || length == 0)) ret = 0;
+	else if (m) {
+		unsigned int blockSize = mountedSB->blockSize;
+		unsigned long long start = p - m->data;
+		unsigned long long end = (length > m->length - start ? m->length
+		                                                     : start + length);
+		ret = mapRegionSync(m, (unsigned int)(start / blockSize),
+		                    (unsigned int)((end - 1) / blockSize));
+	}
+	pthread_rwlock_unlock(&mapLock);
+	return ret;
+}
+
+//Funcao para desfazer um mapeamento de myFSMmap, a partir do endereco
+//retornado por ele, gravando antes os blocos alterados. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int myFSMunmap (void *addr) {
+	MapRegion **prev = &mappings, *m;
+	if (!mountedSB || !addr) return -1;
+	pthread_rwlock_wrlock(&mapLock);
+	while (*prev && (*prev)->data != addr) prev = &(*prev)->next;
+	if ((m = *prev) != NULL) *prev = m->next;
+	pthread_rwlock_unlock(&mapLock);
+	if (!m) return -1;
+
+	int ret = 0;
+	if (m->dirty &&
+	    mapRegionSync(m, 0, (unsigned int)(m->length
+	                                       / mountedSB->blockSize) - 1) < 0)
+		ret = -1;
+	if (memInodePut(m->mi) < 0) ret = -1;
+	pthread_mutex_destroy(&m->lock);
+	free(m->data);
+	free(m->present);
+	free(m->dirty);
+	free(m);
+	return ret;
+}
+
+// Pre-aloca os blocos que cobrem os length bytes a partir de offset do
+// arquivo de um i-node em memoria, com a sua trava obtida para escrita.
+// Retorna 0 em caso de sucesso ou -1 caso contrario
+static int memInodeAllocRange(MemInode *mi, unsigned long long offset,
+                              unsigned long long length) {
+	// Dados com alocacao atrasada recebem seus blocos antes da pre-alocacao
+	if (memInodeFlushDelayed(mi) < 0) return -1;
+
+	// Buracos dentro do arquivo sao lidos como zeros e precisam continuar
+	// assim depois de ganhar blocos
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned long long fileSize = inodeGetFileSize(mi->inode);
+	unsigned int firstBlock = (unsigned int)(offset / blockSize);
+	unsigned int lastBlock = (unsigned int)((offset + length - 1) / blockSize);
+	for (unsigned int b = firstBlock;
+	     b <= lastBlock && (unsigned long long)b * blockSize < fileSize; b++) {
+		if (memInodeBlockAddr(mi, b) != 0) continue;
+		if (allocFileBlocks(mi, b, b) < 0) return -1;
+		unsigned long long start = (unsigned long long)b * blockSize;
+		unsigned long long end = start + blockSize;
+		if (memInodeZero(mi, start, (end < fileSize ? end : fileSize),
+		                 start) < 0)
+			return -1;
+	}
+	return allocFileBlocks(mi, firstBlock, lastBlock);
+}
+
+//Funcao para pre-alocacao de espaco para um arquivo, como myFSFallocate, mas
+//com posicao e tamanho de 64 bits. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario
+int myFSFallocate64 (int fd, unsigned long long offset,
+                     unsigned long long length) {
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) return -1;
+	int ret = 0;
+	if (length > 0 &&
+	    (offset >= maxFileSize() || length > maxFileSize() - offset))
+		ret = -1;
+	else if (length > 0 && (ret = fdFlushWrites(f)) == 0) {
+		pthread_rwlock_wrlock(&f->mi->lock);
+		ret = memInodeAllocRange(f->mi, offset, length);
+		pthread_rwlock_unlock(&f->mi->lock);
+	}
+	fdUnlock(f);
+	return ret;
+}
+
+//Funcao para pre-alocacao de espaco para um arquivo, a partir de um
+//descritor de arquivo existente. Garante que os blocos que cobrem os
+//length bytes a partir de offset estejam alocados, em sequencias contiguas
+//sempre que possivel. O tamanho do arquivo nao e' alterado. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario
+int myFSFallocate (int fd, unsigned int offset, unsigned int length) {
+	return myFSFallocate64(fd, offset, length);
+}
+
+//Funcao para alterar o tamanho de um arquivo, como myFSTruncate, mas com
+//tamanho de 64 bits, ate' o maior tamanho de arquivo suportado. Retorna 0
+//caso bem sucedido, ou -1 caso contrario
+int myFSTruncate64 (int fd, unsigned long long length) {
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) return -1;
+	int ret = (length > maxFileSize() ? -1 : fdFlushWrites(f));
+	if (ret < 0) {
+		fdUnlock(f);
+		return -1;
+	}
+
+	MemInode *mi = f->mi;
+	pthread_rwlock_wrlock(&mi->lock);
+	unsigned long long fileSize = inodeGetFileSize(mi->inode);
+	if (length > fileSize) {
+		// O aumento e' um buraco: so' blocos ja' alocados alem do fim
+		// precisam ser zerados
+		ret = memInodeZero(mi, fileSize, length, fileSize);
+	}
+	else ret = memInodeTruncate(mi, length);
+	if (ret == 0) {
+		inodeSetFileSize(mi->inode, length);
+		mi->dirty = 1;
+	}
+	pthread_rwlock_unlock(&mi->lock);
+	fdUnlock(f);
+	return ret;
+}
+
+//Funcao para alterar o tamanho de um arquivo para length bytes, a partir de
+//um descritor de arquivo existente. Na reducao, os blocos e extensoes do
+//i-node alem do novo fim sao liberados de uma vez. No aumento, o trecho novo
+//e' um buraco, lido como zeros, sem ocupar blocos. O cursor nao e' alterado. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int myFSTruncate (int fd, unsigned int length) {
+	return myFSTruncate64(fd, length);
+}
+
+// Torna o arquivo mi um clone do arquivo smi, com as travas dos dois
+// obtidas para escrita. Retorna 0 em caso de sucesso ou -1 caso contrario
+static int memInodeClone(MemInode *mi, MemInode *smi) {
+	if (memInodeFlushDelayed(smi) < 0) return -1;
+	if (memInodeTruncate(mi, 0) < 0) return -1;
+	inodeSetFileSize(mi->inode, 0);
+	mi->dirty = 1;
+
+	// As referencias do clone sao contadas antes de os enderecos entrarem
+	// no i-node, para que uma falha apenas as devolva
+	unsigned int n = smi->numBlocks, i;
+	if (memInodeMapReserve(mi, n) < 0) return -1;
+	memcpy(mi->blocks + mi->numBlocks, smi->blocks, n * sizeof(unsigned int));
+	pthread_mutex_lock(&allocLock);
+	for (i = 0; i < n; i++) {
+		unsigned int addr = smi->blocks[i];
+		if (addr != INODE_HOLE && blockRefsSet(addr, blockRefs(addr) + 1) < 0)
+			break;
+	}
+	pthread_mutex_unlock(&allocLock);
+	int added = (i == n ? memInodeMapCommit(mi, n) : -1);
+	if (added < 0 || (unsigned int)added < n) {
+		unsigned int counted = i;
+		pthread_mutex_lock(&allocLock);
+		for (i = (added > 0 ? added : 0); i < counted; i++) {
+			unsigned int addr = smi->blocks[i];
+			if (addr != INODE_HOLE) blockRefsSet(addr, blockRefs(addr) - 1);
+		}
+		pthread_mutex_unlock(&allocLock);
+		memInodeTruncate(mi, 0);
+		return -1;
+	}
+	inodeSetFileSize(mi->inode, inodeGetFileSize(smi->inode));
+	return 0;
+}
+
+//Funcao para tornar o arquivo do descritor fd um clone do arquivo do
+//descritor srcFd, ambos existentes: o conteudo anterior de fd e' descartado
+//e os dois arquivos passam a compartilhar os blocos de dados de srcFd, sem
+//copia-los. Cada bloco compartilhado ganha uma referencia e so' e' copiado
+//quando um dos arquivos o altera (copy-on-write). Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int myFSClone (int fd, int srcFd) {
+	// Os descritores e os i-nodes sao travados sempre em ordem crescente,
+	// para que clones cruzados em paralelo nao se bloqueiem
+	if (fd == srcFd) return -1;
+	FileDescriptor *lo = fdLock(fd < srcFd ? fd : srcFd, FD_FILE, 1);
+	FileDescriptor *hi = (lo ? fdLock(fd < srcFd ? srcFd : fd, FD_FILE, 1)
+	                         : NULL);
+	if (!hi) {
+		if (lo) fdUnlock(lo);
+		return -1;
+	}
+	FileDescriptor *f = (fd < srcFd ? lo : hi), *sf = (fd < srcFd ? hi : lo);
+	MemInode *mi = f->mi, *smi = sf->mi;
+	int ret = -1;
+
+	// Os dados pendentes da origem precisam estar em blocos
+	if (mi != smi && fdFlushWrites(f) == 0 && fdFlushWrites(sf) == 0) {
+		MemInode *first = (mi->inumber < smi->inumber ? mi : smi);
+		MemInode *second = (first == mi ? smi : mi);
+		pthread_rwlock_wrlock(&first->lock);
+		pthread_rwlock_wrlock(&second->lock);
+		ret = memInodeClone(mi, smi);
+		pthread_rwlock_unlock(&second->lock);
+		pthread_rwlock_unlock(&first->lock);
+	}
+	fdUnlock(hi);
+	fdUnlock(lo);
+	return ret;
+}
+
+//Funcao para criar o arquivo indicado por path, no disco montado d, como
+//clone do arquivo do descritor srcFd: o novo arquivo tem i-node proprio e
+//compartilha os blocos de dados de srcFd, sem copia-los, ate' que um dos
+//dois os altere (copy-on-write). path nao pode existir e os diretorios
+//intermediarios precisam existir. Retorna um descritor do novo arquivo em
+//caso de sucesso ou -1 caso contrario
+int myFSCloneFile (Disk *d, int srcFd, const char *path) {
+	char filename[MAX_FILENAME_LENGTH + 1];
+	unsigned int parent, type;
+	MemInode *dir, *mi = NULL;
+	int ret = -1;
+
+	if (!mountedSB || d != mountedDisk || !path ||
+	    pathWalk(path, &parent, filename) < 0 || filename[0] == '\0') {
+		return -1;
+	}
+	FileDescriptor *sf = fdLock(srcFd, FD_FILE, 1);
+	if (!sf) return -1;
+	// Os dados pendentes da origem precisam estar em blocos
+	if (fdFlushWrites(sf) < 0 || !(dir = dirGet(parent))) {
+		fdUnlock(sf);
+		return -1;
+	}
+	MemInode *smi = sf->mi;
+
+	// O novo i-node e' clonado antes de receber o nome, com a trava do
+	// diretorio mantida, para que nenhuma busca o encontre pela metade
+	pthread_rwlock_wrlock(&dir->lock);
+	Inode *inode = NULL;
+	if (inodeGetRefCount(dir->inode) != 0 &&
+	    dirFind(dir, filename, &type) == 0 &&
+	    (inode = inodeCreateFree(1, mountedDisk)) != NULL) {
+		unsigned int inumber = inodeGetNumber(inode);
+		inodeSetFileType(inode, FILETYPE_REGULAR);
+		inodeSetFileSize(inode, 0);
+		inodeSetRefCount(inode, 1);
+		if (inodeSave(inode) < 0) inodeFree(inode);
+		else {
+			pthread_mutex_lock(&allocLock);
+			if (mountedSB->freeInodes > 0) mountedSB->freeInodes--;
+			mountedSB->numFiles++;
+			pthread_mutex_unlock(&allocLock);
+			mi = memInodeGet(inumber);
+		}
+		free(inode);
+	}
+	if (mi) {
+		MemInode *first = (mi->inumber < smi->inumber ? mi : smi);
+		MemInode *second = (first == mi ? smi : mi);
+		pthread_rwlock_wrlock(&first->lock);
+		pthread_rwlock_wrlock(&second->lock);
+		ret = memInodeClone(mi, smi);
+		if (ret == 0 &&
+		    dirAdd(dir, filename, mi->inumber, FILETYPE_REGULAR) != 0)
+			ret = -1;
+		// Sem nome, o novo arquivo e' apagado ao ser fechado abaixo
+		if (ret < 0) {
+			inodeSetRefCount(mi->inode, 0);
+			mi->dirty = 1;
+		}
+		pthread_rwlock_unlock(&second->lock);
+		pthread_rwlock_unlock(&first->lock);
+	}
+	pthread_rwlock_unlock(&dir->lock);
+	fdUnlock(sf);
+
+	if (memInodePut(dir) < 0) ret = -1;
+	if (!mi) return -1;
+	int fd = (ret == 0 ? fdAlloc(mi, 0) : -1);
+	if (fd < 0) memInodePut(mi);
+	return fd;
+}
+
+//Funcao para fechar um arquivo, a partir de um descritor de arquivo
+//existente. Retorna 0 caso bem sucedido, ou -1 caso contrario
+int myFSClose(int fd) {
+	FileDescriptor *f = fdLock(fd, FD_FILE, 1);
+	if (!f) {
+		return -1;
+	}
+
+	// Na ultima abertura do arquivo, suas pendencias sao gravadas
+	int ret = fdFlushWrites(f);
+	MemInode *mi = f->mi;
+	fdRelease(f, fd);
+	if (memInodePut(mi) < 0) ret = -1;
+	return ret;
+}
+
+//Funcao para abertura de um diretorio, a partir do caminho especificado
+//em path, no disco montado especificado em d, criando o diretorio se nao
+//existir. Os diretorios intermediarios precisam existir. Retorna um
+//descritor de arquivo, em caso de sucesso. Retorna -1, caso contrario.
+int myFSOpendir (Disk *d, const char *path) {
+	if (!mountedSB || d != mountedDisk || !path) return -1;
+
+	MemInode *mi = myFSGetOrCreate(d, path, FILETYPE_DIR);
+	if (!mi) return -1;
+
+	int fd = fdAlloc(mi, 1);
+	if (fd < 0) memInodePut(mi);
+	return fd;
+}
+
+// Le ate' max entradas do diretorio aberto em f a partir do cursor, em ordem
+// de hash, percorrendo a cadeia das folhas a partir da que cobre o cursor.
+// O cursor guarda o hash da ultima entrada lida (e quantas entradas com esse
+// hash ja' foram lidas), o que mantem a posicao mesmo com divisoes de
+// folhas. Em entries sao preenchidos o nome, o i-node e o tipo. Chamada com
+// a trava do diretorio obtida para leitura. Retorna o numero de entradas
+// lidas ou -1 em caso de falha
+static int dirReadEntries(FileDescriptor *f, FSDirEntry *entries,
+                          unsigned int max) {
+	unsigned int blockSize = mountedSB->blockSize;
+	unsigned int numBlocks = inodeGetFileSize(f->mi->inode) / blockSize;
+	unsigned char *block;
+	unsigned int count = 0;
+	DirPath path;
+	DirEntry e;
+
+	if (numBlocks == 0 || max == 0) return 0;
+	if (!(block = malloc(blockSize))) return -1;
+	if (dirFindLeaf(f->mi, f->cursor, &path, block, 0) < 0 ||
+	    dirReadBlock(f->mi, path.leaf, block) < 0) {
+		free(block);
+		return -1;
+	}
+	for (unsigned int n = 0; count < max && n < numBlocks; n++) {
+		unsigned int seen = 0;
+		for (unsigned int p = DIRLEAF_HEADER;
+		     count < max && p + DIRENT_HEADER <= blockSize; p += e.recLen) {
+			direntDecode(block + p, &e);
+			if (e.recLen < DIRENT_HEADER || p + e.recLen > blockSize) break;
+			if (e.inumber == 0) continue;
+			// Ja' lidas: as de hash menor e as primeiras de hash igual
+			unsigned int h = nameHash((const char *)e.name, e.nameLen);
+			if (h < f->cursor) continue;
+			if (h == f->cursor && seen < f->dirSkip) {
+				seen++;
+				continue;
+			}
+			FSDirEntry *out = &entries[count++];
+			memcpy(out->name, e.name, e.nameLen);
+			out->name[e.nameLen] = '\0';
+			out->inumber = e.inumber;
+			out->fileType = e.type;
+			if (h != f->cursor) {
+				f->cursor = h;
+				f->dirSkip = 0;
+				seen = 0;
+			}
+			f->dirSkip++;
+			seen++;
+		}
+		if (count < max && dirNextLeaf(f->mi, block) == 0) break;
+	}
+	free(block);
+	return (int)count;
+}
+
+//Funcao para a leitura de um diretorio, identificado por um descritor de
+//arquivo existente. As entradas sao lidas em ordem de hash, percorrendo a
+//cadeia das folhas a partir da que cobre o cursor; o cursor guarda o hash
+//da ultima entrada lida, o que mantem a posicao mesmo com divisoes de
+//folhas. O nome da entrada e' copiado para filename e seu i-node para
+//inumber. Retorna 1 se uma entrada foi lida, 0 se fim do diretorio ou -1
+//caso mal sucedido.
+int myFSReaddir (int fd, char *filename, unsigned int *inumber) {
+	if (!filename || !inumber) return -1;
+	FileDescriptor *f = fdLock(fd, FD_DIR, 1);
+	if (!f) return -1;
+
+	FSDirEntry entry;
+	pthread_rwlock_rdlock(&f->mi->lock);
+	int ret = dirReadEntries(f, &entry, 1);
+	pthread_rwlock_unlock(&f->mi->lock);
+	fdUnlock(f);
+	if (ret == 1) {
+		strcpy(filename, entry.name);
+		*inumber = entry.inumber;
+	}
+	return ret;
+}
+
+// Preenche os atributos de entry a partir do i-node inode
+static void direntFillAttrs(FSDirEntry *entry, Inode *inode) {
+	entry->fileType = inodeGetFileType(inode);
+	entry->fileSize = inodeGetFileSize(inode);
+	entry->refCount = inodeGetRefCount(inode);
+	entry->owner = inodeGetOwner(inode);
+	entry->permission = inodeGetPermission(inode);
+}
+
+//Funcao para a leitura de um lote de ate' max entradas de um diretorio,
+//identificado por um descritor de arquivo existente, junto com os atributos
+//dos seus i-nodes. As entradas sao lidas como em myFSReaddir. Os atributos
+//de arquivos abertos vem do i-node em memoria; os demais i-nodes sao
+//carregados juntos, em ordem de setor, lendo cada setor da area de i-nodes
+//uma unica vez. Retorna o numero de entradas lidas, 0 se fim do diretorio
+//ou -1 caso mal sucedido.
+int myFSReaddirPlus (int fd, FSDirEntry *entries, unsigned int max) {
+	if (!entries) return -1;
+	FileDescriptor *f = fdLock(fd, FD_DIR, 1);
+	if (!f) return -1;
+	pthread_rwlock_rdlock(&f->mi->lock);
+	int count = dirReadEntries(f, entries, max);
+	pthread_rwlock_unlock(&f->mi->lock);
+	fdUnlock(f);
+	if (count <= 0) return count;
+
+	unsigned int *numbers = malloc(count * sizeof(unsigned int));
+	Inode **loaded = malloc(count * sizeof(Inode *));
+	if (!numbers || !loaded) {
+		free(numbers);
+		free(loaded);
+		return -1;
+	}
+	// Arquivos abertos ja' tem o i-node em memoria, possivelmente mais
+	// recente que o do disco, lido com a sua trava; os demais sao
+	// carregados juntos
+	for (int k = 0; k < count; k++) {
+		pthread_mutex_lock(&memInodesLock);
+		MemInode *mi = memInodeFind(entries[k].inumber);
+		pthread_mutex_unlock(&memInodesLock);
+		numbers[k] = (mi ? 0 : entries[k].inumber);
+		if (!mi) continue;
+		pthread_rwlock_rdlock(&mi->lock);
+		direntFillAttrs(&entries[k], mi->inode);
+		pthread_rwlock_unlock(&mi->lock);
+		memInodePut(mi);
+	}
+	inodeLoadMany(numbers, loaded, count, mountedDisk);
+
+	int ret = count;
+	for (int k = 0; k < count; k++) {
+		if (numbers[k] == 0) continue;
+		if (!loaded[k] || inodeGetNumber(loaded[k]) != entries[k].inumber)
+			ret = -1;
+		else direntFillAttrs(&entries[k], loaded[k]);
+	}
+	for (int k = 0; k < count; k++) free(loaded[k]);
+	free(loaded);
+	free(numbers);
+	return ret;
+}
+
+//Funcao para adicionar uma entrada a um diretorio, identificado por um
+//descritor de arquivo existente. A nova entrada tera' o nome indicado por
+//filename e apontara' para o i-node inumber, que deve ser de um arquivo
+//regular existente (diretorios nao recebem links adicionais). O contador
+//de links do i-node e' incrementado. Retorna 0 caso bem sucedido, ou -1
+//caso contrario.
+int myFSLink (int fd, const char *filename, unsigned int inumber) {
+	if (!filename || !validName(filename)) return -1;
+	FileDescriptor *f = fdLock(fd, FD_DIR, 0);
+	if (!f) return -1;
+
+	// O i-node em memoria e' o mesmo dos descritores abertos sobre o arquivo,
+	// que pode ter perdido o ultimo link depois de aberto. Ele so' e' travado
+	// depois de conferido que e' um arquivo regular, e nao outro diretorio
+	MemInode *dir = f->mi, *mi = NULL;
+	unsigned int type;
+	int ret = -1;
+	pthread_rwlock_wrlock(&dir->lock);
+	// Um diretorio ja' removido nao recebe novas entradas
+	if (inodeGetRefCount(dir->inode) != 0 &&
+	    dirFind(dir, filename, &type) == 0 &&
+	    (mi = memInodeGet(inumber)) != NULL && mi->type == FILETYPE_REGULAR) {
+		pthread_rwlock_wrlock(&mi->lock);
+		if (inodeGetRefCount(mi->inode) != 0 &&
+		    dirAdd(dir, filename, inumber, FILETYPE_REGULAR) == 0) {
+			inodeSetRefCount(mi->inode, inodeGetRefCount(mi->inode) + 1);
+			mi->dirty = 1;
+			ret = 0;
+		}
+		pthread_rwlock_unlock(&mi->lock);
+	}
+	pthread_rwlock_unlock(&dir->lock);
+	fdUnlock(f);
+	if (mi && memInodePut(mi) < 0) ret = -1;
+	return ret;
+}
+
+//Funcao para remover uma entrada existente em um diretorio, identificado
+//por um descritor de arquivo existente. A entrada e' identificada pelo nome
+//indicado em filename. O contador de links do i-node e' decrementado e, ao
+//chegar a 0, o arquivo e' apagado: seus blocos sao liberados de uma so' vez
+//no bitmap e seu i-node e extensoes ficam livres. Se o arquivo estiver
+//aberto, a liberacao ocorre no seu ultimo fechamento. Um diretorio so' pode
+//ser removido se estiver vazio. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario.
+int myFSUnlink (int fd, const char *filename) {
+	if (!filename) return -1;
+	FileDescriptor *f = fdLock(fd, FD_DIR, 0);
+	if (!f) return -1;
+
+	// O i-node em memoria e' o mesmo dos descritores abertos sobre o arquivo.
+	// O diretorio pai e' travado antes do filho: a arvore nao tem ciclos
+	MemInode *dir = f->mi, *mi = NULL;
+	unsigned int type;
+	int ret = -1;
+	pthread_rwlock_wrlock(&dir->lock);
+	unsigned int inumber = dirFind(dir, filename, &type);
+	if (inumber != 0 && (mi = memInodeGet(inumber)) != NULL && mi != dir) {
+		// Um diretorio vazio fica travado ate' perder o link, para que nao
+		// receba entradas no intervalo
+		pthread_rwlock_wrlock(&mi->lock);
+		if ((type != FILETYPE_DIR || dirIsEmpty(mi)) &&
+		    dirRemove(dir, filename) == inumber) {
+			if (type == FILETYPE_DIR) dcachePurge(inumber);
+			unsigned int refs = inodeGetRefCount(mi->inode);
+			inodeSetRefCount(mi->inode, (refs > 0 ? refs - 1 : 0));
+			mi->dirty = 1;
+			ret = 0;
+		}
+		pthread_rwlock_unlock(&mi->lock);
+	}
+	pthread_rwlock_unlock(&dir->lock);
+	fdUnlock(f);
+	if (ret == 0 && type == FILETYPE_DIR) dirCacheDrop(inumber);
+	if (mi && memInodePut(mi) < 0) ret = -1;
+	return ret;
+}
+
+//Funcao para fechar um diretorio, identificado por um descritor de arquivo
+//existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int myFSClosedir (int fd) {
+	FileDescriptor *f = fdLock(fd, FD_DIR, 1);
+	if (!f) return -1;
+
+	MemInode *mi = f->mi;
+	fdRelease(f, fd);
+	return memInodePut(mi);
+}
 
+//Funcao para obtencao das estatisticas de ocupacao do sistema de arquivos
+//montado no disco d, copiadas para st. Os contadores sao mantidos no
+//superbloco em memoria, sem varrer o bitmap ou os i-nodes. Blocos reservados
+//pela alocacao atrasada nao contam como livres. Retorna 0 caso bem sucedido,
+//ou -1 caso contrario.
+int myFSStatfs (Disk *d, FSStat *st) {
+	if (!mountedSB || d != mountedDisk || !st) return -1;
+	pthread_mutex_lock(&allocLock);
+	st->blockSize = mountedSB->blockSize;
+	st->totalBlocks = mountedSB->totalBlocks;
+	st->freeBlocks = mountedSB->freeBlocks - reservedBlocks;
+	st->totalInodes = mountedSB->inodeCount;
+	st->freeInodes = mountedSB->freeInodes;
+	st->numFiles = mountedSB->numFiles;
+	pthread_mutex_unlock(&allocLock);
 	return 0;
 }
 
@@ -536,7 +4862,7 @@ int myFSClose(int fd) {
 //o sistema de arquivos tenha sido registrado com sucesso.
 //Caso contrario, retorna -1
 int installMyFS (void) {
-	FSInfo *fsInfo = malloc(sizeof(FSInfo));
+	FSInfo *fsInfo = calloc(1, sizeof(FSInfo));
 	if (!fsInfo) {
 		return -1;
 	}
@@ -551,6 +4877,39 @@ int installMyFS (void) {
 	fsInfo->readFn = myFSRead;
 	fsInfo->writeFn = myFSWrite;
 	fsInfo->closeFn = myFSClose;
+	fsInfo->opendirFn = myFSOpendir;
+	fsInfo->readdirFn = myFSReaddir;
+	fsInfo->linkFn = myFSLink;
+	fsInfo->unlinkFn = myFSUnlink;
+	fsInfo->closedirFn = myFSClosedir;
+	fsInfo->fallocateFn = myFSFallocate;
+	fsInfo->statfsFn = myFSStatfs;
+	fsInfo->truncateFn = myFSTruncate;
+	fsInfo->readdirplusFn = myFSReaddirPlus;
+	fsInfo->preadFn = myFSPread;
+	fsInfo->pwriteFn = myFSPwrite;
+	fsInfo->lseekFn = myFSLseek;
+	fsInfo->setbufferedFn = myFSSetBuffered;
+	fsInfo->flushFn = myFSFlush;
+	fsInfo->fsyncFn = myFSFsync;
+	fsInfo->syncfsFn = myFSSyncfs;
+	fsInfo->mmapFn = myFSMmap;
+	fsInfo->msyncFn = myFSMsync;
+	fsInfo->munmapFn = myFSMunmap;
+	fsInfo->readvFn = myFSReadv;
+	fsInfo->writevFn = myFSWritev;
+	fsInfo->cloneFn = myFSClone;
+	fsInfo->read64Fn = myFSRead64;
+	fsInfo->write64Fn = myFSWrite64;
+	fsInfo->pread64Fn = myFSPread64;
+	fsInfo->pwrite64Fn = myFSPwrite64;
+	fsInfo->lseek64Fn = myFSLseek64;
+	fsInfo->truncate64Fn = myFSTruncate64;
+	fsInfo->fallocate64Fn = myFSFallocate64;
+	fsInfo->delayedallocFn = myFSSetDelayedAlloc;
+	fsInfo->clonefileFn = myFSCloneFile;
+	fsInfo->mfaultFn = myFSMfault;
+	fsInfo->mmap64Fn = myFSMmap64;
 	
 	if (vfsRegisterFS(fsInfo) < 0) {
 		free(fsInfo);
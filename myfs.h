@@ -20,4 +20,12 @@
 //Caso contrario, retorna -1
 int installMyFS ( void );
 
+//Funcao para ativar (enable = 1) ou desativar (enable = 0) a alocacao
+//atrasada de blocos nas escritas do MyFS. Com ela ativa, escritas alem dos
+//blocos ja' alocados de um arquivo apenas reservam espaco e mantem os dados
+//em memoria; os blocos sao alocados e gravados no fechamento do arquivo ou
+//na sincronizacao/desmontagem do sistema de arquivos. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario
+int myFSSetDelayedAlloc (Disk *d, int enable);
+
 #endif
@@ -30,5 +30,5 @@ void ul2char (unsigned int ui, unsigned char *c) {
 void char2ul (unsigned char *c, unsigned int *ui) {
 	*ui = 0;
 	for (int i = 0; i < sizeof (unsigned int); i++)
-		*ui = *ui + (c[i] << (i*8));
+		*ui = *ui + ((unsigned int) c[i] << (i*8));
 }
@@ -10,7 +10,9 @@
 *
 */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <pthread.h>
 #include "vfs.h"
 #include "inode.h"
 
@@ -20,6 +22,24 @@ FSInfo* installedFSInfo[MAX_INSTALLED_FS];
 Disk* rootDisk;
 FSInfo* rootFS;
 
+//Trava da montagem: as chamadas sobre o sistema de arquivos raiz a obtem
+//para leitura, e seguem em paralelo; a montagem, a desmontagem e o registro
+//de sistemas de arquivos, para escrita. A sincronizacao entre as chamadas
+//fica a cargo de cada sistema de arquivos
+static pthread_rwlock_t mountLock = PTHREAD_RWLOCK_INITIALIZER;
+
+//Funcao interna que obtem a trava da montagem para leitura. Retorna o
+//sistema de arquivos raiz ou NULL se nao houver um montado; em ambos os
+//casos, a trava deve ser liberada com __vfsLeave
+static FSInfo* __vfsEnter ( void ) {
+        pthread_rwlock_rdlock (&mountLock);
+        return ( rootDisk ? rootFS : NULL );
+}
+
+static void __vfsLeave ( void ) {
+        pthread_rwlock_unlock (&mountLock);
+}
+
 //Funcao interna para a obtencao do FSInfo correspondente a um fsId
 FSInfo* __vfsGetFSInfo (char fsId) {
         FSInfo *fsInfo = NULL;
@@ -44,24 +64,35 @@ void vfsInit ( void ) {
 //Funcao para a montagem do sistema de arquivos que sera' a raiz da arvore
 //unica do sistema (Unix-like). Retorna 0 caso bem sucedido e -1 em contrario
 int vfsMountRoot (Disk *d, char fsId) {
+	int ret = -1;
 	if ( !d ) return -1;
-	rootFS = __vfsGetFSInfo (fsId);
-	if ( !rootFS ) return -1;
-	if ( !rootFS->xMountFn (d, 1) ) return -1;
-	rootDisk = d;
-	return 0;
+	pthread_rwlock_wrlock (&mountLock);
+	if ( !rootDisk ) {
+		rootFS = __vfsGetFSInfo (fsId);
+		if ( rootFS && rootFS->xMountFn (d, 1) ) {
+			rootDisk = d;
+			ret = 0;
+		}
+		else rootFS = NULL;
+	}
+	pthread_rwlock_unlock (&mountLock);
+	return ret;
 }
 
 //Funcao para a desmontagem do sistema de arquivos. Nao podem haver arquivos
 //ou diretorios abertos para a desmontagem. Retorna 0 caso bem sucedido e -1
 //caso contrario
 int vfsUnmountRoot ( void ) {
-	if ( !rootDisk || !rootFS ) return -1;
-	if ( !rootFS->isidleFn (rootDisk) ) return -1;
-	if ( !rootFS->xMountFn (rootDisk, 0) ) return -1;
-	rootFS = NULL;
-	rootDisk = NULL;
-	return 0;
+	int ret = -1;
+	pthread_rwlock_wrlock (&mountLock);
+	if ( rootDisk && rootFS && rootFS->isidleFn (rootDisk) &&
+	     rootFS->xMountFn (rootDisk, 0) ) {
+		rootFS = NULL;
+		rootDisk = NULL;
+		ret = 0;
+	}
+	pthread_rwlock_unlock (&mountLock);
+	return ret;
 }
 
 //Funcao para formatacao de um disco com o sistema de arquivos indicado pelo
@@ -70,10 +101,13 @@ int vfsUnmountRoot ( void ) {
 //formatado com sucesso. Caso contrario, retorna -1.
 int vfsFormat (Disk *d, unsigned int blockSize, char fsId) {
 	FSInfo *fsInfo = NULL;
+	int ret = -1;
 	if ( !d ) return -1;
+	pthread_rwlock_rdlock (&mountLock);
 	fsInfo = __vfsGetFSInfo (fsId);
-	if ( !fsInfo ) return -1;
-	return fsInfo->formatFn (d, blockSize);
+	if ( fsInfo ) ret = fsInfo->formatFn (d, blockSize);
+	pthread_rwlock_unlock (&mountLock);
+	return ret;
 }
 
 //Funcao para abertura de um arquivo, a partir do caminho especificado em path,
@@ -81,8 +115,10 @@ int vfsFormat (Disk *d, unsigned int blockSize, char fsId) {
 //arquivo, em caso de sucesso. Retorna -1, caso contrario.
 //Descritores de arquivo se iniciam em 1
 int vfsOpen (const char *path) {
-	if ( !rootDisk || !rootFS ) return -1;
-	return rootFS->openFn (rootDisk, path);
+	FSInfo *fs = __vfsEnter ();
+	int ret = ( fs && fs->openFn ? fs->openFn (rootDisk, path) : -1 );
+	__vfsLeave ();
+	return ret;
 }
 
 //Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
@@ -90,8 +126,10 @@ int vfsOpen (const char *path) {
 //nbytes. Retorna o numero de bytes efetivamente lidos em caso de sucesso ou
 //-1, caso contrario.
 int vfsRead (int fd, char *buf, unsigned int nbytes) {
-	if ( !rootDisk || !rootFS ) return -1;
-	return rootFS->readFn (fd, buf, nbytes);
+	FSInfo *fs = __vfsEnter ();
+	int ret = ( fs && fs->readFn ? fs->readFn (fd, buf, nbytes) : -1 );
+	__vfsLeave ();
+	return ret;
 }
 
 //Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
@@ -99,23 +137,282 @@ int vfsRead (int fd, char *buf, unsigned int nbytes) {
 //maximo de nbytes. Retorna o numero de bytes efetivamente escritos em caso
 //de sucesso ou -1, caso contrario
 int vfsWrite (int fd, const char *buf, unsigned int nbytes) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->writeFn (fd, buf, nbytes);
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->writeFn ? fs->writeFn (fd, buf, nbytes) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a leitura de um arquivo, como vfsRead, mas com tamanho e retorno
+//de 64 bits: uma unica chamada pode ler mais de 2 GB. Retorna o numero de
+//bytes efetivamente lidos em caso de sucesso ou -1, caso contrario
+//(inclusive se o sistema de arquivos nao suportar arquivos grandes).
+long long vfsRead64 (int fd, char *buf, unsigned long long nbytes) {
+        FSInfo *fs = __vfsEnter ();
+        long long ret = ( fs && fs->read64Fn ? fs->read64Fn (fd, buf, nbytes) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a escrita de um arquivo, como vfsWrite, mas com tamanho e
+//retorno de 64 bits: uma unica chamada pode escrever mais de 2 GB. Retorna o
+//numero de bytes efetivamente escritos em caso de sucesso ou -1, caso
+//contrario (inclusive se o sistema de arquivos nao suportar arquivos
+//grandes).
+long long vfsWrite64 (int fd, const char *buf, unsigned long long nbytes) {
+        FSInfo *fs = __vfsEnter ();
+        long long ret = ( fs && fs->write64Fn ? fs->write64Fn (fd, buf, nbytes) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a leitura vetorizada de um arquivo, a partir de um descritor de
+//arquivo existente: os dados a partir do cursor preenchem em sequencia os
+//iovcnt trechos de iov, como em uma unica leitura, e o cursor avanca. Retorna
+//o numero total de bytes efetivamente lidos em caso de sucesso ou -1, caso
+//contrario.
+int vfsReadv (int fd, const FSIovec *iov, unsigned int iovcnt) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->readvFn ? fs->readvFn (fd, iov, iovcnt) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a escrita vetorizada de um arquivo, a partir de um descritor de
+//arquivo existente: os iovcnt trechos de iov sao escritos em sequencia a
+//partir do cursor, como em uma unica escrita, e o cursor avanca. Retorna o
+//numero total de bytes efetivamente escritos em caso de sucesso ou -1, caso
+//contrario.
+int vfsWritev (int fd, const FSIovec *iov, unsigned int iovcnt) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->writevFn ? fs->writevFn (fd, iov, iovcnt) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a leitura de um arquivo a partir da posicao offset, dada na
+//chamada, e nao do cursor do descritor de arquivo existente, que nao e'
+//alterado. Os dados lidos sao copiados para buf e terao tamanho maximo de
+//nbytes. Retorna o numero de bytes efetivamente lidos em caso de sucesso ou
+//-1, caso contrario.
+int vfsPread (int fd, char *buf, unsigned int nbytes, unsigned int offset) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->preadFn ? fs->preadFn (fd, buf, nbytes, offset) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a escrita de um arquivo a partir da posicao offset, dada na
+//chamada, e nao do cursor do descritor de arquivo existente, que nao e'
+//alterado. Os dados de buf serao copiados para o disco e terao tamanho maximo
+//de nbytes. Retorna o numero de bytes efetivamente escritos em caso de
+//sucesso ou -1, caso contrario
+int vfsPwrite (int fd, const char *buf, unsigned int nbytes,
+               unsigned int offset) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->pwriteFn ? fs->pwriteFn (fd, buf, nbytes, offset) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para reposicionar o cursor de um descritor de arquivo existente em
+//offset bytes a partir do inicio (VFS_SEEK_SET), da posicao atual
+//(VFS_SEEK_CUR) ou do fim do arquivo (VFS_SEEK_END), ou na primeira posicao
+//com dados (VFS_SEEK_DATA) ou em buraco (VFS_SEEK_HOLE) a partir de offset.
+//Retorna a nova posicao do cursor em caso de sucesso ou -1, caso contrario.
+int vfsLseek (int fd, int offset, int whence) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->lseekFn ? fs->lseekFn (fd, offset, whence) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcoes para a leitura e a escrita de um arquivo a partir da posicao offset,
+//como vfsPread e vfsPwrite, mas com posicao, tamanho e retorno de 64 bits,
+//para arquivos maiores que 4 GB. Retornam o numero de bytes efetivamente
+//lidos/escritos em caso de sucesso ou -1, caso contrario (inclusive se o
+//sistema de arquivos nao suportar arquivos grandes).
+long long vfsPread64 (int fd, char *buf, unsigned long long nbytes,
+                      unsigned long long offset) {
+        FSInfo *fs = __vfsEnter ();
+        long long ret = ( fs && fs->pread64Fn ? fs->pread64Fn (fd, buf, nbytes, offset) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+long long vfsPwrite64 (int fd, const char *buf, unsigned long long nbytes,
+                       unsigned long long offset) {
+        FSInfo *fs = __vfsEnter ();
+        long long ret = ( fs && fs->pwrite64Fn ? fs->pwrite64Fn (fd, buf, nbytes, offset) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para reposicionar o cursor de um descritor de arquivo existente, como
+//vfsLseek, mas com posicao e retorno de 64 bits. Retorna a nova posicao do
+//cursor em caso de sucesso ou -1, caso contrario (inclusive se o sistema de
+//arquivos nao suportar arquivos grandes).
+long long vfsLseek64 (int fd, long long offset, int whence) {
+        FSInfo *fs = __vfsEnter ();
+        long long ret = ( fs && fs->lseek64Fn ? fs->lseek64Fn (fd, offset, whence) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para ativar (enable = 1) ou desativar (enable = 0) o buffer de escrita
+//de um descritor de arquivo existente. Com ele ativo, escritas pequenas e
+//sequenciais sao acumuladas em memoria e gravadas por bloco; os dados
+//pendentes sao gravados ao completar um bloco, ao reposicionar o cursor, em
+//leituras pelo mesmo descritor, em vfsFlush e no fechamento. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario (inclusive se o sistema de arquivos nao
+//suportar o buffer).
+int vfsSetBuffered (int fd, int enable) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->setbufferedFn ? fs->setbufferedFn (fd, enable) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para gravar os dados pendentes no buffer de escrita de um descritor
+//de arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsFlush (int fd) {
+        FSInfo *fs = __vfsEnter ();
+        //Sem buffer de escrita, nao ha' o que gravar
+        int ret = ( !fs ? -1 : !fs->flushFn ? 0 : fs->flushFn (fd) );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para persistir no disco os dados e metadados de um arquivo, a partir
+//de um descritor de arquivo existente (inclusive o buffer de escrita). O
+//sistema de arquivos pode manter alteracoes apenas em memoria (write-back);
+//depois de vfsFsync, elas sobrevivem a uma queda. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int vfsFsync (int fd) {
+        FSInfo *fs = __vfsEnter ();
+        //Sistema de arquivos sem write-back: tudo ja' esta' no disco
+        int ret = ( !fs ? -1 : !fs->fsyncFn ? 0 : fs->fsyncFn (fd) );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para persistir no disco todas as alteracoes pendentes do sistema de
+//arquivos raiz, de todos os arquivos. Retorna 0 caso bem sucedido, ou -1
+//caso contrario.
+int vfsSync ( void ) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( !fs ? -1 : !fs->syncfsFn ? 0 : fs->syncfsFn (rootDisk) );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para ativar (enable = 1) ou desativar (enable = 0) a alocacao atrasada
+//de blocos no sistema de arquivos raiz. Retorna 0 caso bem sucedido, ou -1
+//caso contrario (inclusive se o sistema de arquivos nao a suportar).
+int vfsSetDelayedAlloc (int enable) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->delayedallocFn ? fs->delayedallocFn (rootDisk, enable) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para mapear em memoria length bytes de um arquivo, a partir da posicao
+//offset (multipla do tamanho de bloco), a partir de um descritor de arquivo
+//existente. Os blocos sao trazidos para a memoria sob demanda, em vfsMfault.
+//Com prot incluindo VFS_PROT_WRITE, os trechos marcados como alterados voltam
+//ao arquivo em vfsMsync e vfsMunmap, sem aumenta'-lo. O trecho continua
+//mapeado depois do fechamento do descritor, ate' vfsMunmap. Retorna o
+//endereco do trecho mapeado ou NULL, caso contrario (inclusive se o sistema
+//de arquivos nao suportar mapeamentos).
+void* vfsMmap (int fd, unsigned int offset, unsigned int length, int prot) {
+        FSInfo *fs = __vfsEnter ();
+        void* ret = ( fs && fs->mmapFn ? fs->mmapFn (fd, offset, length, prot) : NULL );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para mapear em memoria um trecho de um arquivo, como vfsMmap, mas com
+//posicao e tamanho de 64 bits. Retorna o endereco do trecho mapeado ou NULL,
+//caso contrario.
+void* vfsMmap64 (int fd, unsigned long long offset, unsigned long long length,
+                 int prot) {
+        FSInfo *fs = __vfsEnter ();
+        void* ret = ( fs && fs->mmap64Fn ? fs->mmap64Fn (fd, offset, length, prot) : NULL );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para trazer para a memoria o trecho entre addr e addr + length de um
+//mapeamento de vfsMmap, antes de acessa-lo, marcando-o como alterado se prot
+//incluir VFS_PROT_WRITE. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsMfault (void *addr, unsigned int length, int prot) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->mfaultFn ? fs->mfaultFn (addr, length, prot) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para gravar no arquivo os trechos marcados como alterados entre addr e
+//addr + length, dentro de um trecho mapeado por vfsMmap. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int vfsMsync (void *addr, unsigned int length) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->msyncFn ? fs->msyncFn (addr, length) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para desfazer um mapeamento, a partir do endereco retornado por
+//vfsMmap, gravando antes as alteracoes. Retorna 0 caso bem sucedido, ou -1
+//caso contrario.
+int vfsMunmap (void *addr) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->munmapFn ? fs->munmapFn (addr) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para tornar o arquivo do descritor fd um clone do arquivo do
+//descritor srcFd, ambos existentes: o conteudo anterior de fd e' descartado e
+//ele passa a ter o mesmo tamanho e conteudo de srcFd, sem copia dos dados,
+//que so' sao copiados quando um dos arquivos altera um bloco compartilhado.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario (inclusive se o sistema de
+//arquivos nao suportar clones).
+int vfsClone (int fd, int srcFd) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->cloneFn ? fs->cloneFn (fd, srcFd) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para criar o arquivo indicado por path como clone do arquivo do
+//descritor srcFd existente, com i-node proprio e os blocos de dados
+//compartilhados. Retorna um descritor do novo arquivo em caso de sucesso ou
+//-1, caso contrario.
+int vfsCloneFile (int srcFd, const char *path) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->clonefileFn ? fs->clonefileFn (rootDisk, srcFd, path) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
 //Retorna 0 caso bem sucedido, ou -1 caso contrario
 int vfsClose (int fd) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->closeFn (fd);
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->closeFn ? fs->closeFn (fd) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para abertura de um diretorio, a partir do caminho especificado em
 //path, no modo Read/Write, criando o diretorio se nao existir. Retorna um
 //descritor de arquivo, em caso de sucesso. Retorna -1, caso contrario.
 int vfsOpendir (const char *path) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->opendirFn (rootDisk, path);
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->opendirFn ? fs->opendirFn (rootDisk, path) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para a leitura de um diretorio, identificado por um descritor de
@@ -125,8 +422,10 @@ int vfsOpendir (const char *path) {
 //correspondente 'a entrada e' copiado para inumber. Retorna 1 se uma entrada
 //foi lida, 0 se fim do diretorio ou -1 caso mal sucedido.
 int vfsReaddir (int fd, char *filename, unsigned int *inumber) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->readdirFn (fd, filename, inumber);
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->readdirFn ? fs->readdirFn (fd, filename, inumber) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para adicionar uma entrada a um diretorio, identificado por um 
@@ -134,52 +433,131 @@ int vfsReaddir (int fd, char *filename, unsigned int *inumber) {
 //filename e apontara' para o numero de i-node indicado por inumber. Retorna 0\
 //caso bem sucedido, ou -1 caso contrario.
 int vfsLink (int fd, const char *filename, unsigned int inumber) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->linkFn (fd, filename, inumber);
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->linkFn ? fs->linkFn (fd, filename, inumber) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para remover uma entrada existente em um diretorio, este identificado
 //por um descritor de arquivo existente. A entrada e' identificada pelo nome 
 //indicado em filename. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsUnlink (int fd, const char *filename) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->unlinkFn (fd, filename);
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->unlinkFn ? fs->unlinkFn (fd, filename) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Funcao para fechar um diretorio, identificado por um descritor de arquivo
 //existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsClosedir (int fd) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->closedirFn (fd);
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->closedirFn ? fs->closedirFn (fd) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para pre-alocacao de espaco para um arquivo, a partir de um descritor
+//de arquivo existente. Garante que os blocos que cobrem os length bytes a
+//partir de offset estejam alocados, sem alterar o tamanho do arquivo. Retorna
+//0 caso bem sucedido, ou -1 caso contrario (inclusive se o sistema de arquivos
+//nao suportar pre-alocacao).
+int vfsFallocate (int fd, unsigned int offset, unsigned int length) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->fallocateFn ? fs->fallocateFn (fd, offset, length) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para pre-alocacao de espaco para um arquivo, como vfsFallocate, mas
+//com posicao e tamanho de 64 bits. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario (inclusive se o sistema de arquivos nao suportar arquivos
+//grandes).
+int vfsFallocate64 (int fd, unsigned long long offset,
+                    unsigned long long length) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->fallocate64Fn ? fs->fallocate64Fn (fd, offset, length) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para obtencao das estatisticas de ocupacao (blocos, i-nodes e
+//arquivos) do sistema de arquivos raiz, copiadas para st. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int vfsStatfs (FSStat *st) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->statfsFn && st ? fs->statfsFn (rootDisk, st) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para alteracao do tamanho de um arquivo para length bytes, a partir
+//de um descritor de arquivo existente. Na reducao, o espaco alem do novo fim
+//e' liberado; no aumento, o arquivo e' completado com zeros. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario.
+int vfsTruncate (int fd, unsigned int length) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->truncateFn ? fs->truncateFn (fd, length) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para alteracao do tamanho de um arquivo, como vfsTruncate, mas com
+//tamanho de 64 bits. Retorna 0 caso bem sucedido, ou -1 caso contrario
+//(inclusive se o sistema de arquivos nao suportar arquivos grandes).
+int vfsTruncate64 (int fd, unsigned long long length) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->truncate64Fn ? fs->truncate64Fn (fd, length) : -1 );
+        __vfsLeave ();
+        return ret;
+}
+
+//Funcao para a leitura de um lote de ate' max entradas de um diretorio,
+//identificado por um descritor de arquivo existente, junto com os atributos
+//(tipo, tamanho, links...) dos seus i-nodes, copiadas para entries. Retorna o
+//numero de entradas lidas, 0 se fim de diretorio ou -1 caso mal sucedido
+//(inclusive se o sistema de arquivos nao suportar a operacao).
+int vfsReaddirPlus (int fd, FSDirEntry *entries, unsigned int max) {
+        FSInfo *fs = __vfsEnter ();
+        int ret = ( fs && fs->readdirplusFn ? fs->readdirplusFn (fd, entries, max) : -1 );
+        __vfsLeave ();
+        return ret;
 }
 
 //Registra novo sistema de arquivos. Retorna um identificador unico (slot),
 //caso o sistema de arquivos tenha sido registrado com sucesso. Caso contrario,
 //retorna -1
 int vfsRegisterFS (FSInfo* fsInfo) {
-	int i;
+	int i, ret = -1;
 	if ( !fsInfo ) return -1;
+	pthread_rwlock_wrlock (&mountLock);
 	for (i=MAX_INSTALLED_FS; i>0; i--)
 		if ( !installedFSInfo[i-1] ) {
 			installedFSInfo[i-1] = fsInfo;
-			return 0;
+			ret = 0;
+			break;
 		}
-	return -1;
+	pthread_rwlock_unlock (&mountLock);
+	return ret;
 }
 
 //Desfaz o registro de um sistema de arquivos. Um sistema de arquivos montado
 //nao pode ter seu registro desfeito. Retorna 0 se bem sucedido e -1 caso
 //contrario
 int vfsUnregisterFS(char fsId) {
-	if (fsId == rootFS->fsid) return -1;
-	for (int i=0; i<MAX_INSTALLED_FS; i++) {
+	int ret = -1;
+	pthread_rwlock_wrlock (&mountLock);
+	for (int i=0; i<MAX_INSTALLED_FS && !(rootFS && fsId == rootFS->fsid); i++) {
 		if ( !installedFSInfo[i] ) continue;
 		if ( fsId == installedFSInfo[i]->fsid ) {
 			installedFSInfo[i] = NULL;
-			return 0;
+			ret = 0;
+			break;
 		}
 	}
-	return -1;
+	pthread_rwlock_unlock (&mountLock);
+	return ret;
 }
 
 //Escreve na saida padrao as informacoes sobre sistemas de arquivos registrados
@@ -15,12 +15,50 @@
 
 #include "disk.h"
 
-#define MAX_FDS 128             //Numero maximo de descritores de arquivos
+#define MAX_FDS 128             //Numero maximo de descritores do shell (main.c)
 #define MAX_FILENAME_LENGTH 255 //Comprimento maximo do nome de arquivos
 
 #define FILETYPE_DIR 128    //Identificador de tipo de arquivo: diretorio
 #define FILETYPE_REGULAR 64 //Identificador de tipo de arquivo: arq regular
 
+#define VFS_SEEK_SET 0	//Reposicionamento a partir do inicio do arquivo
+#define VFS_SEEK_CUR 1	//Reposicionamento a partir da posicao atual
+#define VFS_SEEK_END 2	//Reposicionamento a partir do fim do arquivo
+#define VFS_SEEK_DATA 3	//Proxima posicao com dados, a partir de offset
+#define VFS_SEEK_HOLE 4	//Proxima posicao em buraco, a partir de offset
+
+#define VFS_PROT_READ 1		//Mapeamento em memoria com leitura
+#define VFS_PROT_WRITE 2	//Mapeamento em memoria com escrita
+
+//Estrutura com as estatisticas de ocupacao de um sistema de arquivos montado
+typedef struct fs_stat {
+	unsigned int blockSize;		// Tamanho de bloco em bytes
+	unsigned int totalBlocks;	// Numero total de blocos de dados
+	unsigned int freeBlocks;	// Numero de blocos livres para uso
+	unsigned int totalInodes;	// Numero total de i-nodes
+	unsigned int freeInodes;	// Numero de i-nodes livres
+	unsigned int numFiles;		// Numero de arquivos existentes
+} FSStat;
+
+//Estrutura com uma entrada de diretorio e os atributos do seu i-node,
+//devolvida em lotes pela leitura de diretorio com atributos (readdirplus)
+typedef struct fs_dirent {
+	char name[MAX_FILENAME_LENGTH+1];	// Nome da entrada, terminado em \0
+	unsigned int inumber;		// Numero do i-node da entrada
+	unsigned int fileType;		// FILETYPE_DIR ou FILETYPE_REGULAR
+	unsigned long long fileSize;	// Tamanho do arquivo em bytes
+	unsigned int refCount;		// Numero de links do arquivo
+	unsigned int owner;		// Proprietario do arquivo
+	unsigned int permission;	// Permissoes de acesso do arquivo
+} FSDirEntry;
+
+//Estrutura com um trecho de memoria da leitura/escrita vetorizada
+//(readv/writev)
+typedef struct fs_iovec {
+	void *base;			// Inicio do trecho
+	unsigned int len;		// Tamanho do trecho em bytes
+} FSIovec;
+
 //Estrutura para definicao da API de sistemas de arquivos.
 //Deve ser preenchida com os ponteiros das respectivas funcoes e passada
 //para registro por meio da funcao vfsRegister()
@@ -100,6 +138,146 @@ typedef struct fs_info {
 	//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.	
 	int (*closedirFn) (int fd);
 
+	//Funcao para pre-alocacao de espaco para um arquivo, a partir de um
+	//descritor de arquivo existente. Garante que os blocos que cobrem os
+	//length bytes a partir de offset estejam alocados, preferencialmente
+	//contiguos, sem alterar o tamanho do arquivo. Retorna 0 caso bem
+	//sucedido, ou -1 caso contrario.
+	int (*fallocateFn) (int fd, unsigned int offset, unsigned int length);
+
+	//Funcao para obtencao das estatisticas de ocupacao do sistema de
+	//arquivos montado no disco d, copiadas para st. Deve ser barata o
+	//bastante para ser chamada com frequencia, sem varrer o disco.
+	//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+	int (*statfsFn) (Disk *d, FSStat *st);
+
+	//Funcao para alteracao do tamanho de um arquivo para length bytes, a
+	//partir de um descritor de arquivo existente. Na reducao, o espaco
+	//alem do novo fim e' liberado; no aumento, o arquivo e' completado com
+	//zeros. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+	int (*truncateFn) (int fd, unsigned int length);
+
+	//Funcao para a leitura de um lote de entradas de um diretorio, junto
+	//com os atributos dos seus i-nodes, a partir de um descritor de
+	//arquivo existente. Sao lidas ate' max entradas a partir da posicao
+	//atual do cursor, copiadas para entries. Retorna o numero de entradas
+	//lidas, 0 se fim do diretorio ou -1 caso mal sucedido.
+	int (*readdirplusFn) (int fd, FSDirEntry *entries, unsigned int max);
+
+	//Funcoes para a leitura e a escrita de um arquivo a partir da posicao
+	//offset, dada na chamada, em vez do cursor do descritor de arquivo
+	//existente, que nao e' alterado. Retornam o numero de bytes
+	//efetivamente lidos/escritos em caso de sucesso ou -1, caso contrario.
+	int (*preadFn) (int fd, char *buf, unsigned int nbytes,
+	                unsigned int offset);
+	int (*pwriteFn) (int fd, const char *buf, unsigned int nbytes,
+	                 unsigned int offset);
+
+	//Funcao para reposicionar o cursor de um descritor de arquivo existente
+	//em offset bytes a partir do inicio (VFS_SEEK_SET), da posicao atual
+	//(VFS_SEEK_CUR) ou do fim do arquivo (VFS_SEEK_END), ou na primeira
+	//posicao com dados (VFS_SEEK_DATA) ou em buraco (VFS_SEEK_HOLE) a
+	//partir de offset. Retorna a nova posicao do cursor em caso de sucesso
+	//ou -1, caso contrario.
+	int (*lseekFn) (int fd, int offset, int whence);
+
+	//Funcao para ativar (enable = 1) ou desativar (enable = 0) o buffer de
+	//escrita de um descritor de arquivo existente, que acumula escritas
+	//pequenas e sequenciais ate' completar um bloco. Retorna 0 caso bem
+	//sucedido, ou -1 caso contrario.
+	int (*setbufferedFn) (int fd, int enable);
+
+	//Funcao para gravar os dados pendentes no buffer de escrita de um
+	//descritor de arquivo existente. Retorna 0 caso bem sucedido, ou -1
+	//caso contrario.
+	int (*flushFn) (int fd);
+
+	//Funcao para persistir no disco os dados e metadados de um arquivo, a
+	//partir de um descritor de arquivo existente. Alteracoes feitas sem
+	//ela podem ficar apenas em memoria ate' a desmontagem. Retorna 0 caso
+	//bem sucedido, ou -1 caso contrario.
+	int (*fsyncFn) (int fd);
+
+	//Funcao para persistir no disco todas as alteracoes pendentes do
+	//sistema de arquivos montado no disco d. Retorna 0 caso bem sucedido,
+	//ou -1 caso contrario.
+	int (*syncfsFn) (Disk *d);
+
+	//Funcao para mapear em memoria length bytes de um arquivo, a partir da
+	//posicao offset (multipla do tamanho de bloco), a partir de um
+	//descritor de arquivo existente, com acesso prot (VFS_PROT_READ e/ou
+	//VFS_PROT_WRITE). Retorna o endereco do trecho mapeado ou NULL, caso
+	//contrario.
+	void* (*mmapFn) (int fd, unsigned int offset, unsigned int length,
+	                 int prot);
+
+	//Funcao para gravar no arquivo as alteracoes feitas na memoria entre
+	//addr e addr + length, dentro de um trecho mapeado. Retorna 0 caso bem
+	//sucedido, ou -1 caso contrario.
+	int (*msyncFn) (void *addr, unsigned int length);
+
+	//Funcao para desfazer um mapeamento, a partir do endereco retornado
+	//por mmapFn, gravando antes as alteracoes. Retorna 0 caso bem
+	//sucedido, ou -1 caso contrario.
+	int (*munmapFn) (void *addr);
+
+	//Funcoes para a leitura e a escrita vetorizadas de um arquivo, a partir
+	//de um descritor de arquivo existente: os iovcnt trechos de iov sao
+	//lidos/escritos em sequencia, a partir do cursor, como uma unica
+	//operacao. Retornam o numero total de bytes efetivamente lidos/escritos
+	//em caso de sucesso ou -1, caso contrario.
+	int (*readvFn) (int fd, const FSIovec *iov, unsigned int iovcnt);
+	int (*writevFn) (int fd, const FSIovec *iov, unsigned int iovcnt);
+
+	//Funcao para tornar o arquivo do descritor fd um clone do arquivo do
+	//descritor srcFd, ambos existentes, compartilhando seus blocos de dados
+	//ate' que um dos dois os altere (copy-on-write). Retorna 0 caso bem
+	//sucedido, ou -1 caso contrario.
+	int (*cloneFn) (int fd, int srcFd);
+
+	//Funcoes equivalentes a readFn, writeFn, preadFn, pwriteFn, lseekFn,
+	//truncateFn e fallocateFn, com posicoes, tamanhos e retornos de 64
+	//bits, para arquivos maiores que 4 GB e transferencias maiores que
+	//2 GB. Retornam o mesmo que as originais.
+	long long (*read64Fn) (int fd, char *buf, unsigned long long nbytes);
+	long long (*write64Fn) (int fd, const char *buf,
+	                        unsigned long long nbytes);
+	long long (*pread64Fn) (int fd, char *buf, unsigned long long nbytes,
+	                        unsigned long long offset);
+	long long (*pwrite64Fn) (int fd, const char *buf,
+	                         unsigned long long nbytes,
+	                         unsigned long long offset);
+	long long (*lseek64Fn) (int fd, long long offset, int whence);
+	int (*truncate64Fn) (int fd, unsigned long long length);
+	int (*fallocate64Fn) (int fd, unsigned long long offset,
+	                      unsigned long long length);
+
+	//Funcao para ativar (enable = 1) ou desativar (enable = 0) a alocacao
+	//atrasada de blocos no sistema de arquivos montado no disco d: escritas
+	//alem dos blocos ja' alocados apenas reservam espaco e os blocos sao
+	//alocados e gravados de uma vez no fechamento ou na sincronizacao.
+	//Retorna 0 caso bem sucedido, ou -1 caso contrario.
+	int (*delayedallocFn) (Disk *d, int enable);
+
+	//Funcao para criar o arquivo indicado por path, no disco montado d,
+	//como clone do arquivo do descritor srcFd existente, com i-node
+	//proprio e os blocos de dados compartilhados (copy-on-write). path nao
+	//pode existir. Retorna um descritor do novo arquivo em caso de
+	//sucesso ou -1, caso contrario.
+	int (*clonefileFn) (Disk *d, int srcFd, const char *path);
+
+	//Funcao para trazer para a memoria os blocos de um trecho mapeado por
+	//mmapFn, entre addr e addr + length, antes de acessa-los; com prot
+	//incluindo VFS_PROT_WRITE, os blocos passam a ser gravados em msyncFn e
+	//munmapFn. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+	int (*mfaultFn) (void *addr, unsigned int length, int prot);
+
+	//Funcao equivalente a mmapFn, com posicao e tamanho de 64 bits, para
+	//mapear trechos de arquivos maiores que 4 GB. Retorna o mesmo que
+	//mmapFn.
+	void* (*mmap64Fn) (int fd, unsigned long long offset,
+	                   unsigned long long length, int prot);
+
 } FSInfo;
 
 //Funcao para inicializacao do sistema de arquivos virtual
@@ -137,6 +315,163 @@ int vfsRead (int fd, char *buf, unsigned int nbytes);
 //de sucesso ou -1, caso contrario
 int vfsWrite (int fd, const char *buf, unsigned int nbytes);
 
+//Funcao para a leitura de um arquivo, como vfsRead, mas com tamanho e retorno
+//de 64 bits: uma unica chamada pode ler mais de 2 GB. Retorna o numero de
+//bytes efetivamente lidos em caso de sucesso ou -1, caso contrario
+//(inclusive se o sistema de arquivos nao suportar arquivos grandes).
+long long vfsRead64 (int fd, char *buf, unsigned long long nbytes);
+
+//Funcao para a escrita de um arquivo, como vfsWrite, mas com tamanho e
+//retorno de 64 bits: uma unica chamada pode escrever mais de 2 GB. Retorna o
+//numero de bytes efetivamente escritos em caso de sucesso ou -1, caso
+//contrario (inclusive se o sistema de arquivos nao suportar arquivos
+//grandes).
+long long vfsWrite64 (int fd, const char *buf, unsigned long long nbytes);
+
+//Funcao para a leitura vetorizada de um arquivo, a partir de um descritor de
+//arquivo existente: os dados a partir do cursor preenchem em sequencia os
+//iovcnt trechos de iov, como em uma unica leitura, e o cursor avanca. Retorna
+//o numero total de bytes efetivamente lidos em caso de sucesso ou -1, caso
+//contrario.
+int vfsReadv (int fd, const FSIovec *iov, unsigned int iovcnt);
+
+//Funcao para a escrita vetorizada de um arquivo, a partir de um descritor de
+//arquivo existente: os iovcnt trechos de iov sao escritos em sequencia a
+//partir do cursor, como em uma unica escrita, e o cursor avanca. Retorna o
+//numero total de bytes efetivamente escritos em caso de sucesso ou -1, caso
+//contrario.
+int vfsWritev (int fd, const FSIovec *iov, unsigned int iovcnt);
+
+//Funcao para a leitura de um arquivo a partir da posicao offset, dada na
+//chamada, e nao do cursor do descritor de arquivo existente, que nao e'
+//alterado. Os dados lidos sao copiados para buf e terao tamanho maximo de
+//nbytes. Retorna o numero de bytes efetivamente lidos em caso de sucesso ou
+//-1, caso contrario.
+int vfsPread (int fd, char *buf, unsigned int nbytes, unsigned int offset);
+
+//Funcao para a escrita de um arquivo a partir da posicao offset, dada na
+//chamada, e nao do cursor do descritor de arquivo existente, que nao e'
+//alterado. Os dados de buf serao copiados para o disco e terao tamanho maximo
+//de nbytes. Retorna o numero de bytes efetivamente escritos em caso de
+//sucesso ou -1, caso contrario
+int vfsPwrite (int fd, const char *buf, unsigned int nbytes,
+               unsigned int offset);
+
+//Funcoes para a leitura e a escrita de um arquivo a partir da posicao offset,
+//como vfsPread e vfsPwrite, mas com posicao, tamanho e retorno de 64 bits,
+//para arquivos maiores que 4 GB. Retornam o numero de bytes efetivamente
+//lidos/escritos em caso de sucesso ou -1, caso contrario (inclusive se o
+//sistema de arquivos nao suportar arquivos grandes).
+long long vfsPread64 (int fd, char *buf, unsigned long long nbytes,
+                      unsigned long long offset);
+long long vfsPwrite64 (int fd, const char *buf, unsigned long long nbytes,
+                       unsigned long long offset);
+
+//Funcao para reposicionar o cursor de um descritor de arquivo existente em
+//offset bytes a partir do inicio (VFS_SEEK_SET), da posicao atual
+//(VFS_SEEK_CUR) ou do fim do arquivo (VFS_SEEK_END), ou na primeira posicao
+//com dados (VFS_SEEK_DATA) ou em buraco (VFS_SEEK_HOLE) a partir de offset.
+//Retorna a nova posicao do cursor em caso de sucesso ou -1, caso contrario
+//(inclusive se a nova posicao nao couber em int; veja vfsLseek64).
+int vfsLseek (int fd, int offset, int whence);
+
+//Funcao para reposicionar o cursor de um descritor de arquivo existente, como
+//vfsLseek, mas com posicao e retorno de 64 bits. Retorna a nova posicao do
+//cursor em caso de sucesso ou -1, caso contrario (inclusive se o sistema de
+//arquivos nao suportar arquivos grandes).
+long long vfsLseek64 (int fd, long long offset, int whence);
+
+//Funcao para ativar (enable = 1) ou desativar (enable = 0) o buffer de escrita
+//de um descritor de arquivo existente. Com ele ativo, escritas pequenas e
+//sequenciais sao acumuladas em memoria e gravadas por bloco; os dados
+//pendentes sao gravados ao completar um bloco, ao reposicionar o cursor, em
+//leituras pelo mesmo descritor, em vfsFlush e no fechamento. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario (inclusive se o sistema de arquivos nao
+//suportar o buffer).
+int vfsSetBuffered (int fd, int enable);
+
+//Funcao para gravar os dados pendentes no buffer de escrita de um descritor
+//de arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsFlush (int fd);
+
+//Funcao para persistir no disco os dados e metadados de um arquivo, a partir
+//de um descritor de arquivo existente (inclusive o buffer de escrita). O
+//sistema de arquivos pode manter alteracoes apenas em memoria (write-back);
+//depois de vfsFsync, elas sobrevivem a uma queda. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int vfsFsync (int fd);
+
+//Funcao para persistir no disco todas as alteracoes pendentes do sistema de
+//arquivos raiz, de todos os arquivos. Retorna 0 caso bem sucedido, ou -1
+//caso contrario.
+int vfsSync ( void );
+
+//Funcao para ativar (enable = 1) ou desativar (enable = 0) a alocacao atrasada
+//de blocos no sistema de arquivos raiz. Com ela ativa, escritas alem dos
+//blocos ja' alocados de um arquivo apenas reservam espaco e mantem os dados em
+//memoria; os blocos sao alocados, contiguos, e gravados de uma vez no
+//fechamento, em vfsFsync ou vfsSync. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario (inclusive se o sistema de arquivos nao suportar a alocacao
+//atrasada).
+int vfsSetDelayedAlloc (int enable);
+
+//Funcao para mapear em memoria length bytes de um arquivo, a partir da posicao
+//offset (multipla do tamanho de bloco), a partir de um descritor de arquivo
+//existente. O trecho funciona como uma cache de blocos do arquivo: nada e'
+//lido no mapeamento, e cada trecho precisa ser trazido para a memoria com
+//vfsMfault antes de acessado; depois disso, os acessos sao leituras e
+//escritas comuns na memoria. Com prot incluindo VFS_PROT_WRITE, os trechos
+//declarados como alterados em vfsMfault voltam ao arquivo em vfsMsync e
+//vfsMunmap, sem aumenta'-lo. O trecho continua mapeado depois do fechamento
+//do descritor, ate' vfsMunmap. Retorna o endereco do trecho mapeado ou NULL,
+//caso contrario (inclusive se o sistema de arquivos nao suportar
+//mapeamentos).
+void* vfsMmap (int fd, unsigned int offset, unsigned int length, int prot);
+
+//Funcao para mapear em memoria um trecho de um arquivo, como vfsMmap, mas com
+//posicao e tamanho de 64 bits, para arquivos maiores que 4 GB. Retorna o
+//endereco do trecho mapeado ou NULL, caso contrario (inclusive se o sistema de
+//arquivos nao suportar arquivos grandes).
+void* vfsMmap64 (int fd, unsigned long long offset, unsigned long long length,
+                 int prot);
+
+//Funcao para trazer para a memoria o trecho entre addr e addr + length de um
+//mapeamento de vfsMmap, antes de acessa-lo. Os blocos ainda ausentes sao lidos
+//do arquivo, junto com alguns dos seguintes (leitura antecipada, que cresce
+//com o acesso sequencial); os ja' presentes nao custam E/S. Com prot incluindo
+//VFS_PROT_WRITE, o trecho e' marcado como alterado, para gravacao no proximo
+//vfsMsync ou em vfsMunmap. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+int vfsMfault (void *addr, unsigned int length, int prot);
+
+//Funcao para gravar no arquivo os trechos marcados como alterados por vfsMfault
+//entre addr e addr + length, dentro de um trecho mapeado por vfsMmap. Depois
+//dela, novas alteracoes precisam ser marcadas de novo. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int vfsMsync (void *addr, unsigned int length);
+
+//Funcao para desfazer um mapeamento, a partir do endereco retornado por
+//vfsMmap, gravando antes as alteracoes. Retorna 0 caso bem sucedido, ou -1
+//caso contrario.
+int vfsMunmap (void *addr);
+
+//Funcao para tornar o arquivo do descritor fd um clone do arquivo do
+//descritor srcFd, ambos existentes: o conteudo anterior de fd e' descartado e
+//ele passa a ter o mesmo tamanho e conteudo de srcFd, sem copia dos dados,
+//que so' sao copiados quando um dos arquivos altera um bloco compartilhado.
+//Retorna 0 caso bem sucedido, ou -1 caso contrario (inclusive se o sistema de
+//arquivos nao suportar clones). Para criar o clone como um novo arquivo, ver
+//vfsCloneFile.
+int vfsClone (int fd, int srcFd);
+
+//Funcao para criar o arquivo indicado por path como clone do arquivo do
+//descritor srcFd existente: o novo arquivo tem i-node proprio e o mesmo tamanho
+//e conteudo de srcFd, sem copia dos dados, que so' sao copiados quando um dos
+//arquivos altera um bloco compartilhado. path nao pode existir e os diretorios
+//intermediarios precisam existir. Retorna um descritor do novo arquivo em caso
+//de sucesso ou -1, caso contrario (inclusive se o sistema de arquivos nao
+//suportar clones).
+int vfsCloneFile (int srcFd, const char *path);
+
 //Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
 //Retorna 0 caso bem sucedido, ou -1 caso contrario
 int vfsClose (int fd);
@@ -169,6 +504,43 @@ int vfsUnlink (int fd, const char *filename);
 //existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsClosedir (int fd);
 
+//Funcao para pre-alocacao de espaco para um arquivo, a partir de um descritor
+//de arquivo existente. Garante que os blocos que cobrem os length bytes a
+//partir de offset estejam alocados, sem alterar o tamanho do arquivo. Retorna
+//0 caso bem sucedido, ou -1 caso contrario (inclusive se o sistema de arquivos
+//nao suportar pre-alocacao).
+int vfsFallocate (int fd, unsigned int offset, unsigned int length);
+
+//Funcao para pre-alocacao de espaco para um arquivo, como vfsFallocate, mas
+//com posicao e tamanho de 64 bits. Retorna 0 caso bem sucedido, ou -1 caso
+//contrario (inclusive se o sistema de arquivos nao suportar arquivos
+//grandes).
+int vfsFallocate64 (int fd, unsigned long long offset,
+                    unsigned long long length);
+
+//Funcao para obtencao das estatisticas de ocupacao (blocos, i-nodes e
+//arquivos) do sistema de arquivos raiz, copiadas para st. Retorna 0 caso bem
+//sucedido, ou -1 caso contrario.
+int vfsStatfs (FSStat *st);
+
+//Funcao para alteracao do tamanho de um arquivo para length bytes, a partir
+//de um descritor de arquivo existente. Na reducao, o espaco alem do novo fim
+//e' liberado; no aumento, o arquivo e' completado com zeros. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario.
+int vfsTruncate (int fd, unsigned int length);
+
+//Funcao para alteracao do tamanho de um arquivo, como vfsTruncate, mas com
+//tamanho de 64 bits. Retorna 0 caso bem sucedido, ou -1 caso contrario
+//(inclusive se o sistema de arquivos nao suportar arquivos grandes).
+int vfsTruncate64 (int fd, unsigned long long length);
+
+//Funcao para a leitura de um lote de ate' max entradas de um diretorio,
+//identificado por um descritor de arquivo existente, junto com os atributos
+//(tipo, tamanho, links...) dos seus i-nodes, copiadas para entries. Retorna o
+//numero de entradas lidas, 0 se fim de diretorio ou -1 caso mal sucedido
+//(inclusive se o sistema de arquivos nao suportar a operacao).
+int vfsReaddirPlus (int fd, FSDirEntry *entries, unsigned int max);
+
 //Registra novo sistema de arquivos. Retorna um identificador unico (slot),
 //caso o sistema de arquivos tenha sido registrado com sucesso. Caso contrario,
 //retorna -1